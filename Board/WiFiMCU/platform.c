@@ -468,7 +468,7 @@ const mico_spi_device_t mico_spi_flash =
 {
   .port        = MICO_SPI_1,
   .chip_select = FLASH_PIN_SPI_CS,
-  .speed       = 40000000,
+  .speed       = 50000000, /* FAST_READ is used for reads, see spi_flash.c */
   .mode        = (SPI_CLOCK_RISING_EDGE | SPI_CLOCK_IDLE_HIGH | SPI_USE_DMA | SPI_MSB_FIRST ),
   .bits        = 8
 };
@@ -541,6 +541,26 @@ MICO_RTOS_DEFINE_ISR( DMA2_Stream2_IRQHandler )
   platform_uart_rx_dma_irq( &platform_uart_drivers[MICO_UART_2] );
 }
 
+MICO_RTOS_DEFINE_ISR( DMA2_Stream4_IRQHandler )
+{
+  platform_adc_stream_irq( );
+}
+
+MICO_RTOS_DEFINE_ISR( ADC_IRQHandler )
+{
+  platform_adc_stream_ovr_irq( );
+}
+
+MICO_RTOS_DEFINE_ISR( DMA1_Stream0_IRQHandler )
+{
+  platform_pwm_wave_irq( 0 );
+}
+
+MICO_RTOS_DEFINE_ISR( DMA1_Stream1_IRQHandler )
+{
+  platform_pwm_wave_irq( 1 );
+}
+
 
 /******************************************************
 *               Function Definitions
@@ -559,6 +579,9 @@ void platform_init_peripheral_irq_priorities( void )
   NVIC_SetPriority( DMA1_Stream5_IRQn,  7 ); /* MICO_UART_1 RX DMA  */
   NVIC_SetPriority( DMA2_Stream7_IRQn,  7 ); /* MICO_UART_2 TX DMA  */
   NVIC_SetPriority( DMA2_Stream2_IRQn,  7 ); /* MICO_UART_2 RX DMA  */
+  NVIC_SetPriority( DMA2_Stream4_IRQn, 13 ); /* ADC stream DMA      */
+  NVIC_SetPriority( DMA1_Stream0_IRQn, 13 ); /* PWM wave TIM5 DMA   */
+  NVIC_SetPriority( DMA1_Stream1_IRQn, 13 ); /* PWM wave TIM2 DMA   */
   NVIC_SetPriority( EXTI0_IRQn       , 14 ); /* GPIO                */
   NVIC_SetPriority( EXTI1_IRQn       , 14 ); /* GPIO                */
   NVIC_SetPriority( EXTI2_IRQn       , 14 ); /* GPIO                */
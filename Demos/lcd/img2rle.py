@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""
+img2rle.py - convert images to the compressed lcd.image format
+
+  python3 img2rle.py nature_160x123.img 160 nature.rle
+  python3 img2rle.py picture.png picture.rle        (needs Pillow)
+
+Raw .img input is RGB565, big endian, as used by lcd.image.
+The smaller of the RGB565 RLE and palette RLE encodings is written;
+the palette encoding is only possible for images with <= 256 colors.
+
+File format:
+  0  'R','L','E'
+  3  format: 1 = RGB565 RLE, 2 = palette RLE
+  4  width, height (uint16, little endian)
+  8  format 2 only: ncolors (0 = 256), ncolors RGB565 colors (big endian)
+  then packets until width*height pixels:
+     c >= 0x80: run, (c & 0x7F)+1 pixels of the one pixel value that follows
+     c <  0x80: literal, c+1 pixel values follow
+  pixel value: RGB565 big endian, or 1 byte palette index
+"""
+
+import struct
+import sys
+
+MAX_PACKET = 128
+MIN_RUN = 4  # same as IMG_MIN_RUN in lcd.c
+
+
+def load_raw(path, width):
+    data = open(path, "rb").read()
+    if width <= 0 or len(data) % (2 * width):
+        sys.exit("file size is not a multiple of the line size")
+    pixels = [(data[i] << 8) | data[i + 1] for i in range(0, len(data), 2)]
+    return width, len(pixels) // width, pixels
+
+
+def load_pil(path):
+    try:
+        from PIL import Image
+    except ImportError:
+        sys.exit("Pillow is needed for this input, or give a raw .img and its width")
+    img = Image.open(path).convert("RGB")
+    pixels = [((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3) for r, g, b in img.getdata()]
+    return img.size[0], img.size[1], pixels
+
+
+def encode(values, put):
+    """RLE packets over a list of pixel values, put(v) returns its bytes"""
+    out = bytearray()
+    lit = []
+
+    def flush():
+        while lit:
+            chunk = lit[:MAX_PACKET]
+            del lit[:MAX_PACKET]
+            out.append(len(chunk) - 1)
+            for v in chunk:
+                out.extend(put(v))
+
+    i = 0
+    while i < len(values):
+        n = 1
+        while i + n < len(values) and n < MAX_PACKET and values[i + n] == values[i]:
+            n += 1
+        if n >= MIN_RUN:
+            flush()
+            out.append(0x80 | (n - 1))
+            out += put(values[i])
+        else:
+            lit.extend(values[i:i + n])
+        i += n
+    flush()
+    return out
+
+
+def convert(width, height, pixels):
+    if width > 0xFFFF or height > 0xFFFF:
+        sys.exit("image too big")
+    best = bytes("RLE", "ascii") + struct.pack("<BHH", 1, width, height) + \
+        encode(pixels, lambda v: struct.pack(">H", v))
+
+    colors = sorted(set(pixels))
+    if len(colors) <= 256:
+        index = {c: i for i, c in enumerate(colors)}
+        pal = bytes("RLE", "ascii") + struct.pack("<BHH", 2, width, height)
+        pal += bytes([len(colors) & 0xFF])
+        pal += b"".join(struct.pack(">H", c) for c in colors)
+        pal += encode([index[p] for p in pixels], lambda v: bytes([v]))
+        if len(pal) < len(best):
+            best = pal
+    return best
+
+
+def main():
+    if len(sys.argv) == 4:
+        width, height, pixels = load_raw(sys.argv[1], int(sys.argv[2]))
+    elif len(sys.argv) == 3:
+        width, height, pixels = load_pil(sys.argv[1])
+    else:
+        sys.exit(__doc__)
+    out = convert(width, height, pixels)
+    open(sys.argv[-1], "wb").write(out)
+    print("%dx%d, %d -> %d bytes, format %d" % (width, height, 2 * len(pixels), len(out), out[3]))
+
+
+if __name__ == "__main__":
+    main()
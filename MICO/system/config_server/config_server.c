@@ -48,12 +48,38 @@
 
 #define kMIMEType_MXCHIP_OTA    "application/ota-stream"
 
+#define kCONFIGJsonChunkSize    128
+
 typedef struct _configContext_t{
   uint32_t offset;
   bool     isFlashLocked;
   CRC16_Context crc16_contex;
 } configContext_t;
 
+typedef struct _configRecvContext_t{
+  bool           *need_reboot;
+  mico_Context_t *context;
+} configRecvContext_t;
+
+/* Keys written straight into micoSystemConfig, others go to config_server_delegate_recv */
+static const struct json_field config_server_fields[] = {
+  JSON_FIELD( string,  "Device Name",    mico_sys_config_t, name ),
+  JSON_FIELD( boolean, "RF power save",  mico_sys_config_t, rfPowerSaveEnable ),
+  JSON_FIELD( boolean, "MCU power save", mico_sys_config_t, mcuPowerSaveEnable ),
+  JSON_FIELD( string,  "Wi-Fi",          mico_sys_config_t, ssid ),
+  JSON_FIELD( string,  "Password",       mico_sys_config_t, key ),
+  JSON_FIELD( string,  "Password",       mico_sys_config_t, user_key ),
+  JSON_FIELD( boolean, "DHCP",           mico_sys_config_t, dhcpEnable ),
+  JSON_FIELD( string,  "IP address",     mico_sys_config_t, localIp ),
+  JSON_FIELD( string,  "Net Mask",       mico_sys_config_t, netMask ),
+  JSON_FIELD( string,  "Gateway",        mico_sys_config_t, gateWay ),
+  JSON_FIELD( string,  "DNS Server",     mico_sys_config_t, dnsServer ),
+};
+
+/* Bits in the found mask, index into config_server_fields */
+#define kCONFIGFieldWiFi        (1UL << 3)
+#define kCONFIGFieldPassword    (1UL << 4)
+
 extern OSStatus     ConfigIncommingJsonMessage( const char *input, bool *need_reboot, mico_Context_t * const inContext );
 extern json_object* ConfigCreateReportJsonMessage( mico_Context_t * const inContext );
 
@@ -63,6 +89,8 @@ static mico_Context_t *Context;
 static OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico_Context_t * const inContext);
 static OSStatus onReceivedData(struct _HTTPHeader_t * httpHeader, uint32_t pos, uint8_t * data, size_t len, void * userContext );
 static void onClearHTTPHeader(struct _HTTPHeader_t * httpHeader, void * userContext );
+static int config_server_send_json(void *arg, const char *data, int len);
+static void config_server_recv_unknown(const char *key, json_object *val, void *arg);
 
 bool is_config_server_established = false;
 
@@ -322,7 +350,7 @@ static OSStatus onReceivedData(struct _HTTPHeader_t * inHeader, uint32_t inPos,
   configContext_t *context = (configContext_t *)inUserContext;
   mico_logic_partition_t* ota_partition = MicoFlashGetInfo( MICO_PARTITION_OTA_TEMP );
 
-  err = HTTPGetHeaderField( inHeader->buf, inHeader->len, "Content-Type", NULL, NULL, &value, &valueSize, NULL );
+  err = HTTPHeaderGetField( inHeader, "Content-Type", &value, &valueSize );
   if(err == kNoErr && strnicmpx( value, valueSize, kMIMEType_MXCHIP_OTA ) == 0){
     printf("%d/", inPos);
 
@@ -370,13 +398,29 @@ static void onClearHTTPHeader(struct _HTTPHeader_t * inHeader, void * inUserCont
   }
  }
 
+static int config_server_send_json(void *arg, const char *data, int len)
+{
+  return SocketSend( *(int *)arg, (const uint8_t *)data, len ) == kNoErr ? 0 : -1;
+}
+
+static void config_server_recv_unknown(const char *key, json_object *val, void *arg)
+{
+  configRecvContext_t *recv_context = (configRecvContext_t *)arg;
+  config_server_delegate_recv( key, val, recv_context->need_reboot, recv_context->context );
+}
+
 OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico_Context_t * const inContext)
 {
   OSStatus err = kUnknownErr;
-  const char *  json_str;
+  char json_chunk[kCONFIGJsonChunkSize];
+  int json_len;
   uint8_t *httpResponse = NULL;
   size_t httpResponseLen = 0;
-  json_object* report = NULL, *config = NULL;
+  json_object* report = NULL;
+  mico_sys_config_t *sys_config = &inContext->flashContentInRam.micoSystemConfig;
+  configRecvContext_t recv_context;
+  enum json_tokener_error json_err;
+  unsigned long found;
   bool need_reboot = false;
   uint16_t crc;
   configContext_t *http_context = (configContext_t *)inHeader->userContext;
@@ -460,16 +504,16 @@ OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico
 
     mico_rtos_unlock_mutex(&inContext->flashContentInRam_mutex);
 
-    json_str = json_object_to_json_string(report);
-    require_action( json_str, exit, err = kNoMemoryErr );
-    config_log("Send config object=%s", json_str);
-    err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_JSON, strlen(json_str), &httpResponse, &httpResponseLen );
+    /* Count first for Content-Length, then stream the body to the socket */
+    json_len = json_object_write( report, NULL, 0, NULL, NULL );
+    config_log("Send config object, %d bytes", json_len);
+    err =  CreateSimpleHTTPMessageNoCopy( kMIMEType_JSON, json_len, &httpResponse, &httpResponseLen );
     require_noerr( err, exit );
     require( httpResponse, exit );
     err = SocketSend( fd, httpResponse, httpResponseLen );
     require_noerr( err, exit );
-    err = SocketSend( fd, (uint8_t *)json_str, strlen(json_str) );
-    require_noerr( err, exit );
+    json_len = json_object_write( report, json_chunk, sizeof(json_chunk), config_server_send_json, &fd );
+    require_action( json_len >= 0, exit, err = kWriteErr );
     config_log("Current configuration sent");
     goto exit;
   }
@@ -483,57 +527,30 @@ OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico
       err = SocketSend( fd, httpResponse, httpResponseLen );
       require_noerr( err, exit );
 
-      config = json_tokener_parse(inHeader->extraDataPtr);
-      require_action(config, exit, err = kUnknownErr);
-      config_log("Recv config object=%s", json_object_to_json_string(config));
+      config_log("Recv config object=%s", inHeader->extraDataPtr);
+      recv_context.need_reboot = &need_reboot;
+      recv_context.context = inContext;
       mico_rtos_lock_mutex(&inContext->flashContentInRam_mutex);
-      json_object_object_foreach(config, key, val) {
-        if(!strcmp(key, "Device Name")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.name, json_object_get_string(val), maxNameLen);
-          need_reboot = true;
-        }else if(!strcmp(key, "RF power save")){
-          inContext->flashContentInRam.micoSystemConfig.rfPowerSaveEnable = json_object_get_boolean(val);
-          need_reboot = true;
-        }else if(!strcmp(key, "MCU power save")){
-          inContext->flashContentInRam.micoSystemConfig.mcuPowerSaveEnable = json_object_get_boolean(val);
-          need_reboot = true;
-        }else if(!strcmp(key, "Wi-Fi")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.ssid, json_object_get_string(val), maxSsidLen);
-          inContext->flashContentInRam.micoSystemConfig.channel = 0;
-          memset(inContext->flashContentInRam.micoSystemConfig.bssid, 0x0, 6);
-          inContext->flashContentInRam.micoSystemConfig.security = SECURITY_TYPE_AUTO;
-          memcpy(inContext->flashContentInRam.micoSystemConfig.key, inContext->flashContentInRam.micoSystemConfig.user_key, maxKeyLen);
-          inContext->flashContentInRam.micoSystemConfig.keyLength = inContext->flashContentInRam.micoSystemConfig.user_keyLength;
-          need_reboot = true;
-        }else if(!strcmp(key, "Password")){
-          inContext->flashContentInRam.micoSystemConfig.security = SECURITY_TYPE_AUTO;
-          strncpy(inContext->flashContentInRam.micoSystemConfig.key, json_object_get_string(val), maxKeyLen);
-          strncpy(inContext->flashContentInRam.micoSystemConfig.user_key, json_object_get_string(val), maxKeyLen);
-          inContext->flashContentInRam.micoSystemConfig.keyLength = strlen(inContext->flashContentInRam.micoSystemConfig.key);
-          inContext->flashContentInRam.micoSystemConfig.user_keyLength = strlen(inContext->flashContentInRam.micoSystemConfig.key);
-          need_reboot = true;
-        }else if(!strcmp(key, "DHCP")){
-          inContext->flashContentInRam.micoSystemConfig.dhcpEnable   = json_object_get_boolean(val);
-          need_reboot = true;
-        }else if(!strcmp(key, "IP address")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.localIp, json_object_get_string(val), maxIpLen);
-          need_reboot = true;
-        }else if(!strcmp(key, "Net Mask")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.netMask, json_object_get_string(val), maxIpLen);
-          need_reboot = true;
-        }else if(!strcmp(key, "Gateway")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.gateWay, json_object_get_string(val), maxIpLen);
-          need_reboot = true;
-        }else if(!strcmp(key, "DNS Server")){
-          strncpy(inContext->flashContentInRam.micoSystemConfig.dnsServer, json_object_get_string(val), maxIpLen);
-          need_reboot = true;
-        }else{
-          config_server_delegate_recv( key, val, &need_reboot, inContext );
+      json_err = json_tokener_parse_fields( inHeader->extraDataPtr, config_server_fields,
+                                            sizeof(config_server_fields) / sizeof(struct json_field),
+                                            sys_config, &found, config_server_recv_unknown, &recv_context );
+      if( json_err == json_tokener_success && found ){
+        if( found & kCONFIGFieldPassword ){
+          sys_config->security = SECURITY_TYPE_AUTO;
+          sys_config->keyLength = strlen(sys_config->key);
+          sys_config->user_keyLength = strlen(sys_config->key);
         }
+        if( found & kCONFIGFieldWiFi ){
+          sys_config->channel = 0;
+          memset(sys_config->bssid, 0x0, 6);
+          sys_config->security = SECURITY_TYPE_AUTO;
+          memcpy(sys_config->key, sys_config->user_key, maxKeyLen);
+          sys_config->keyLength = sys_config->user_keyLength;
+        }
+        need_reboot = true;
       }
       mico_rtos_unlock_mutex(&inContext->flashContentInRam_mutex);
-
-      json_object_put(config);
+      require_action( json_err == json_tokener_success, exit, err = kUnknownErr );
 
       inContext->flashContentInRam.micoSystemConfig.configured = allConfigured;
       mico_system_context_update( inContext );
@@ -594,7 +611,6 @@ OSStatus _LocalConfigRespondInComingMessage(int fd, HTTPHeader_t* inHeader, mico
     err = kConnectionErr;
   if(httpResponse)  free(httpResponse);
   if(report)        json_object_put(report);
-  if(config)        json_object_put(config);
 
   return err;
 
@@ -48,7 +48,7 @@ extern "C" {
 
 /* Define MICO service thread stack size */
 #define STACK_SIZE_LOCAL_CONFIG_SERVER_THREAD   0x300
-#define STACK_SIZE_LOCAL_CONFIG_CLIENT_THREAD   0x450
+#define STACK_SIZE_LOCAL_CONFIG_CLIENT_THREAD   0x550
 #define STACK_SIZE_NTP_CLIENT_THREAD            0x450
 #define STACK_SIZE_mico_system_MONITOR_THREAD   0x300
 
@@ -120,13 +120,23 @@ int sflash_read_status_register( const sflash_handle_t* const handle, void* cons
 
 int sflash_read( const sflash_handle_t* const handle, unsigned long device_address, void* const data_addr, unsigned int size )
 {
-    char device_address_array[3] =  { ( ( device_address & 0x00FF0000 ) >> 16 ),
+    /* FAST_READ takes one dummy byte after the address but is specified up to
+       the full bus clock, plain READ is limited to ~33MHz on most parts. The
+       whole range is clocked out under a single chip select, the platform
+       driver splits it into DMA sized chunks. */
+    char device_address_array[3 + SFLASH_FAST_READ_DUMMY_BYTES] =
+                                    { ( ( device_address & 0x00FF0000 ) >> 16 ),
                                       ( ( device_address & 0x0000FF00 ) >>  8 ),
-                                      ( ( device_address & 0x000000FF ) >>  0 ) };
+                                      ( ( device_address & 0x000000FF ) >>  0 ),
+                                      SFLASH_DUMMY_BYTE };
 
-    return generic_sflash_command( handle, SFLASH_READ, 3, device_address_array, size, NULL, data_addr );
-}
+    if ( size == 0 )
+    {
+        return 0;
+    }
 
+    return generic_sflash_command( handle, SFLASH_FAST_READ, sizeof( device_address_array ), device_address_array, size, NULL, data_addr );
+}
 
 // int sflash_get_size( const sflash_handle_t* const handle, unsigned long* const size )
 // {
@@ -191,64 +201,35 @@ int sflash_get_size( const sflash_handle_t* const handle, /*@out@*/ unsigned lon
 }
 
 
-int sflash_write_page( const sflash_handle_t* const handle, unsigned long device_address, const void* const data_addr, int size )
+static int sflash_write_page( const sflash_handle_t* const handle, unsigned long device_address, const void* const data_addr, int size, unsigned char protection_checked )
 {
     int status;
     int write_size;
-    int max_write_size = 256;
-    unsigned char enable_before_every_write = 1;
+    int max_write_size = sFLASH_SPI_PAGESIZE;
     unsigned char* data_addr_ptr = (unsigned char*) data_addr;
     unsigned char curr_device_address[3];
 
-    if ( handle->write_allowed == SFLASH_WRITE_ALLOWED )
-    {
-    }
-    else
+    if ( handle->write_allowed != SFLASH_WRITE_ALLOWED )
     {
         return -1;
     }
 
     /* Some manufacturers support programming an entire page in one command. */
 
-#ifdef SFLASH_SUPPORT_MACRONIX_PARTS
-    if ( SFLASH_MANUFACTURER( handle->device_id ) == SFLASH_MANUFACTURER_MACRONIX )
-    {
-        max_write_size = 256;  /* TODO: this should be 256, but that causes write errors */
-        enable_before_every_write = 1;
-    }
-#endif /* ifdef SFLASH_SUPPORT_MACRONIX_PARTS */
-
-#ifdef SFLASH_SUPPORT_WINBOND_PARTS
-    if ( SFLASH_MANUFACTURER( handle->device_id ) == SFLASH_MANUFACTURER_WINBOND )
-    {
-        max_write_size = 256;  /* TODO: this should be 256, but that causes write errors */
-        enable_before_every_write = 1;
-    }
-#endif /* ifdef SFLASH_SUPPORT_MACRONIX_PARTS */
-
 #ifdef SFLASH_SUPPORT_SST_PARTS
     if ( SFLASH_MANUFACTURER( handle->device_id ) == SFLASH_MANUFACTURER_SST )
     {
         max_write_size = 1;
-        enable_before_every_write = 1;
     }
 #endif /* ifdef SFLASH_SUPPORT_SST_PARTS */
 #ifdef SFLASH_SUPPORT_EON_PARTS
     if ( SFLASH_MANUFACTURER( handle->device_id ) == SFLASH_MANUFACTURER_EON )
     {
-        max_write_size = (unsigned int) 1;
-        enable_before_every_write = 1;
+        max_write_size = 1;
     }
 #endif /* ifdef SFLASH_SUPPORT_EON_PARTS */
 
-
-    if ( ( enable_before_every_write == 0 ) &&
-         ( 0 != ( status = sflash_write_enable( handle ) ) ) )
-    {
-        return status;
-    }
-
-    /* Generic x-bytes-at-a-time write */
+    /* Generic x-bytes-at-a-time write, WEL is cleared by every program cycle */
 
     while ( size > 0 )
     {
@@ -257,8 +238,16 @@ int sflash_write_page( const sflash_handle_t* const handle, unsigned long device
         curr_device_address[1] = ( ( device_address & 0x0000FF00 ) >>  8 );
         curr_device_address[2] = ( ( device_address & 0x000000FF ) >>  0 );
 
-        if ( ( enable_before_every_write == 1 ) &&
-             ( 0 != ( status = sflash_write_enable( handle ) ) ) )
+        if ( protection_checked == 0 )
+        {
+            /* Full write enable: also clears block protection bits if set */
+            if ( 0 != ( status = sflash_write_enable( handle ) ) )
+            {
+                return status;
+            }
+            protection_checked = 1;
+        }
+        else if ( 0 != ( status = generic_sflash_command( handle, SFLASH_WRITE_ENABLE, 0, NULL, 0, NULL, NULL ) ) )
         {
             return status;
         }
@@ -280,88 +269,40 @@ int sflash_write_page( const sflash_handle_t* const handle, unsigned long device
 /**
   * @brief  Writes block of data to the FLASH. In this function, the number of
   *         WRITE cycles are reduced, using Page WRITE sequence.
-  * @param  pBuffer: pointer to the buffer  containing the data to be written
+  * @param  handle: SPI flash handle
+  * @param  device_address: FLASH's internal address to write to.
+  * @param  data_addr: pointer to the buffer containing the data to be written
   *         to the FLASH.
-  * @param  WriteAddr: FLASH's internal address to write to.
-  * @param  NumByteToWrite: number of bytes to write to the FLASH.
-  * @retval None
+  * @param  size: number of bytes to write to the FLASH.
+  * @retval 0 on success, the first failing command status otherwise
   */
 int sflash_write( const sflash_handle_t* const handle, unsigned long device_address, const void* const data_addr, unsigned int size )
 {
-  int status;
-  uint8_t NumOfPage = 0, NumOfSingle = 0, Addr = 0, count = 0, temp = 0;
+  int status = 0;
+  unsigned int write_size;
+  unsigned char protection_checked = 0;
   unsigned char* data_addr_ptr = (unsigned char*) data_addr;
 
-  Addr = device_address % sFLASH_SPI_PAGESIZE;
-  count = sFLASH_SPI_PAGESIZE - Addr;
-  NumOfPage =  size / sFLASH_SPI_PAGESIZE;
-  NumOfSingle = size % sFLASH_SPI_PAGESIZE;
-
-  if (Addr == 0) /*!< WriteAddr is sFLASH_PAGESIZE aligned  */
-  {
-    if (NumOfPage == 0) /*!< NumByteToWrite < sFLASH_PAGESIZE */
-    {
-      status = sflash_write_page( handle, device_address, data_addr_ptr, size );
-      //sFLASH_WritePage(pBuffer, WriteAddr, NumByteToWrite);
-    }
-    else /*!< NumByteToWrite > sFLASH_PAGESIZE */
-    {
-      while (NumOfPage--)
-      {
-        status = sflash_write_page( handle, device_address, data_addr_ptr, sFLASH_SPI_PAGESIZE );
-        //sFLASH_WritePage(pBuffer, WriteAddr, sFLASH_SPI_PAGESIZE);
-        device_address +=  sFLASH_SPI_PAGESIZE;
-        data_addr_ptr += sFLASH_SPI_PAGESIZE;
-      }
-
-      status = sflash_write_page( handle, device_address, data_addr_ptr, NumOfSingle);
-    }
-  }
-  else /*!< WriteAddr is not sFLASH_PAGESIZE aligned  */
+  /* Program page by page. Block protection is verified once before the first
+     page, following pages only need a bare WREN before PAGE PROGRAM. */
+  while ( size > 0 )
   {
-    if (NumOfPage == 0) /*!< NumByteToWrite < sFLASH_PAGESIZE */
+    write_size = sFLASH_SPI_PAGESIZE - ( device_address % sFLASH_SPI_PAGESIZE );
+    if ( write_size > size )
     {
-      if (NumOfSingle > count) /*!< (NumByteToWrite + WriteAddr) > sFLASH_PAGESIZE */
-      {
-        temp = NumOfSingle - count;
-
-        status = sflash_write_page( handle, device_address, data_addr_ptr, count );
-        //sFLASH_WritePage(pBuffer, WriteAddr, count);
-        device_address +=  count;
-        data_addr_ptr += count;
-
-        status = sflash_write_page( handle, device_address, data_addr_ptr, temp);
-      }
-      else
-      {
-        status = sflash_write_page(handle, device_address, data_addr_ptr, size);
-      }
+      write_size = size;
     }
-    else /*!< NumByteToWrite > sFLASH_PAGESIZE */
+
+    status = sflash_write_page( handle, device_address, data_addr_ptr, (int) write_size, protection_checked );
+    if ( status != 0 )
     {
-      size -= count;
-      NumOfPage =  size / sFLASH_SPI_PAGESIZE;
-      NumOfSingle = size % sFLASH_SPI_PAGESIZE;
-
-      status = sflash_write_page( handle, device_address, data_addr_ptr, count );
-      //sFLASH_WritePage(pBuffer, WriteAddr, count);
-      device_address +=  count;
-      data_addr_ptr += count;
-
-      while (NumOfPage--)
-      {
-        status = sflash_write_page( handle, device_address, data_addr_ptr, sFLASH_SPI_PAGESIZE );
-        //sFLASH_WritePage(pBuffer, WriteAddr, sFLASH_SPI_PAGESIZE);
-        device_address +=  sFLASH_SPI_PAGESIZE;
-        data_addr_ptr += sFLASH_SPI_PAGESIZE;
-      }
-
-      if (NumOfSingle != 0)
-      {
-        status = sflash_write_page( handle, device_address, data_addr_ptr, NumOfSingle );
-        //sFLASH_WritePage(pBuffer, WriteAddr, NumOfSingle);
-      }
+      return status;
     }
+    protection_checked = 1;
+
+    device_address += write_size;
+    data_addr_ptr  += write_size;
+    size           -= write_size;
   }
   return status;
 }
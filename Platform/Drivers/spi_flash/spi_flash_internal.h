@@ -82,6 +82,8 @@ typedef enum
 
 #define SFLASH_DUMMY_BYTE ( 0xA5 )
 
+#define SFLASH_FAST_READ_DUMMY_BYTES   ( 1 )   /* 8 dummy clocks after the address */
+
 #define SFLASH_MANUFACTURER( id ) ( ( (id) & 0x00ff0000 ) >> 16 )
 
 #define SFLASH_MANUFACTURER_SST        ( (uint8_t) 0xBF )
@@ -37,6 +37,19 @@
  *                    Constants
  ******************************************************/
 
+/* Resources used by platform_adc_stream_start. ADC1 can only be served by
+ * DMA2 stream 0 or 4, stream 0 belongs to the SPI flash. TIM3 is shared
+ * with MICO_PWM_10/11, a stream is refused while TIM3 runs a PWM output
+ * and platform_pwm refuses TIM3 while a stream runs. */
+#define ADC_STREAM_PORT         ADC1
+#define ADC_STREAM_DMA_STREAM   DMA2_Stream4
+#define ADC_STREAM_DMA_CHANNEL  DMA_Channel_0
+#define ADC_STREAM_DMA_IRQ      DMA2_Stream4_IRQn
+#define ADC_STREAM_TIM          TIM3
+#define ADC_STREAM_TIM_CLOCK    RCC_APB1Periph_TIM3
+#define ADC_STREAM_TRIGGER      ADC_ExternalTrigConv_T3_TRGO
+#define ADC_STREAM_MAX_CHANNELS (16)
+
 /******************************************************
  *                   Enumerations
  ******************************************************/
@@ -52,6 +65,15 @@
 /******************************************************
  *               Variables Definitions
  ******************************************************/
+static struct
+{
+    platform_adc_stream_callback_t callback;
+    void*                          arg;
+    uint16_t*                      buffer;
+    uint32_t                       half_length;
+    bool                           running;
+} adc_stream;
+
 static const uint16_t adc_sampling_cycle[] =
 {
     [ADC_SampleTime_3Cycles  ] = 3,
@@ -198,6 +220,222 @@ exit:
   return err;
 }
 
+OSStatus platform_adc_stream_start( const platform_adc_t* const* adcs, uint8_t adc_count, uint32_t sample_rate, uint16_t* buffer, uint32_t buffer_length, platform_adc_stream_callback_t callback, void* arg )
+{
+    GPIO_InitTypeDef        gpio_init_structure;
+    ADC_InitTypeDef         adc_init_structure;
+    ADC_CommonInitTypeDef   adc_common_init_structure;
+    DMA_InitTypeDef         dma_init_structure;
+    TIM_TimeBaseInitTypeDef tim_time_base_structure;
+    RCC_ClocksTypeDef       rcc_clock_frequencies;
+    uint32_t                adc_clock;
+    uint32_t                tim_clock;
+    uint32_t                ticks;
+    uint32_t                prescaler;
+    uint32_t                period;
+    uint8_t                 sample_time = ADC_SampleTime_84Cycles;
+    uint8_t                 i;
+    OSStatus                err = kNoErr;
+
+    require_action_quiet( adcs != NULL && buffer != NULL && callback != NULL, exit, err = kParamErr);
+    require_action_quiet( adc_count > 0 && adc_count <= ADC_STREAM_MAX_CHANNELS, exit, err = kParamErr);
+    require_action_quiet( sample_rate > 0, exit, err = kParamErr);
+    require_action_quiet( buffer_length >= 2 * adc_count && ( buffer_length % ( 2 * adc_count ) ) == 0, exit, err = kParamErr);
+    require_action_quiet( buffer_length <= 0xFFFF, exit, err = kParamErr); /* DMA NDTR is 16 bits wide */
+
+    for ( i = 0; i < adc_count; i++ )
+    {
+        if ( ( adcs[i]->channel == ADC_Channel_16 ) || ( adcs[i]->channel == ADC_Channel_17 ) )
+            sample_time = ADC_SampleTime_480Cycles; /* temperature sensor and Vrefint need >10us */
+    }
+
+    /* A frame must be converted before the next trigger: sampling plus 12
+     * cycles per channel of the ADC clock, PCLK2 / 2 */
+    RCC_GetClocksFreq( &rcc_clock_frequencies );
+    adc_clock = rcc_clock_frequencies.PCLK2_Frequency / 2;
+    require_action_quiet( sample_rate <= adc_clock / ( adc_count * ( adc_sampling_cycle[sample_time] + 12 ) ), exit, err = kParamErr);
+
+    /* A running TIM3 that isn't ours drives PWM_10/11 */
+    require_action_quiet( adc_stream.running || ( ADC_STREAM_TIM->CR1 & TIM_CR1_CEN ) == 0, exit, err = kAlreadyInUseErr);
+
+    if ( adc_stream.running )
+        platform_adc_stream_stop( );
+
+    /* Stays disabled until platform_adc_stream_stop, STOP mode would halt the timer */
+    platform_mcu_powersave_disable();
+
+    ADC_DeInit();
+
+    for ( i = 0; i < adc_count; i++ )
+    {
+        if ( adcs[i]->pin != NULL )
+        {
+            platform_gpio_enable_clock( adcs[i]->pin );
+            gpio_init_structure.GPIO_Pin   = (uint32_t)( 1 << adcs[i]->pin->pin_number );
+            gpio_init_structure.GPIO_Speed = (GPIOSpeed_TypeDef) 0;
+            gpio_init_structure.GPIO_Mode  = GPIO_Mode_AN;
+            gpio_init_structure.GPIO_PuPd  = GPIO_PuPd_NOPULL;
+            gpio_init_structure.GPIO_OType = GPIO_OType_OD;
+            GPIO_Init( adcs[i]->pin->port, &gpio_init_structure );
+        }
+    }
+
+    RCC_APB2PeriphClockCmd( adcs[0]->adc_peripheral_clock, ENABLE );
+    RCC_AHB1PeriphClockCmd( RCC_AHB1Periph_DMA2, ENABLE );
+    RCC_APB1PeriphClockCmd( ADC_STREAM_TIM_CLOCK, ENABLE );
+
+    adc_stream.callback    = callback;
+    adc_stream.arg         = arg;
+    adc_stream.buffer      = buffer;
+    adc_stream.half_length = buffer_length / 2;
+
+    /* DMA: ADC data register into the circular buffer, interrupt at half and full */
+    DMA_DeInit( ADC_STREAM_DMA_STREAM );
+    DMA_StructInit( &dma_init_structure );
+    dma_init_structure.DMA_Channel            = ADC_STREAM_DMA_CHANNEL;
+    dma_init_structure.DMA_PeripheralBaseAddr = (uint32_t)&ADC_STREAM_PORT->DR;
+    dma_init_structure.DMA_Memory0BaseAddr    = (uint32_t)buffer;
+    dma_init_structure.DMA_DIR                = DMA_DIR_PeripheralToMemory;
+    dma_init_structure.DMA_BufferSize         = buffer_length;
+    dma_init_structure.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+    dma_init_structure.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+    dma_init_structure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    dma_init_structure.DMA_MemoryDataSize     = DMA_MemoryDataSize_HalfWord;
+    dma_init_structure.DMA_Mode               = DMA_Mode_Circular;
+    dma_init_structure.DMA_Priority           = DMA_Priority_High;
+    dma_init_structure.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+    DMA_Init( ADC_STREAM_DMA_STREAM, &dma_init_structure );
+    DMA_ITConfig( ADC_STREAM_DMA_STREAM, DMA_IT_HT | DMA_IT_TC | DMA_IT_TE, ENABLE );
+    NVIC_EnableIRQ( ADC_STREAM_DMA_IRQ );
+    DMA_Cmd( ADC_STREAM_DMA_STREAM, ENABLE );
+
+    /* ADC: one scan of all channels per timer trigger */
+    ADC_StructInit( &adc_init_structure );
+    adc_init_structure.ADC_Resolution           = ADC_Resolution_12b;
+    adc_init_structure.ADC_ScanConvMode         = ( adc_count > 1 ) ? ENABLE : DISABLE;
+    adc_init_structure.ADC_ContinuousConvMode   = DISABLE;
+    adc_init_structure.ADC_ExternalTrigConvEdge = ADC_ExternalTrigConvEdge_Rising;
+    adc_init_structure.ADC_ExternalTrigConv     = ADC_STREAM_TRIGGER;
+    adc_init_structure.ADC_DataAlign            = ADC_DataAlign_Right;
+    adc_init_structure.ADC_NbrOfConversion      = adc_count;
+    ADC_Init( ADC_STREAM_PORT, &adc_init_structure );
+
+    ADC_CommonStructInit( &adc_common_init_structure );
+    adc_common_init_structure.ADC_Mode             = ADC_Mode_Independent;
+    adc_common_init_structure.ADC_DMAAccessMode    = ADC_DMAAccessMode_Disabled;
+    adc_common_init_structure.ADC_Prescaler        = ADC_Prescaler_Div2;
+    adc_common_init_structure.ADC_TwoSamplingDelay = ADC_TwoSamplingDelay_5Cycles;
+    ADC_CommonInit( &adc_common_init_structure );
+
+    if ( sample_time == ADC_SampleTime_480Cycles )
+    {
+        ADC_TempSensorVrefintCmd(ENABLE);
+        platform_nanosecond_delay(10*1000);
+    }
+
+    for ( i = 0; i < adc_count; i++ )
+        ADC_RegularChannelConfig( ADC_STREAM_PORT, adcs[i]->channel, i + 1, sample_time );
+
+    ADC_DMARequestAfterLastTransferCmd( ADC_STREAM_PORT, ENABLE );
+    ADC_DMACmd( ADC_STREAM_PORT, ENABLE );
+    /* An overrun stops the DMA requests, platform_adc_stream_ovr_irq restarts them */
+    ADC_ClearITPendingBit( ADC_STREAM_PORT, ADC_IT_OVR );
+    ADC_ITConfig( ADC_STREAM_PORT, ADC_IT_OVR, ENABLE );
+    NVIC_EnableIRQ( ADC_IRQn );
+    ADC_Cmd( ADC_STREAM_PORT, ENABLE );
+
+    /* Timer: update event on TRGO at sample_rate */
+    if( rcc_clock_frequencies.PCLK1_Frequency == rcc_clock_frequencies.HCLK_Frequency )
+      tim_clock = rcc_clock_frequencies.PCLK1_Frequency;
+    else
+      tim_clock = rcc_clock_frequencies.PCLK1_Frequency * 2;
+
+    ticks = tim_clock / sample_rate;
+    if ( ticks == 0 )
+      ticks = 1;
+    prescaler = ( ticks - 1 ) / 0x10000;
+    period = ticks / ( prescaler + 1 );
+    if ( period < 2 )
+      period = 2; /* a period of 0 would stop the timer */
+
+    TIM_DeInit( ADC_STREAM_TIM );
+    TIM_TimeBaseStructInit( &tim_time_base_structure );
+    tim_time_base_structure.TIM_Prescaler     = (uint16_t) prescaler;
+    tim_time_base_structure.TIM_Period        = period - 1;
+    tim_time_base_structure.TIM_ClockDivision = 0;
+    tim_time_base_structure.TIM_CounterMode   = TIM_CounterMode_Up;
+    TIM_TimeBaseInit( ADC_STREAM_TIM, &tim_time_base_structure );
+    TIM_SelectOutputTrigger( ADC_STREAM_TIM, TIM_TRGOSource_Update );
+
+    adc_stream.running = true;
+    TIM_Cmd( ADC_STREAM_TIM, ENABLE );
+
+exit:
+    return err;
+}
+
+OSStatus platform_adc_stream_stop( void )
+{
+    if ( !adc_stream.running )
+        return kNoErr;
+
+    TIM_Cmd( ADC_STREAM_TIM, DISABLE );
+    NVIC_DisableIRQ( ADC_IRQn );
+    ADC_ITConfig( ADC_STREAM_PORT, ADC_IT_OVR, DISABLE );
+    ADC_Cmd( ADC_STREAM_PORT, DISABLE );
+    ADC_DMACmd( ADC_STREAM_PORT, DISABLE );
+    DMA_Cmd( ADC_STREAM_DMA_STREAM, DISABLE );
+    DMA_ITConfig( ADC_STREAM_DMA_STREAM, DMA_IT_HT | DMA_IT_TC | DMA_IT_TE, DISABLE );
+    NVIC_DisableIRQ( ADC_STREAM_DMA_IRQ );
+    adc_stream.running = false;
+
+    platform_mcu_powersave_enable();
+    return kNoErr;
+}
+
+bool platform_adc_stream_uses_timer( TIM_TypeDef* tim )
+{
+    return adc_stream.running && ( tim == ADC_STREAM_TIM );
+}
+
+void platform_adc_stream_irq( void )
+{
+    if ( DMA_GetITStatus( ADC_STREAM_DMA_STREAM, DMA_IT_HTIF4 ) == SET )
+    {
+        DMA_ClearITPendingBit( ADC_STREAM_DMA_STREAM, DMA_IT_HTIF4 );
+        adc_stream.callback( adc_stream.buffer, adc_stream.half_length, adc_stream.arg );
+    }
+    if ( DMA_GetITStatus( ADC_STREAM_DMA_STREAM, DMA_IT_TCIF4 ) == SET )
+    {
+        DMA_ClearITPendingBit( ADC_STREAM_DMA_STREAM, DMA_IT_TCIF4 );
+        adc_stream.callback( adc_stream.buffer + adc_stream.half_length, adc_stream.half_length, adc_stream.arg );
+    }
+    if ( DMA_GetITStatus( ADC_STREAM_DMA_STREAM, DMA_IT_TEIF4 ) == SET )
+    {
+        DMA_ClearITPendingBit( ADC_STREAM_DMA_STREAM, DMA_IT_TEIF4 );
+    }
+}
+
+void platform_adc_stream_ovr_irq( void )
+{
+    if ( ADC_GetITStatus( ADC_STREAM_PORT, ADC_IT_OVR ) != SET )
+        return;
+
+    /* The DMA stops at an overrun. Restart it at the start of the buffer,
+     * the samples of the current half are lost, and let the next trigger
+     * begin a new sequence. */
+    ADC_DMACmd( ADC_STREAM_PORT, DISABLE );
+    DMA_Cmd( ADC_STREAM_DMA_STREAM, DISABLE );
+    while ( DMA_GetCmdStatus( ADC_STREAM_DMA_STREAM ) == ENABLE )
+        ;
+    DMA_ClearFlag( ADC_STREAM_DMA_STREAM, DMA_FLAG_HTIF4 | DMA_FLAG_TCIF4 | DMA_FLAG_TEIF4 | DMA_FLAG_DMEIF4 | DMA_FLAG_FEIF4 );
+    DMA_MemoryTargetConfig( ADC_STREAM_DMA_STREAM, (uint32_t)adc_stream.buffer, DMA_Memory_0 );
+    DMA_SetCurrDataCounter( ADC_STREAM_DMA_STREAM, adc_stream.half_length * 2 );
+    DMA_Cmd( ADC_STREAM_DMA_STREAM, ENABLE );
+    ADC_ClearITPendingBit( ADC_STREAM_PORT, ADC_IT_OVR );
+    ADC_DMACmd( ADC_STREAM_PORT, ENABLE );
+}
+
 OSStatus platform_adc_deinit( const platform_adc_t* adc )
 {
     UNUSED_PARAMETER(adc);
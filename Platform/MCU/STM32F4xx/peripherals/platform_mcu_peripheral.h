@@ -269,6 +269,12 @@ void     platform_uart_rx_dma_irq            ( platform_uart_driver_t* driver );
 
 uint8_t  platform_spi_get_port_number        ( platform_spi_port_t* spi );
 
+void     platform_adc_stream_irq             ( void );
+void     platform_adc_stream_ovr_irq         ( void );
+bool     platform_adc_stream_uses_timer      ( TIM_TypeDef* tim );
+
+void     platform_pwm_wave_irq               ( uint8_t index );
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -35,6 +35,14 @@
 *                    Constants
 ******************************************************/
 
+/* Waveform playback: the update event of the timer requests a DMA burst
+ * which writes one frame into the CCR registers through TIMx_DMAR.
+ * Only timers with an update DMA request on a free stream are supported,
+ * TIM1 (DMA2 stream 5, SPI flash) and TIM4 (DMA1 stream 6, UART 1 TX)
+ * are not, TIM3 triggers the ADC stream, TIM9..11 have no DMA. */
+#define PWM_WAVE_TIMERS         (2)
+#define PWM_WAVE_MAX_CHANNELS   (4)
+
 /******************************************************
 *                   Enumerations
 ******************************************************/
@@ -51,6 +59,32 @@
 *               Variables Definitions
 ******************************************************/
 
+static const struct
+{
+    TIM_TypeDef*        tim;
+    DMA_Stream_TypeDef* stream;
+    uint32_t            channel;
+    IRQn_Type           irq;
+    uint32_t            it_ht;
+    uint32_t            it_tc;
+    uint32_t            it_te;
+} pwm_wave_dma[PWM_WAVE_TIMERS] =
+{
+    { TIM5, DMA1_Stream0, DMA_Channel_6, DMA1_Stream0_IRQn, DMA_IT_HTIF0, DMA_IT_TCIF0, DMA_IT_TEIF0 },
+    { TIM2, DMA1_Stream1, DMA_Channel_3, DMA1_Stream1_IRQn, DMA_IT_HTIF1, DMA_IT_TCIF1, DMA_IT_TEIF1 },
+};
+
+static struct
+{
+    platform_pwm_wave_callback_t callback;
+    void*                        arg;
+    uint32_t*                    buffer;
+    uint32_t                     half_frames;
+    uint8_t                      width;
+    uint8_t                      ending;  /* half buffers left to send after the last frame */
+    bool                         running;
+} pwm_wave[PWM_WAVE_TIMERS];
+
 /******************************************************
 *               Function Declarations
 ******************************************************/
@@ -69,6 +103,8 @@ OSStatus platform_pwm_init( const platform_pwm_t* pwm, uint32_t frequency, float
   OSStatus                err                 = kNoErr;
   
   require_action_quiet( pwm != NULL, exit, err = kParamErr);
+  /* TIM3 also triggers the ADC stream */
+  require_action_quiet( !platform_adc_stream_uses_timer( pwm->tim ), exit, err = kAlreadyInUseErr);
 
   platform_mcu_powersave_disable();
 
@@ -156,6 +192,7 @@ OSStatus platform_pwm_start( const platform_pwm_t* pwm )
   platform_mcu_powersave_disable();
 
   require_action_quiet( pwm != NULL, exit, err = kParamErr);
+  require_action_quiet( !platform_adc_stream_uses_timer( pwm->tim ), exit, err = kAlreadyInUseErr);
   
   TIM_Cmd( pwm->tim, ENABLE );
   TIM_CtrlPWMOutputs( pwm->tim, ENABLE );
@@ -165,6 +202,180 @@ exit:
   return err;
 }
 
+static int pwm_wave_index( TIM_TypeDef* tim )
+{
+  int i;
+
+  for ( i = 0; i < PWM_WAVE_TIMERS; i++ )
+  {
+    if ( pwm_wave_dma[i].tim == tim )
+      return i;
+  }
+  return -1;
+}
+
+OSStatus platform_pwm_wave_layout( const platform_pwm_t* const* pwms, uint8_t pwm_count, platform_pwm_wave_layout_t* layout )
+{
+  uint8_t  first = PWM_WAVE_MAX_CHANNELS;
+  uint8_t  last  = 1;
+  uint8_t  i;
+  OSStatus err   = kNoErr;
+
+  require_action_quiet( pwms != NULL && layout != NULL, exit, err = kParamErr);
+  require_action_quiet( pwm_count > 0 && pwm_count <= PWM_WAVE_MAX_CHANNELS, exit, err = kParamErr);
+  require_action_quiet( pwm_wave_index( pwms[0]->tim ) >= 0, exit, err = kUnsupportedErr);
+
+  /* all channels of one frame are written by the same burst */
+  for ( i = 0; i < pwm_count; i++ )
+  {
+    require_action_quiet( pwms[i]->tim == pwms[0]->tim, exit, err = kParamErr);
+    if ( pwms[i]->channel < first ) first = pwms[i]->channel;
+    if ( pwms[i]->channel > last )  last  = pwms[i]->channel;
+  }
+  layout->width = last - first + 1;
+  for ( i = 0; i < pwm_count; i++ )
+    layout->column[i] = pwms[i]->channel - first;
+  layout->period = pwms[0]->tim->ARR + 1;
+
+exit:
+  return err;
+}
+
+OSStatus platform_pwm_wave_start( const platform_pwm_t* const* pwms, uint8_t pwm_count, uint32_t* buffer, uint32_t buffer_frames, platform_pwm_wave_callback_t callback, void* arg )
+{
+  DMA_InitTypeDef            dma_init_structure;
+  platform_pwm_wave_layout_t layout;
+  uint8_t                    first = PWM_WAVE_MAX_CHANNELS;
+  uint8_t                    i;
+  int                        n;
+  OSStatus                   err   = kNoErr;
+
+  err = platform_pwm_wave_layout( pwms, pwm_count, &layout );
+  require_noerr_quiet( err, exit );
+  require_action_quiet( buffer != NULL && callback != NULL, exit, err = kParamErr);
+  require_action_quiet( buffer_frames >= 2 && ( buffer_frames % 2 ) == 0, exit, err = kParamErr);
+  require_action_quiet( buffer_frames * layout.width <= 0xFFFF, exit, err = kParamErr); /* DMA NDTR is 16 bits wide */
+
+  for ( i = 0; i < pwm_count; i++ )
+  {
+    if ( pwms[i]->channel < first ) first = pwms[i]->channel;
+  }
+  n = pwm_wave_index( pwms[0]->tim );
+  if ( pwm_wave[n].running )
+    platform_pwm_wave_stop( pwms[0] );
+
+  /* Stays disabled until platform_pwm_wave_stop, STOP mode would halt the timer */
+  platform_mcu_powersave_disable();
+  RCC_AHB1PeriphClockCmd( RCC_AHB1Periph_DMA1, ENABLE );
+
+  pwm_wave[n].callback    = callback;
+  pwm_wave[n].arg         = arg;
+  pwm_wave[n].buffer      = buffer;
+  pwm_wave[n].half_frames = buffer_frames / 2;
+  pwm_wave[n].width       = layout.width;
+  pwm_wave[n].ending      = 0;
+
+  /* both halves are filled before the first update */
+  if ( !callback( buffer, pwm_wave[n].half_frames, arg ) )
+    pwm_wave[n].ending = 1;
+  if ( !callback( buffer + ( pwm_wave[n].half_frames * layout.width ), pwm_wave[n].half_frames, arg ) && pwm_wave[n].ending == 0 )
+    pwm_wave[n].ending = 2;
+
+  /* DMA: circular buffer of frames into the DMA burst register */
+  DMA_DeInit( pwm_wave_dma[n].stream );
+  DMA_StructInit( &dma_init_structure );
+  dma_init_structure.DMA_Channel            = pwm_wave_dma[n].channel;
+  dma_init_structure.DMA_PeripheralBaseAddr = (uint32_t)&pwms[0]->tim->DMAR;
+  dma_init_structure.DMA_Memory0BaseAddr    = (uint32_t)buffer;
+  dma_init_structure.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+  dma_init_structure.DMA_BufferSize         = buffer_frames * layout.width;
+  dma_init_structure.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+  dma_init_structure.DMA_MemoryInc          = DMA_MemoryInc_Enable;
+  dma_init_structure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+  dma_init_structure.DMA_MemoryDataSize     = DMA_MemoryDataSize_Word;
+  dma_init_structure.DMA_Mode               = DMA_Mode_Circular;
+  dma_init_structure.DMA_Priority           = DMA_Priority_Medium;
+  dma_init_structure.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+  DMA_Init( pwm_wave_dma[n].stream, &dma_init_structure );
+  DMA_ITConfig( pwm_wave_dma[n].stream, DMA_IT_HT | DMA_IT_TC | DMA_IT_TE, ENABLE );
+  NVIC_EnableIRQ( pwm_wave_dma[n].irq );
+  DMA_Cmd( pwm_wave_dma[n].stream, ENABLE );
+
+  /* Timer: one burst of width transfers starting at CCR<first> per update */
+  TIM_DMAConfig( pwms[0]->tim, TIM_DMABase_CCR1 + ( first - 1 ), (uint16_t)( ( layout.width - 1 ) << 8 ) );
+  TIM_DMACmd( pwms[0]->tim, TIM_DMA_Update, ENABLE );
+  pwm_wave[n].running = true;
+
+exit:
+  return err;
+}
+
+static void pwm_wave_halt( int n )
+{
+  TIM_DMACmd( pwm_wave_dma[n].tim, TIM_DMA_Update, DISABLE );
+  DMA_Cmd( pwm_wave_dma[n].stream, DISABLE );
+  DMA_ITConfig( pwm_wave_dma[n].stream, DMA_IT_HT | DMA_IT_TC | DMA_IT_TE, DISABLE );
+  NVIC_DisableIRQ( pwm_wave_dma[n].irq );
+  pwm_wave[n].running = false;
+
+  platform_mcu_powersave_enable();
+}
+
+OSStatus platform_pwm_wave_stop( const platform_pwm_t* pwm )
+{
+  int n;
+
+  if ( pwm == NULL )
+    return kParamErr;
+  n = pwm_wave_index( pwm->tim );
+  if ( n < 0 )
+    return kNoErr;
+
+  /* a one shot waveform may halt itself from the interrupt */
+  NVIC_DisableIRQ( pwm_wave_dma[n].irq );
+  if ( pwm_wave[n].running )
+    pwm_wave_halt( n );
+  return kNoErr;
+}
+
+/* Refill a half buffer that was sent, returns false once the waveform halted */
+static bool pwm_wave_half( uint8_t index, uint32_t* frames )
+{
+  /* a one shot waveform stops after the half with its last frame was sent */
+  if ( pwm_wave[index].ending > 0 && --pwm_wave[index].ending == 0 )
+  {
+    pwm_wave_halt( index );
+    return false;
+  }
+  if ( !pwm_wave[index].callback( frames, pwm_wave[index].half_frames, pwm_wave[index].arg ) && pwm_wave[index].ending == 0 )
+    pwm_wave[index].ending = 2;
+  return true;
+}
+
+void platform_pwm_wave_irq( uint8_t index )
+{
+  if ( index >= PWM_WAVE_TIMERS )
+    return;
+
+  if ( DMA_GetITStatus( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_ht ) == SET )
+  {
+    /* first half was sent, refill it */
+    DMA_ClearITPendingBit( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_ht );
+    if ( !pwm_wave_half( index, pwm_wave[index].buffer ) )
+      return;
+  }
+  if ( DMA_GetITStatus( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_tc ) == SET )
+  {
+    DMA_ClearITPendingBit( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_tc );
+    if ( !pwm_wave_half( index, pwm_wave[index].buffer + ( pwm_wave[index].half_frames * pwm_wave[index].width ) ) )
+      return;
+  }
+  if ( DMA_GetITStatus( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_te ) == SET )
+  {
+    DMA_ClearITPendingBit( pwm_wave_dma[index].stream, pwm_wave_dma[index].it_te );
+  }
+}
+
 OSStatus platform_pwm_stop( const platform_pwm_t* pwm )
 {
   OSStatus err = kNoErr;
@@ -37,6 +37,7 @@
 *                    Constants
 ******************************************************/
 #define MAX_NUM_SPI_PRESCALERS     (8)
+#define SPI_DMA_MAX_TRANSFER_SIZE  (0xFFFF) /* DMA NDTR is 16 bits wide */
 
 /******************************************************
 *                   Enumerations
@@ -270,13 +271,26 @@ OSStatus platform_spi_transfer( platform_spi_driver_t* driver, const platform_sp
     /* Check if we are using DMA */
     if ( config->mode & SPI_USE_DMA )
     {
-      if( segments[ i ].length != 0){
-        //platform_log( "length: %d, i:%d", segments[ i ].length, i );
-        
-        spi_dma_config( driver->peripheral, &segments[ i ] );
+      platform_spi_message_segment_t chunk = segments[ i ];
+
+      /* DMA NDTR is 16 bits wide, long segments are sent as back-to-back
+         chunks without releasing chip select */
+      while( chunk.length != 0 ){
+        uint32_t remaining = chunk.length;
+
+        if( chunk.length > SPI_DMA_MAX_TRANSFER_SIZE )
+          chunk.length = SPI_DMA_MAX_TRANSFER_SIZE;
+
+        spi_dma_config( driver->peripheral, &chunk );
       
         err = spi_dma_transfer( driver->peripheral, config );
         require_noerr(err, cleanup_transfer);
+
+        if( chunk.tx_buffer != NULL )
+          chunk.tx_buffer = (const uint8_t*)chunk.tx_buffer + chunk.length;
+        if( chunk.rx_buffer != NULL )
+          chunk.rx_buffer = (uint8_t*)chunk.rx_buffer + chunk.length;
+        chunk.length = remaining - chunk.length;
       }
     }
     else
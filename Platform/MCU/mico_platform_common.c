@@ -158,6 +158,27 @@ OSStatus MicoAdcTakeSampleStream( mico_adc_t adc, void* buffer, uint16_t buffer_
   return (OSStatus) platform_adc_take_sample_stream( &platform_adc_peripherals[adc], buffer, buffer_length );
 }
 
+OSStatus MicoAdcStreamStart( const mico_adc_t* adcs, uint8_t adc_count, uint32_t sample_rate, uint16_t* buffer, uint32_t buffer_length, mico_adc_stream_handler_t handler, void* arg )
+{
+  const platform_adc_t* peripherals[MICO_ADC_STREAM_MAX_CHANNELS];
+  uint8_t i;
+
+  if ( adc_count == 0 || adc_count > MICO_ADC_STREAM_MAX_CHANNELS )
+    return kParamErr;
+  for ( i = 0; i < adc_count; i++ )
+  {
+    if ( adcs[i] >= MICO_ADC_NONE )
+      return kUnsupportedErr;
+    peripherals[i] = &platform_adc_peripherals[adcs[i]];
+  }
+  return (OSStatus) platform_adc_stream_start( peripherals, adc_count, sample_rate, buffer, buffer_length, handler, arg );
+}
+
+OSStatus MicoAdcStreamStop( void )
+{
+  return (OSStatus) platform_adc_stream_stop( );
+}
+
 OSStatus MicoGpioInitialize( mico_gpio_t gpio, mico_gpio_config_t configuration )
 {
   if ( gpio >= MICO_GPIO_NONE )
@@ -347,6 +368,48 @@ OSStatus MicoPwmStop( mico_pwm_t pwm )
   return (OSStatus) platform_pwm_stop( &platform_pwm_peripherals[pwm] );
 }
 
+static OSStatus _pwm_wave_peripherals( const mico_pwm_t* pwms, uint8_t pwm_count, const platform_pwm_t** peripherals )
+{
+  uint8_t i;
+
+  if ( pwm_count == 0 || pwm_count > MICO_PWM_WAVE_MAX_CHANNELS )
+    return kParamErr;
+  for ( i = 0; i < pwm_count; i++ )
+  {
+    if ( pwms[i] >= MICO_PWM_NONE )
+      return kUnsupportedErr;
+    peripherals[i] = &platform_pwm_peripherals[pwms[i]];
+  }
+  return kNoErr;
+}
+
+OSStatus MicoPwmWaveLayout( const mico_pwm_t* pwms, uint8_t pwm_count, mico_pwm_wave_layout_t* layout )
+{
+  const platform_pwm_t* peripherals[MICO_PWM_WAVE_MAX_CHANNELS];
+  OSStatus err = _pwm_wave_peripherals( pwms, pwm_count, peripherals );
+
+  if ( err != kNoErr )
+    return err;
+  return (OSStatus) platform_pwm_wave_layout( peripherals, pwm_count, layout );
+}
+
+OSStatus MicoPwmWaveStart( const mico_pwm_t* pwms, uint8_t pwm_count, uint32_t* buffer, uint32_t buffer_frames, mico_pwm_wave_handler_t handler, void* arg )
+{
+  const platform_pwm_t* peripherals[MICO_PWM_WAVE_MAX_CHANNELS];
+  OSStatus err = _pwm_wave_peripherals( pwms, pwm_count, peripherals );
+
+  if ( err != kNoErr )
+    return err;
+  return (OSStatus) platform_pwm_wave_start( peripherals, pwm_count, buffer, buffer_frames, handler, arg );
+}
+
+OSStatus MicoPwmWaveStop( mico_pwm_t pwm )
+{
+  if ( pwm >= MICO_PWM_NONE )
+    return kUnsupportedErr;
+  return (OSStatus) platform_pwm_wave_stop( &platform_pwm_peripherals[pwm] );
+}
+
 OSStatus MicoRtcGetTime(mico_rtc_time_t* time)
 {
   return (OSStatus) platform_rtc_get_time( time );
@@ -218,10 +218,33 @@ typedef enum
  */
 typedef void (*platform_gpio_irq_callback_t)( void* arg );
 
+/**
+ * ADC stream callback handler, called from interrupt context with
+ * count interleaved samples (one per channel per frame)
+ */
+typedef void (*platform_adc_stream_callback_t)( const uint16_t* samples, uint32_t count, void* arg );
+
+/**
+ * PWM waveform callback handler, called from interrupt context to fill
+ * count frames (see platform_pwm_wave_layout_t) with CCR values. Returns
+ * false when these frames end the waveform, it stops once they were sent
+ */
+typedef bool (*platform_pwm_wave_callback_t)( uint32_t* frames, uint32_t count, void* arg );
+
 /******************************************************
  *                    Structures
  ******************************************************/
 
+/**
+ * Frame layout of a PWM waveform
+ */
+typedef struct
+{
+    uint32_t period;     /* CCR value for 100% duty cycle */
+    uint8_t  width;      /* CCR values per frame */
+    uint8_t  column[4];  /* position of each PWM interface in the frame */
+} platform_pwm_wave_layout_t;
+
 /**
  * UART configuration
  */
@@ -647,6 +670,32 @@ OSStatus platform_adc_take_sample( const platform_adc_t* adc, uint16_t* output )
 OSStatus platform_adc_take_sample_stream( const platform_adc_t* adc, uint16_t* buffer, uint16_t buffer_length );
 
 
+/**
+ * Start timer triggered, DMA driven sampling of one or more ADC channels
+ *
+ * @param[in]  adcs          : ADC interfaces, converted in this order every frame
+ * @param[in]  adc_count     : number of ADC interfaces
+ * @param[in]  sample_rate   : frames per second
+ * @param[in]  buffer        : circular DMA buffer of interleaved samples
+ * @param[in]  buffer_length : buffer length in samples, a multiple of 2 * adc_count
+ * @param[in]  callback      : called with each filled half of the buffer
+ * @param[in]  arg           : argument passed to callback
+ *
+ * @return @ref OSStatus, kParamErr if a frame of adc_count channels can not
+ *         be converted at sample_rate, kAlreadyInUseErr if the sample timer
+ *         is driving a PWM output
+ */
+OSStatus platform_adc_stream_start( const platform_adc_t* const* adcs, uint8_t adc_count, uint32_t sample_rate, uint16_t* buffer, uint32_t buffer_length, platform_adc_stream_callback_t callback, void* arg );
+
+
+/**
+ * Stop sampling started by platform_adc_stream_start
+ *
+ * @return @ref OSStatus
+ */
+OSStatus platform_adc_stream_stop( void );
+
+
 /**
  * Initialise I2C interface
  *
@@ -740,7 +789,7 @@ OSStatus platform_i2c_transfer( const platform_i2c_t* i2c, const platform_i2c_co
  * @param[in] frequency     : PWM signal frequency in Hz
  * @param[in] duty_cycle    : PWM signal duty cycle in percentage point
  *
- * @return @ref OSStatus
+ * @return @ref OSStatus, kAlreadyInUseErr if the timer triggers an ADC stream
  */
 OSStatus platform_pwm_init( const platform_pwm_t* pwm, uint32_t frequency, float duty_cycle );
 
@@ -765,6 +814,45 @@ OSStatus platform_pwm_start( const platform_pwm_t* pwm );
 OSStatus platform_pwm_stop( const platform_pwm_t* pwm );
 
 
+/**
+ * Get the frame layout for a waveform on the specified PWM interfaces
+ *
+ * @param[in]  pwms      : PWM interfaces, all on the same timer
+ * @param[in]  pwm_count : number of PWM interfaces
+ * @param[out] layout    : frame layout
+ *
+ * @return @ref OSStatus
+ */
+OSStatus platform_pwm_wave_layout( const platform_pwm_t* const* pwms, uint8_t pwm_count, platform_pwm_wave_layout_t* layout );
+
+
+/**
+ * Start updating the duty cycles of initialised PWM interfaces by DMA,
+ * one frame per PWM period
+ *
+ * @param[in]  pwms          : PWM interfaces, all on the same timer
+ * @param[in]  pwm_count     : number of PWM interfaces
+ * @param[in]  buffer        : circular DMA buffer of frames
+ * @param[in]  buffer_frames : buffer length in frames, a multiple of 2
+ * @param[in]  callback      : called to fill each half of the buffer
+ * @param[in]  arg           : argument passed to callback
+ *
+ * @return @ref OSStatus
+ */
+OSStatus platform_pwm_wave_start( const platform_pwm_t* const* pwms, uint8_t pwm_count, uint32_t* buffer, uint32_t buffer_frames, platform_pwm_wave_callback_t callback, void* arg );
+
+
+/**
+ * Stop the waveform running on the timer of the PWM interface,
+ * the duty cycles keep their last values
+ *
+ * @param[in] pwm : PWM interface
+ *
+ * @return @ref OSStatus
+ */
+OSStatus platform_pwm_wave_stop( const platform_pwm_t* pwm );
+
+
 /**
  * Get current real-time clock
  *
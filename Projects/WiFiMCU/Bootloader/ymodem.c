@@ -74,26 +74,6 @@ static uint32_t Send_Byte (uint8_t c)
   return 0;
 }
 
-//------------------------------------------------------------------------
-static unsigned short crc16(const unsigned char *buf, unsigned long count)
-{
-  unsigned short crc = 0;
-  int i;
-
-  while(count--) {
-          crc = crc ^ *buf++ << 8;
-
-          for (i=0; i<8; i++) {
-                  if (crc & 0x8000) {
-                          crc = crc << 1 ^ 0x1021;
-                  } else {
-                          crc = crc << 1;
-                  }
-          }
-  }
-  return crc;
-}
-
 
 /**
   * @brief  Receive a packet from sender
@@ -154,7 +134,7 @@ static int32_t Receive_Packet (uint8_t *data, int32_t *length, uint32_t timeout)
   {
     return -1;
   }
-  if (crc16(&data[PACKET_HEADER], packet_size + PACKET_TRAILER) != 0) {
+  if (CRC16_Calc(&data[PACKET_HEADER], packet_size + PACKET_TRAILER) != 0) {
     return -1;
   }
   *length = packet_size;
@@ -386,13 +366,7 @@ void Ymodem_PreparePacket(mico_flash_t flash, uint32_t flashdestination, uint8_t
   */
 uint16_t Cal_CRC16(const uint8_t* data, uint32_t size)
 {
-  CRC16_Context contex;
-  uint16_t ret;
-  
-  CRC16_Init( &contex );
-  CRC16_Update( &contex, data, size );
-  CRC16_Final( &contex, &ret );
-  return ret;
+  return CRC16_Calc( data, size );
 }
 
 /**
@@ -8,9 +8,17 @@
 #include "lrotable.h"
 #include "mico_platform.h"
 #include "math.h"
+#include <spiffs.h>
 
 #define MAX_SAMPLES 128
 
+#define STREAM_DMA_FRAMES    32  // frames per DMA half buffer
+#define STREAM_BLOCK_DEFAULT 64  // decimated frames per block delivered to Lua
+
+extern mico_queue_t os_queue;
+extern spiffs fs;
+extern void lua_spiffs_mount();
+
 extern const char wifimcu_gpio_map[];
 
 const char wifimcu_adc_map[] =
@@ -45,9 +53,8 @@ static uint16_t _getLen(lua_State* L)
 }
 
 //------------------------------
-static int _getPin(lua_State* L)
+static int _adcPin(lua_State* L, unsigned pin)
 {
-  unsigned pin = luaL_checkinteger( L, 1);
   int adcPinID;
   if (pin < 18) {
     MOD_CHECK_ID( adcpin, pin);
@@ -61,6 +68,44 @@ static int _getPin(lua_State* L)
   return adcPinID;
 }
 
+//------------------------------
+static int _getPin(lua_State* L)
+{
+  return _adcPin(L, luaL_checkinteger( L, 1));
+}
+
+// Exact integer moments of one channel over one block. Samples are 12 bit,
+// so mean and variance are computed from them without rounding error.
+typedef struct {
+  uint32_t n;
+  uint32_t sum;
+  uint64_t sumsq;
+  uint16_t min;
+  uint16_t max;
+} adc_stats_t;
+
+// Continuous acquisition state. The DMA half buffer callback decimates and
+// accumulates in interrupt context, the queue thread only sees whole blocks.
+typedef struct {
+  lua_State* L;
+  int        cb_ref;
+  spiffs_file fd;           // log file, -1 if none
+  uint8_t    count;         // channels per frame
+  uint16_t   decimate;      // frames averaged into one output frame
+  uint16_t   block;         // output frames per block
+  uint16_t   dcnt;          // frames in the current average
+  uint16_t   fill;          // output frames in the current block
+  uint8_t    w;             // block being filled
+  volatile int8_t ready;    // block waiting for the queue thread, -1 if none
+  volatile uint32_t overrun;// blocks dropped because Lua was too slow
+  uint32_t   acc[MICO_ADC_STREAM_MAX_CHANNELS];
+  uint16_t*  dma;           // circular DMA buffer
+  uint16_t*  blk[2];        // interleaved output frames
+  adc_stats_t stats[2][MICO_ADC_STREAM_MAX_CHANNELS];
+} adc_stream_t;
+
+static adc_stream_t* adc_stream = NULL;
+
 //-----------------------------------------------------------------------
 static float _adcRead(int adcpin, uint16_t len, uint8_t type, float* std)
 {
@@ -68,6 +113,7 @@ static float _adcRead(int adcpin, uint16_t len, uint8_t type, float* std)
   *std = 0.0;
 
   if (adcpin == 999) return -99999;
+  if (adc_stream != NULL) return -99999;  // ADC is owned by adc.start
   // init ADC
   if (kNoErr != MicoAdcInitialize((mico_adc_t)adcpin, 3)) return -99999.0;
   // get ADC data
@@ -198,6 +244,211 @@ static int adc_setautocal( lua_State* L )
 }
 
 
+//-------------------------------------------------------------------------
+static void _adc_stream_handler(const uint16_t* samples, uint32_t count, void* arg)
+{
+  adc_stream_t* s = (adc_stream_t*)arg;
+  uint16_t* out;
+  adc_stats_t* st;
+  uint32_t v;
+  uint8_t c;
+
+  while (count >= s->count) {
+    for (c=0; c<s->count; c++) s->acc[c] += samples[c];
+    samples += s->count;
+    count -= s->count;
+    if (++s->dcnt < s->decimate) continue;
+    
+    // boxcar FIR + decimation: one output frame per 'decimate' input frames
+    out = s->blk[s->w] + s->fill * s->count;
+    for (c=0; c<s->count; c++) {
+      v = (s->acc[c] + s->decimate/2) / s->decimate;
+      s->acc[c] = 0;
+      out[c] = (uint16_t)v;
+      st = &s->stats[s->w][c];
+      st->n++;
+      st->sum += v;
+      st->sumsq += (uint64_t)v * v;
+      if (v < st->min) st->min = v;
+      if (v > st->max) st->max = v;
+    }
+    s->dcnt = 0;
+    if (++s->fill < s->block) continue;
+
+    s->fill = 0;
+    if (s->ready < 0) {
+      queue_msg_t msg;
+      msg.L = s->L;
+      msg.source = onADC;
+      msg.para1 = 0;
+      msg.para2 = s->cb_ref;
+      msg.para3 = NULL;
+      msg.para4 = NULL;
+      if (mico_rtos_push_to_queue(&os_queue, &msg, 0) == kNoErr) {
+        s->ready = s->w;
+        s->w ^= 1;
+      }
+      else s->overrun++;
+    }
+    else s->overrun++;   // previous block not consumed yet, refill this one
+    for (c=0; c<s->count; c++) {
+      st = &s->stats[s->w][c];
+      st->n = 0; st->sum = 0; st->sumsq = 0; st->min = 0xFFFF; st->max = 0;
+    }
+  }
+}
+
+// called from the queue thread for msg.source == onADC
+void _adc_stream_handle(lua_State* L)
+{
+  adc_stream_t* s = adc_stream;
+  adc_stats_t* st;
+  double mean, var;
+  int8_t r;
+  uint8_t c;
+
+  if (s == NULL || s->ready < 0) return;
+  r = s->ready;
+  if (s->fd >= 0) {
+    SPIFFS_write(&fs, s->fd, s->blk[r], s->block * s->count * sizeof(uint16_t));
+  }
+  if (s->cb_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, s->cb_ref);
+    lua_createtable(L, s->count, 0);
+    for (c=0; c<s->count; c++) {
+      st = &s->stats[r][c];
+      mean = (double)st->sum / st->n;
+      var = (double)((uint64_t)st->n * st->sumsq - (uint64_t)st->sum * st->sum) / ((double)st->n * st->n);
+      lua_createtable(L, 0, 6);
+      lua_pushnumber(L, st->n);         lua_setfield(L, -2, "n");
+      lua_pushnumber(L, mean);          lua_setfield(L, -2, "mean");
+      lua_pushnumber(L, sqrt(var));     lua_setfield(L, -2, "std");
+      lua_pushnumber(L, st->min);       lua_setfield(L, -2, "min");
+      lua_pushnumber(L, st->max);       lua_setfield(L, -2, "max");
+      lua_pushnumber(L, sqrt((double)st->sumsq / st->n)); lua_setfield(L, -2, "rms");
+      lua_rawseti(L, -2, c+1);
+    }
+    lua_pushlstring(L, (const char*)s->blk[r], s->block * s->count * sizeof(uint16_t));
+    lua_pushinteger(L, s->overrun);
+    s->ready = -1;
+    lua_call(L, 3, 0);
+  }
+  else s->ready = -1;
+}
+
+//-------------------------------------------
+static void _adc_stream_free(lua_State* L)
+{
+  adc_stream_t* s = adc_stream;
+  if (s == NULL) return;
+  MicoAdcStreamStop();
+  adc_stream = NULL;
+  if (s->cb_ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, s->cb_ref);
+  if (s->fd >= 0) SPIFFS_close(&fs, s->fd);
+  if (s->dma != NULL) free(s->dma);
+  if (s->blk[0] != NULL) free(s->blk[0]);
+  free(s);
+}
+
+// Lua: adc.start(pins, rate, function[, decimate[, block[, logfile]]])
+// function(stats, data, overrun) is called for every block
+static int adc_start( lua_State* L )
+{
+  mico_adc_t adcs[MICO_ADC_STREAM_MAX_CHANNELS];
+  adc_stream_t* s;
+  uint32_t rate;
+  int count = 0, i, decimate, block;
+  size_t sl;
+  const char* logfile = NULL;
+  OSStatus err;
+
+  if (lua_type(L, 1) == LUA_TTABLE) {
+    count = lua_objlen(L, 1);
+    if (count < 1 || count > MICO_ADC_STREAM_MAX_CHANNELS)
+      return luaL_error( L, "1~%d pins needed", MICO_ADC_STREAM_MAX_CHANNELS );
+    for (i=0; i<count; i++) {
+      lua_rawgeti(L, 1, i+1);
+      adcs[i] = (mico_adc_t)_adcPin(L, luaL_checkinteger( L, -1));
+      lua_pop(L, 1);
+      if (adcs[i] == 999) return luaL_error( L, "pin error" );
+    }
+  }
+  else {
+    count = 1;
+    adcs[0] = (mico_adc_t)_getPin(L);
+    if (adcs[0] == 999) return luaL_error( L, "pin error" );
+  }
+  rate = luaL_checkinteger( L, 2 );
+  if (rate < 1 || rate > 100000) return luaL_error( L, "rate should be 1~100000" );
+  if (lua_type(L, 3) != LUA_TFUNCTION && lua_type(L, 3) != LUA_TLIGHTFUNCTION &&
+      lua_type(L, 6) != LUA_TSTRING)
+    return luaL_error( L, "callback function or log file needed" );
+  decimate = luaL_optinteger( L, 4, 1 );
+  if (decimate < 1 || decimate > 0xFFFF) return luaL_error( L, "decimate should be 1~65535" );
+  block = luaL_optinteger( L, 5, STREAM_BLOCK_DEFAULT );
+  if (block < 1 || block > 4096) return luaL_error( L, "block should be 1~4096" );
+  if (lua_type(L, 6) == LUA_TSTRING) {
+    logfile = luaL_checklstring( L, 6, &sl );
+    if (sl > SPIFFS_OBJ_NAME_LEN || sl == 0) return luaL_error( L, "filename too long" );
+  }
+
+  _adc_stream_free(L);
+
+  s = (adc_stream_t*)malloc(sizeof(adc_stream_t));
+  if (s == NULL) return luaL_error( L, "memory not enough" );
+  memset(s, 0, sizeof(adc_stream_t));
+  s->cb_ref = LUA_NOREF;
+  s->fd = -1;
+  s->ready = -1;
+  s->L = L;
+  s->count = count;
+  s->decimate = decimate;
+  s->block = block;
+  for (i=0; i<count; i++) {
+    s->stats[0][i].min = 0xFFFF;
+  }
+  s->dma = (uint16_t*)malloc(2 * STREAM_DMA_FRAMES * count * sizeof(uint16_t));
+  s->blk[0] = (uint16_t*)malloc(2 * block * count * sizeof(uint16_t));
+  adc_stream = s;
+  if (s->dma == NULL || s->blk[0] == NULL) {
+    _adc_stream_free(L);
+    return luaL_error( L, "memory not enough" );
+  }
+  s->blk[1] = s->blk[0] + block * count;
+
+  if (logfile != NULL) {
+    if (SPIFFS_mounted(&fs) == false) lua_spiffs_mount();
+    s->fd = SPIFFS_open(&fs, (char*)logfile, SPIFFS_WRONLY|SPIFFS_CREAT|SPIFFS_APPEND, 0);
+    if (s->fd < 0) {
+      _adc_stream_free(L);
+      return luaL_error( L, "open file failed" );
+    }
+  }
+  if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION) {
+    lua_pushvalue(L, 3);
+    s->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+
+  err = MicoAdcStreamStart(adcs, count, rate, s->dma, 2 * STREAM_DMA_FRAMES * count,
+                           _adc_stream_handler, s);
+  if (err != kNoErr) {
+    _adc_stream_free(L);
+    // a channel takes 96 ADC clocks, 492 with the internal sensors
+    if (err == kParamErr) return luaL_error( L, "rate too high for %d pins", count );
+    // the sample timer also drives pwm on D15/D16
+    if (err == kAlreadyInUseErr) return luaL_error( L, "timer in use by pwm on D15/D16" );
+    return luaL_error( L, "adc start failed" );
+  }
+  return 0;
+}
+
+// Lua: adc.stop()
+static int adc_stop( lua_State* L )
+{
+  _adc_stream_free(L);
+  return 0;
+}
+
 #define MIN_OPT_LEVEL  2
 #include "lrodefs.h"
 const LUA_REG_TYPE adc_map[] =
@@ -206,6 +457,8 @@ const LUA_REG_TYPE adc_map[] =
   { LSTRKEY( "readV" ), LFUNCVAL( adc_read_v )},
   { LSTRKEY( "setref" ), LFUNCVAL( adc_setref )},
   { LSTRKEY( "setautocal" ), LFUNCVAL( adc_setautocal )},
+  { LSTRKEY( "start" ), LFUNCVAL( adc_start )},
+  { LSTRKEY( "stop" ), LFUNCVAL( adc_stop )},
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif    
   {LNILKEY, LNILVAL}
@@ -220,3 +473,9 @@ LUALIB_API int luaopen_adc(lua_State *L)
   return 1;
 #endif
 }
+
+LUALIB_API int luaclose_adc(lua_State *L)
+{
+  _adc_stream_free(L);
+  return 0;
+}
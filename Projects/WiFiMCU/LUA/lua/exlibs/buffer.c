@@ -0,0 +1,415 @@
+/**
+ * buffer.c
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+#include "lmem.h"
+
+#include "user_config.h"
+
+#define BUFFER_NAME       "buffer.buf"
+#define BUFFER_MIN_SIZE   32    // first allocation of an empty buffer
+
+// format limits as in string.format, MAX_ITEM is only the first guess of
+// the room an item needs, longer items are formatted again
+#define BUFFER_MAX_ITEM   128
+#define BUFFER_FLAGS      "-+ #0"
+#define BUFFER_MAX_FORMAT (sizeof(BUFFER_FLAGS) + sizeof(LUA_INTFRMLEN) + 10)
+
+// The bytes live in a block of their own, so the buffer can grow in place
+// of the userdata. The block comes from luaM_, so it counts to the Lua heap
+// for the GC and for the memory limit. data[len] is kept 0 for the %s
+// format of appendf.
+typedef struct {
+  size_t len;
+  size_t size;
+  char *data;
+} buffer_t;
+
+static buffer_t* buffer_check( lua_State* L, int narg )
+{
+  return (buffer_t*)luaL_checkudata(L, narg, BUFFER_NAME);
+}
+
+static buffer_t* buffer_test( lua_State* L, int narg )
+{
+  buffer_t *b = (buffer_t*)lua_touserdata(L, narg);
+  int ok;
+
+  if (b == NULL || !lua_getmetatable(L, narg)) return NULL;
+  luaL_getmetatable(L, BUFFER_NAME);
+  ok = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return ok ? b : NULL;
+}
+
+// Make room for n more bytes and the terminating 0
+static void buffer_reserve( lua_State* L, buffer_t *b, size_t n )
+{
+  size_t size;
+
+  if (b->len + n < b->size) return;
+  size = b->size ? b->size : BUFFER_MIN_SIZE;
+  while (size <= b->len + n) size *= 2;
+  // raises a memory error if the emergency collection did not help
+  b->data = (char*)luaM_realloc_(L, b->data, b->size, size);
+  b->size = size;
+}
+
+static void buffer_add( lua_State* L, buffer_t *b, const char *s, size_t n )
+{
+  if (n == 0) return;
+  buffer_reserve(L, b, n);
+  memcpy(b->data + b->len, s, n);
+  b->len += n;
+  b->data[b->len] = 0;
+}
+
+static void buffer_addvalue( lua_State* L, buffer_t *b, int narg )
+{
+  char num[LUAI_MAXNUMBER2STR];
+  buffer_t *src;
+  const char *s;
+  size_t n;
+
+  if (lua_type(L, narg) == LUA_TNUMBER) {
+    // format numbers here, lua_tolstring would intern a string for them
+    lua_number2str(num, lua_tonumber(L, narg));
+    buffer_add(L, b, num, strlen(num));
+  }
+  else if ((src = buffer_test(L, narg)) != NULL) {
+    n = src->len;
+    buffer_reserve(L, b, n);
+    // src may be b, take its data after the reserve
+    buffer_add(L, b, src->data, n);
+  }
+  else {
+    s = luaL_checklstring(L, narg, &n);
+    buffer_add(L, b, s, n);
+  }
+}
+
+static ptrdiff_t buffer_posrelat( ptrdiff_t pos, size_t len )
+{
+  // negative means back from the end, like string.sub
+  if (pos < 0) pos += (ptrdiff_t)len + 1;
+  return (pos >= 0) ? pos : 0;
+}
+
+// Contents of a buffer or a string argument, for modules that send bytes
+LUALIB_API const char* buffer_checklstring( lua_State* L, int narg, size_t *len )
+{
+  buffer_t *b = buffer_test(L, narg);
+
+  if (b == NULL) return luaL_checklstring(L, narg, len);
+  if (len != NULL) *len = b->len;
+  return b->data ? b->data : "";
+}
+
+LUALIB_API int buffer_isstring( lua_State* L, int narg )
+{
+  return lua_isstring(L, narg) || buffer_test(L, narg) != NULL;
+}
+
+//b = buffer.new([size]), size is reserved up front
+static int buffer_new( lua_State* L )
+{
+  int size = luaL_optinteger(L, 1, 0);
+  buffer_t *b;
+
+  if (size < 0) return luaL_error( L, "size must be >= 0" );
+  b = (buffer_t*)lua_newuserdata(L, sizeof(buffer_t));
+  b->len = 0;
+  b->size = 0;
+  b->data = NULL;
+  luaL_getmetatable(L, BUFFER_NAME);
+  lua_setmetatable(L, -2);
+  if (size > 0) {
+    buffer_reserve(L, b, size);
+    b->data[0] = 0;
+  }
+  return 1;
+}
+
+//b:append(v1, v2, ...), strings, numbers or buffers, returns b
+static int buffer_append( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+  int i, top = lua_gettop(L);
+
+  for (i = 2; i <= top; i++)
+    buffer_addvalue(L, b, i);
+  lua_settop(L, 1);
+  return 1;
+}
+
+static const char* buffer_scanformat( lua_State* L, const char *strfrmt, char *form )
+{
+  const char *p = strfrmt;
+  while (*p != '\0' && strchr(BUFFER_FLAGS, *p) != NULL) p++;  // skip flags
+  if ((size_t)(p - strfrmt) >= sizeof(BUFFER_FLAGS))
+    luaL_error(L, "invalid format (repeated flags)");
+  if (isdigit((unsigned char)*p)) p++;  // skip width
+  if (isdigit((unsigned char)*p)) p++;  // (2 digits at most)
+  if (*p == '.') {
+    p++;
+    if (isdigit((unsigned char)*p)) p++;  // skip precision
+    if (isdigit((unsigned char)*p)) p++;  // (2 digits at most)
+  }
+  if (isdigit((unsigned char)*p))
+    luaL_error(L, "invalid format (width or precision too long)");
+  *(form++) = '%';
+  strncpy(form, strfrmt, p - strfrmt + 1);
+  form += p - strfrmt + 1;
+  *form = '\0';
+  return p;
+}
+
+static void buffer_addintlen( char *form )
+{
+  size_t l = strlen(form);
+  char spec = form[l - 1];
+  strcpy(form + l - 1, LUA_INTFRMLEN);
+  form[l + sizeof(LUA_INTFRMLEN) - 2] = spec;
+  form[l + sizeof(LUA_INTFRMLEN) - 1] = '\0';
+}
+
+// Format one item into out, returns the length it needs like snprintf
+static int buffer_formatitem( lua_State* L, char *out, size_t room, const char *form, int spec, int arg )
+{
+  switch (spec) {
+    case 'c':
+      return snprintf(out, room, form, (int)luaL_checknumber(L, arg));
+    case 'd':  case 'i':
+      return snprintf(out, room, form, (LUA_INTFRM_T)luaL_checknumber(L, arg));
+    case 'o':  case 'u':  case 'x':  case 'X':
+      return snprintf(out, room, form, (unsigned LUA_INTFRM_T)luaL_checknumber(L, arg));
+#if !defined LUA_NUMBER_INTEGRAL
+    case 'e':  case 'E': case 'f':
+    case 'g': case 'G':
+      return snprintf(out, room, form, (double)luaL_checknumber(L, arg));
+#endif
+    case 's':
+      return snprintf(out, room, form, buffer_checklstring(L, arg, NULL));
+    default:
+      return luaL_error(L, "invalid option " LUA_QL("%%%c") " to "
+                           LUA_QL("appendf"), spec);
+  }
+}
+
+//b:appendf(fmt, ...), formats like string.format (without %q) straight
+//into the buffer, %s also takes a buffer, returns b
+static int buffer_appendf( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+  int top = lua_gettop(L), arg = 2;
+  size_t sfl, l;
+  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  const char *strfrmt_end = strfrmt + sfl;
+  const char *s;
+  char form[BUFFER_MAX_FORMAT];
+  size_t room;
+  int spec, n;
+
+  while (strfrmt < strfrmt_end) {
+    if (*strfrmt != '%') {
+      s = strfrmt;
+      while (strfrmt < strfrmt_end && *strfrmt != '%') strfrmt++;
+      buffer_add(L, b, s, strfrmt - s);
+      continue;
+    }
+    if (*++strfrmt == '%') {
+      buffer_add(L, b, strfrmt++, 1);
+      continue;
+    }
+    if (++arg > top)
+      luaL_argerror(L, arg, "no value");
+    strfrmt = buffer_scanformat(L, strfrmt, form);
+    spec = *strfrmt++;
+    switch (spec) {
+      case 'd':  case 'i':
+      case 'o':  case 'u':  case 'x':  case 'X':
+        buffer_addintlen(form);
+        break;
+      case 's':
+        s = buffer_checklstring(L, arg, &l);
+        if ((!strchr(form, '.') && l >= 100) || (b->data != NULL && s == b->data)) {
+          // no precision and too long to be formatted, or b itself which
+          // cannot be formatted into its own end, keep it as it is
+          buffer_addvalue(L, b, arg);
+          continue;
+        }
+        break;
+    }
+    // format into the free room, an item that did not fit (%f of a large
+    // number, a wide field) is formatted again after growing to its length
+    room = BUFFER_MAX_ITEM;
+    for (;;) {
+      buffer_reserve(L, b, room);
+      room = b->size - b->len;
+      n = buffer_formatitem(L, b->data + b->len, room, form, spec, arg);
+      if (n < 0) return luaL_error(L, "invalid format");
+      if ((size_t)n < room) break;
+      room = n;
+    }
+    b->len += n;
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+//b:byte([i [, j]]), the bytes from i to j, like string.byte
+static int buffer_byte( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+  ptrdiff_t posi = buffer_posrelat(luaL_optinteger(L, 2, 1), b->len);
+  ptrdiff_t pose = buffer_posrelat(luaL_optinteger(L, 3, posi), b->len);
+  int n, i;
+
+  if (posi <= 0) posi = 1;
+  if ((size_t)pose > b->len) pose = b->len;
+  if (posi > pose) return 0;
+  n = (int)(pose - posi + 1);
+  luaL_checkstack(L, n, "buffer slice too long");
+  for (i = 0; i < n; i++)
+    lua_pushinteger(L, (unsigned char)b->data[posi + i - 1]);
+  return n;
+}
+
+//b:set(i, byte1, ...), overwrite bytes from i on, the buffer grows when
+//they run past its end, returns b
+static int buffer_set( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+  ptrdiff_t pos = buffer_posrelat(luaL_checkinteger(L, 2), b->len);
+  int i, top = lua_gettop(L), c;
+  size_t end;
+
+  if (pos <= 0 || (size_t)pos > b->len + 1)
+    return luaL_error( L, "position out of range" );
+  // all bytes are checked before the buffer changes
+  for (i = 3; i <= top; i++) {
+    c = luaL_checkinteger(L, i);
+    luaL_argcheck(L, (unsigned char)c == c, i, "invalid value");
+  }
+  end = pos - 1 + (top - 2);
+  if (end > b->len) {
+    buffer_reserve(L, b, end - b->len);
+    b->len = end;
+    b->data[end] = 0;
+  }
+  for (i = 3; i <= top; i++)
+    b->data[pos - 1 + i - 3] = (char)lua_tointeger(L, i);
+  lua_settop(L, 1);
+  return 1;
+}
+
+//s = b:sub(i [, j]), a string of the bytes from i to j, like string.sub
+static int buffer_sub( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+  ptrdiff_t start = buffer_posrelat(luaL_checkinteger(L, 2), b->len);
+  ptrdiff_t end = buffer_posrelat(luaL_optinteger(L, 3, -1), b->len);
+
+  if (start < 1) start = 1;
+  if (end > (ptrdiff_t)b->len) end = (ptrdiff_t)b->len;
+  if (start <= end)
+    lua_pushlstring(L, b->data + start - 1, end - start + 1);
+  else lua_pushliteral(L, "");
+  return 1;
+}
+
+//b:clear(), empty the buffer but keep its memory, returns b
+static int buffer_clear( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+
+  b->len = 0;
+  if (b->data) b->data[0] = 0;
+  lua_settop(L, 1);
+  return 1;
+}
+
+//n = b:len() or #b
+static int buffer_len( lua_State* L )
+{
+  lua_pushinteger(L, buffer_check(L, 1)->len);
+  return 1;
+}
+
+//s = b:tostring() or tostring(b)
+static int buffer_tostring( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+
+  lua_pushlstring(L, b->data ? b->data : "", b->len);
+  return 1;
+}
+
+static int buffer_gc( lua_State* L )
+{
+  buffer_t *b = buffer_check(L, 1);
+
+  if (b->data) {
+    luaM_freemem(L, b->data, b->size);
+    b->data = NULL;
+  }
+  b->len = b->size = 0;
+  return 0;
+}
+
+#define MIN_OPT_LEVEL       1
+#include "lrodefs.h"
+const LUA_REG_TYPE buffer_buf_map[] =
+{
+  { LSTRKEY( "append" ), LFUNCVAL( buffer_append ) },
+  { LSTRKEY( "appendf" ), LFUNCVAL( buffer_appendf ) },
+  { LSTRKEY( "byte" ), LFUNCVAL( buffer_byte ) },
+  { LSTRKEY( "set" ), LFUNCVAL( buffer_set ) },
+  { LSTRKEY( "sub" ), LFUNCVAL( buffer_sub ) },
+  { LSTRKEY( "clear" ), LFUNCVAL( buffer_clear ) },
+  { LSTRKEY( "len" ), LFUNCVAL( buffer_len ) },
+  { LSTRKEY( "tostring" ), LFUNCVAL( buffer_tostring ) },
+  {LNILKEY, LNILVAL}
+};
+
+#undef MIN_OPT_LEVEL
+#define MIN_OPT_LEVEL       2
+#include "lrodefs.h"
+const LUA_REG_TYPE buffer_map[] =
+{
+  { LSTRKEY( "new" ), LFUNCVAL( buffer_new ) },
+  {LNILKEY, LNILVAL}
+};
+
+LUALIB_API int luaopen_buffer(lua_State *L)
+{
+  // A RAM metatable like json.parser, with the methods behind __index
+  luaL_newmetatable(L, BUFFER_NAME);
+  lua_pushcfunction(L, buffer_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pushcfunction(L, buffer_len);
+  lua_setfield(L, -2, "__len");
+  lua_pushcfunction(L, buffer_tostring);
+  lua_setfield(L, -2, "__tostring");
+#if LUA_OPTIMIZE_MEMORY > 0
+  lua_pushrotable(L, (void*)buffer_buf_map);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  return 0;
+#else
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, buffer_buf_map);
+  lua_pop(L, 1);
+  luaL_register( L, EXLIB_BUFFER, buffer_map );
+  return 1;
+#endif
+}
@@ -24,6 +24,7 @@ static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
 static u8_t spiffs_fds[32*4];
 static u8_t spiffs_cache_buf[(LOG_PAGE_SIZE+32)*4];
 spiffs fs;
+static mico_mutex_t spiffs_mutex = NULL;
 #define FILE_NOT_OPENED 0
 volatile int file_fd = FILE_NOT_OPENED;
 
@@ -74,6 +75,19 @@ static s32_t lspiffs_erase(u32_t addr, u32_t size) {
     return SPIFFS_OK;
   } 
 
+//-----------------------
+void spiffs_api_lock(void)
+{
+  if (spiffs_mutex != NULL)
+    mico_rtos_lock_mutex(&spiffs_mutex);
+}
+
+void spiffs_api_unlock(void)
+{
+  if (spiffs_mutex != NULL)
+    mico_rtos_unlock_mutex(&spiffs_mutex);
+}
+
 //-----------------------
 void lua_spiffs_mount() {
     mico_logic_partition_t* part;
@@ -96,6 +110,7 @@ void lua_spiffs_mount() {
     //MicoFlashInitialize(MICO_FLASH_FOR_LUA);
     
     if(SPIFFS_mounted(&fs)) return;
+    if(spiffs_mutex == NULL) mico_rtos_init_mutex(&spiffs_mutex);
     
     int res = SPIFFS_mount(&fs,
       &cfg,
@@ -135,13 +150,7 @@ int mode2flag(char *mode) {
 //-----------------------------------------------------------
 static uint16_t Cal_CRC16(const uint8_t* data, uint32_t size)
 {
-  CRC16_Context contex;
-  uint16_t ret;
-  
-  CRC16_Init( &contex );
-  CRC16_Update( &contex, data, size );
-  CRC16_Final( &contex, &ret );
-  return ret;
+  return CRC16_Calc( data, size );
 }
 
 /*
@@ -158,26 +167,6 @@ static uint8_t CalChecksum(const uint8_t* data, uint32_t size)
 }
 */
 
-//------------------------------------------------------------------------
-static unsigned short crc16(const unsigned char *buf, unsigned long count)
-{
-  unsigned short crc = 0;
-  int i;
-
-  while(count--) {
-          crc = crc ^ *buf++ << 8;
-
-          for (i=0; i<8; i++) {
-                  if (crc & 0x8000) {
-                          crc = crc << 1 ^ 0x1021;
-                  } else {
-                          crc = crc << 1;
-                  }
-          }
-  }
-  return crc;
-}
-
 
 //--------------------------------------------------------
 static int32_t Receive_Byte (uint8_t *c, uint32_t timeout)
@@ -277,7 +266,7 @@ static int32_t Receive_Packet (uint8_t *data, int32_t *length, uint32_t timeout)
   {
     return -1;
   }
-  if (crc16(&data[PACKET_HEADER], packet_size + PACKET_TRAILER) != 0) {
+  if (CRC16_Calc(&data[PACKET_HEADER], packet_size + PACKET_TRAILER) != 0) {
     return -1;
   }
   *length = packet_size;
@@ -975,7 +964,7 @@ static int file_write( lua_State* L )
     return luaL_error(L, "open a file first");
   
   size_t len;
-  const char *s = luaL_checklstring(L, 1, &len);
+  const char *s = buffer_checklstring(L, 1, &len);
   
   if(SPIFFS_write(&fs,file_fd, (char*)s, len)<0)
   {//failed
@@ -996,7 +985,7 @@ static int file_writeline( lua_State* L )
     return luaL_error(L, "open a file first");
   
   size_t len;
-  const char *s = luaL_checklstring(L, 1, &len);
+  const char *s = buffer_checklstring(L, 1, &len);
   
   if(SPIFFS_write(&fs,file_fd, (char*)s, len)<0)
   {//failed
@@ -1223,47 +1212,145 @@ static int writer(lua_State* L, const void* p, size_t size, void* u)
   return 0;
 }
 
-//rewrite lauxlib.c:luaL_loadfile
+//streaming compile: every top level function is written to a temporary
+//file and released as soon as the parser closes it, so peak heap is bounded
+//by the largest function instead of the whole script
+typedef struct {
+  int fd;
+  int strip;
+  int status;
+  size_t wrote;
+} CompileState;
+
+typedef struct {
+  int fd;
+  int extraline;
+  char buff[LUAL_BUFFERSIZE];
+} CompileReader;
+
+static CompileReader compile_reader;
+
+static const char *compile_read(lua_State *L, void *ud, size_t *size)
+{
+  CompileReader *cr = (CompileReader *)ud;
+  s32_t len;
+
+  if (L == NULL && size == NULL) // Direct mode check
+    return NULL;
+
+  if (cr->extraline) {
+    cr->extraline = 0;
+    *size = 1;
+    return "\n";
+  }
+  len = SPIFFS_read(&fs, cr->fd, cr->buff, sizeof(cr->buff));
+  if (len <= 0)
+    return NULL;
+  *size = len;
+  return cr->buff;
+}
+
+static void compile_hook(lua_State *L, Proto *f, void *ud)
+{
+  CompileState *cs = (CompileState *)ud;
+  if (cs->status == 0)
+    cs->status = luaU_dump_proto(L, f, f->source, writer, &cs->fd, cs->strip, &cs->wrote);
+  luaF_releaseproto(L, f);
+}
+
+//file.compile(name[, strip])
 #define toproto(L,i) (clvalue(L->top+(i))->l.p)
 static int file_compile( lua_State* L )
 {
   Proto* f;
+  ZIO z;
+  CompileState cs;
   int file_fd = FILE_NOT_OPENED;
+  int status, result;
+  char c;
   size_t len;
   const char *fname = luaL_checklstring( L, 1, &len );
-  if ( len > SPIFFS_OBJ_NAME_LEN )
+  if ( len >= SPIFFS_OBJ_NAME_LEN )
     return luaL_error(L, "filename too long");
 
   char output[SPIFFS_OBJ_NAME_LEN];
+  char temp[SPIFFS_OBJ_NAME_LEN];
   strcpy(output, fname);
   // check here that filename end with ".lua".
   if (len < 4 || (strcmp( output + len - 4, ".lua") != 0) )
     return luaL_error(L, "not a .lua file");
 
-  output[strlen(output) - 2] = 'c';
-  output[strlen(output) - 1] = '\0';
-  
-  if (luaL_loadfile(L, fname) != 0) {
-    return luaL_error(L, lua_tostring(L, -1));
+  output[len - 2] = 'c';
+  output[len - 1] = '\0';
+  strcpy(temp, output);
+  strcat(temp, "~");
+
+  cs.strip = lua_isnoneornil(L, 2) ? 1 : lua_toboolean(L, 2); /* strip debug information? */
+  cs.status = 0;
+  cs.wrote = 0;
+
+  compile_reader.extraline = 0;
+  compile_reader.fd = SPIFFS_open(&fs, (char*)fname, SPIFFS_RDONLY, 0);
+  if (compile_reader.fd < FILE_NOT_OPENED)
+    return luaL_error(L, "cannot open %s", fname);
+  if (SPIFFS_read(&fs, compile_reader.fd, &c, 1) == 1) {
+    if (c == LUA_SIGNATURE[0]) {
+      SPIFFS_close(&fs, compile_reader.fd);
+      return luaL_error(L, "%s is already compiled", fname);
+    }
+    if (c == '#') {  /* skip eventual `#!...' line, keep line numbers */
+      compile_reader.extraline = 1;
+      while (SPIFFS_read(&fs, compile_reader.fd, &c, 1) == 1 && c != '\n') ;
+    }
+    else
+      SPIFFS_lseek(&fs, compile_reader.fd, 0, SPIFFS_SEEK_SET);
   }
 
-  f = toproto(L, -1);
+  cs.fd = SPIFFS_open(&fs, temp, mode2flag("w+"), 0);
+  if (cs.fd < FILE_NOT_OPENED) {
+    SPIFFS_close(&fs, compile_reader.fd);
+    return luaL_error(L, "cannot open/write to file");
+  }
+
+  lua_pushfstring(L, "@%s", fname);
+  lua_lock(L);
+  luaZ_init(L, &z, compile_read, &compile_reader);
+  status = luaD_protectedparser_hook(L, &z, lua_tostring(L, -1), compile_hook, &cs);
+  lua_unlock(L);
+  SPIFFS_close(&fs, compile_reader.fd);
+  if (status != 0 || cs.status != 0) {
+    SPIFFS_close(&fs, cs.fd);
+    SPIFFS_remove(&fs, temp);
+    if (status != 0)
+      return luaL_error(L, lua_tostring(L, -1));
+    return luaL_error(L, "cannot write to file");
+  }
 
-  int stripping = 1;      /* strip debug information? */
+  f = toproto(L, -1);
 
   file_fd = SPIFFS_open(&fs,(char*)output,mode2flag("w+"),0);
   if (file_fd < FILE_NOT_OPENED)
   {
+    SPIFFS_close(&fs, cs.fd);
+    SPIFFS_remove(&fs, temp);
     return luaL_error(L, "cannot open/write to file");
   }
 
+  SPIFFS_fflush(&fs, cs.fd);
+  SPIFFS_lseek(&fs, cs.fd, 0, SPIFFS_SEEK_SET);
+  compile_reader.fd = cs.fd;
+  compile_reader.extraline = 0;
+
   lua_lock(L);
-  int result = luaU_dump(L, f, writer, &file_fd, stripping);
+  result = luaU_dump_streamed(L, f, writer, &file_fd, cs.strip, compile_read, &compile_reader);
   lua_unlock(L);
+  lua_pop(L, 2);
 
   SPIFFS_fflush(&fs,file_fd);
   SPIFFS_close(&fs,file_fd);
   file_fd =FILE_NOT_OPENED;
+  SPIFFS_close(&fs, cs.fd);
+  SPIFFS_remove(&fs, temp);
 
   if (result == LUA_ERR_CC_INTOVERFLOW) {
     return luaL_error(L, "value too big or small for target integer type");
@@ -1271,6 +1358,9 @@ static int file_compile( lua_State* L )
   if (result == LUA_ERR_CC_NOTINTEGER) {
     return luaL_error(L, "target lua_Number is integral but fractional value found");
   }
+  if (result != 0) {
+    return luaL_error(L, "cannot write to file");
+  }
 
   return 0;
 }
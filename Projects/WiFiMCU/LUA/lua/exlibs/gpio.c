@@ -18,6 +18,10 @@
 #define INTERRUPT     OUTPUT_OPEN_DRAIN_PULL_UP+3
 #define HIGH          OUTPUT_OPEN_DRAIN_PULL_UP+4
 #define LOW           OUTPUT_OPEN_DRAIN_PULL_UP+5
+#define CAPTURE       OUTPUT_OPEN_DRAIN_PULL_UP+6
+#define COUNT         OUTPUT_OPEN_DRAIN_PULL_UP+7
+
+#define GPIO_EDGE_RING_SIZE  64   // edges buffered per capture pin, power of 2
 
 extern mico_queue_t os_queue;
 const char wifimcu_gpio_map[] =
@@ -50,32 +54,200 @@ static int platform_gpio_exists( unsigned pin )
 static int gpio_cb_ref[MICO_GPIO_MAX];
 static lua_State* gL = NULL;
 
+typedef struct
+{
+  uint32_t us;
+  uint32_t level;
+} gpio_edge_t;
+
+// Edge state of one pin. The ISR only touches this struct, Lua is called
+// from the queue thread with whatever has accumulated since the last call.
+typedef struct
+{
+  uint8_t           mode;       // 0, INTERRUPT, CAPTURE or COUNT
+  uint8_t           both;       // triggered on both edges
+  uint8_t           seen;       // last/last_level are valid
+  uint8_t           last_level;
+  volatile uint8_t  pending;    // a queue message is in flight
+  uint16_t          batch;      // CAPTURE: edges needed before Lua is called
+  uint32_t          debounce;   // us, 0 = off
+  uint32_t          last;       // us of last accepted edge
+  volatile uint32_t count;      // INTERRUPT: edges since last call, COUNT: total
+  volatile uint32_t dropped;    // CAPTURE: edges lost to a full ring
+  volatile uint32_t first;      // COUNT: first edge of frequency window
+  volatile uint32_t stamp;      // COUNT: last edge of frequency window
+  volatile uint32_t window;     // COUNT: edges in frequency window
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  gpio_edge_t      *ring;
+} gpio_edge_state_t;
+
+static gpio_edge_state_t gpio_edge[NUM_GPIO];
+
+// Microseconds from the RTOS tick and the SysTick down counter. Unlike
+// DWT->CYCCNT it is not reset by the bit-banged i2c/spi/sensor code.
+uint32_t gpio_time_us( void )
+{
+  uint32_t ms = mico_get_time();
+  uint32_t load = SysTick->LOAD + 1;
+  uint32_t val = SysTick->VAL;
+
+  // counter wrapped but the tick interrupt has not run yet
+  if ( ( SCB->ICSR & SCB_ICSR_PENDSTSET_Msk ) && val > load/2 )
+    ms++;
+  return ms*1000 + ( load - 1 - val ) / ( SystemCoreClock/1000000 );
+}
+
+static void gpio_edge_post( unsigned id )
+{
+  queue_msg_t msg;
+  gpio_edge[id].pending = 1;
+  msg.L = gL;
+  msg.source = GPIO;
+  msg.para1 = id;
+  msg.para2 = gpio_cb_ref[id];
+  msg.para3 = NULL;
+  msg.para4 = NULL;
+  if ( mico_rtos_push_to_queue( &os_queue, &msg, 0 ) != kNoErr )
+    gpio_edge[id].pending = 0;  // retry on the next edge
+}
+
 static void _gpio_irq_handler( void* arg )
 {
   unsigned id = (unsigned)arg;
-  if(id<NUM_GPIO)
+  gpio_edge_state_t *e;
+  uint32_t now, level;
+  uint16_t next;
+
+  if(id>=NUM_GPIO) return;
+  e = &gpio_edge[id];
+  now = gpio_time_us();
+  level = MicoGpioInputGet( (mico_gpio_t)wifimcu_gpio_map[id] ) ? 1 : 0;
+
+  if ( e->debounce && e->seen )
   {
-    queue_msg_t msg;
-    msg.L = gL;
-    msg.source = GPIO;
-    //msg.para1;
-    msg.para2 = gpio_cb_ref[id];;
-    mico_rtos_push_to_queue( &os_queue, &msg,0);
+    if ( now - e->last < e->debounce ) return;
+    // a bounce that settled back to the last reported level
+    if ( e->both && level == e->last_level ) return;
+  }
+  e->seen = 1;
+  e->last = now;
+  e->last_level = level;
+
+  switch ( e->mode )
+  {
+    case INTERRUPT:
+      e->count++;
+      if ( !e->pending ) gpio_edge_post( id );
+      break;
+    case CAPTURE:
+      next = ( e->head + 1 ) & ( GPIO_EDGE_RING_SIZE - 1 );
+      if ( next == e->tail )
+      {
+        e->dropped++;
+      }
+      else
+      {
+        e->ring[e->head].us = now;
+        e->ring[e->head].level = level;
+        e->head = next;
+      }
+      if ( !e->pending &&
+           ( ( e->head - e->tail ) & ( GPIO_EDGE_RING_SIZE - 1 ) ) >= e->batch )
+        gpio_edge_post( id );
+      break;
+    case COUNT:
+      e->count++;
+      if ( e->window++ == 0 ) e->first = now;
+      e->stamp = now;
+      break;
+    default:
+      break;
+  }
+}
+
+// called from the queue thread for msg.source == GPIO
+void _gpio_irq_handle( lua_State* L, int id )
+{
+  gpio_edge_state_t *e;
+  uint32_t n;
+  int i;
+
+  if ( id < 0 || id >= NUM_GPIO ) return;
+  e = &gpio_edge[id];
+  e->pending = 0;
+  if ( gpio_cb_ref[id] == LUA_NOREF ) return;
+
+  if ( e->mode == INTERRUPT )
+  {
+    __disable_irq();
+    n = e->count;
+    e->count = 0;
+    __enable_irq();
+    if ( n == 0 ) return;
+    lua_rawgeti( L, LUA_REGISTRYINDEX, gpio_cb_ref[id] );
+    lua_pushinteger( L, n );
+    lua_call( L, 1, 0 );
+  }
+  else if ( e->mode == CAPTURE && e->ring != NULL )
+  {
+    uint16_t head = e->head;
+    uint16_t tail = e->tail;
+    n = ( head - tail ) & ( GPIO_EDGE_RING_SIZE - 1 );
+    lua_rawgeti( L, LUA_REGISTRYINDEX, gpio_cb_ref[id] );
+    lua_createtable( L, n, 0 );
+    lua_createtable( L, n, 0 );
+    for ( i = 1; tail != head; i++ )
+    {
+      lua_pushnumber( L, e->ring[tail].us );
+      lua_rawseti( L, -3, i );
+      lua_pushinteger( L, e->ring[tail].level );
+      lua_rawseti( L, -2, i );
+      tail = ( tail + 1 ) & ( GPIO_EDGE_RING_SIZE - 1 );
+    }
+    e->tail = tail;
+    __disable_irq();
+    n = e->dropped;
+    e->dropped = 0;
+    __enable_irq();
+    lua_pushinteger( L, n );
+    lua_call( L, 3, 0 );
   }
 }
 
+static void gpio_edge_release( lua_State* L, unsigned pin )
+{
+  gpio_edge_state_t *e = &gpio_edge[pin];
+  if ( e->mode != 0 )
+    MicoGpioDisableIRQ( (mico_gpio_t)wifimcu_gpio_map[pin] );
+  if ( gpio_cb_ref[pin] != LUA_NOREF )
+    luaL_unref( L, LUA_REGISTRYINDEX, gpio_cb_ref[pin] );
+  gpio_cb_ref[pin] = LUA_NOREF;
+  if ( e->ring != NULL )
+    free( e->ring );
+  memset( e, 0, sizeof(gpio_edge_state_t) );
+}
+
 // gpio.mode(pin,mode)
-//gpio.mode(pin,gpio.INT,'rising',function)
+//gpio.mode(pin,gpio.INT,'rising',function[,debounce_us])
+//gpio.mode(pin,gpio.CAPTURE,'both',function[,debounce_us[,batch]])
+//gpio.mode(pin,gpio.COUNT,'rising'[,debounce_us])
 static int lgpio_mode( lua_State* L )
 {
   unsigned mode=0;
   unsigned pin=0;
   unsigned platformPin=0;
+  int arg=4;
+  int batch=1;
+  unsigned debounce=0;
+  gpio_edge_state_t *e;
   pin = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( gpio, pin );
   platformPin = wifimcu_gpio_map[pin];
   mode = luaL_checkinteger( L, 2 );
   if (  mode!=INTERRUPT&&
+        mode!=CAPTURE&&
+        mode!=COUNT&&
         mode!=INPUT && 
         mode!=INPUT_PULL_UP&&
         mode!=INPUT_PULL_DOWN&&
@@ -89,14 +261,9 @@ static int lgpio_mode( lua_State* L )
   if( mode == INPUT)    mode = INPUT_PULL_UP;//for default
   if( mode == OUTPUT)   mode = OUTPUT_PUSH_PULL;//for default
 
-  if (mode!=INTERRUPT)
+  if (mode!=INTERRUPT && mode!=CAPTURE && mode!=COUNT)
   {// disable interrupt
-    if(gpio_cb_ref[pin] != LUA_NOREF)
-    {
-      luaL_unref(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
-      MicoGpioDisableIRQ((mico_gpio_t)platformPin);
-    }
-    gpio_cb_ref[pin] = LUA_NOREF;
+    gpio_edge_release(L, pin);
     MicoGpioFinalize((mico_gpio_t)platformPin);
     MicoGpioInitialize((mico_gpio_t)platformPin,(mico_gpio_config_t)mode);
   }
@@ -116,19 +283,36 @@ static int lgpio_mode( lua_State* L )
        }
        else
          return luaL_error( L, "arg should be 'rising' or 'falling' or 'both' " );
-        
-      if (lua_type(L, 4) == LUA_TFUNCTION || lua_type(L, 4) == LUA_TLIGHTFUNCTION)
+
+      if (mode != COUNT)
+      {
+        if (lua_type(L, 4) != LUA_TFUNCTION && lua_type(L, 4) != LUA_TLIGHTFUNCTION)
+          return luaL_error( L, "callback function needed" );
+        arg = 5;
+      }
+      debounce = luaL_optinteger( L, arg, 0 );
+      if (mode == CAPTURE)
+        batch = luaL_optinteger( L, arg+1, 1 );
+      if (batch < 1 || batch >= GPIO_EDGE_RING_SIZE)
+        return luaL_error( L, "batch should be 1~%d", GPIO_EDGE_RING_SIZE-1 );
+
+      gpio_edge_release(L, pin);
+      e = &gpio_edge[pin];
+      e->debounce = debounce;
+      e->batch = batch;
+      if (mode == CAPTURE)
+      {
+        e->ring = (gpio_edge_t*)malloc( GPIO_EDGE_RING_SIZE*sizeof(gpio_edge_t) );
+        if (e->ring == NULL)
+          return luaL_error( L, "memory not enough" );
+      }
+      if (mode != COUNT)
       {
         lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-        if(gpio_cb_ref[pin] != LUA_NOREF)
-        {
-          luaL_unref(L, LUA_REGISTRYINDEX, gpio_cb_ref[pin]);
-          MicoGpioDisableIRQ((mico_gpio_t)platformPin);
-        }
         gpio_cb_ref[pin] = luaL_ref(L, LUA_REGISTRYINDEX);
       }
-      else
-        return luaL_error( L, "callback function needed" );
+      e->both = (type == IRQ_TRIGGER_BOTH_EDGES);
+      e->mode = mode;
 
     gL = L;
     MicoGpioFinalize((mico_gpio_t)platformPin);
@@ -138,6 +322,46 @@ static int lgpio_mode( lua_State* L )
   return 0;  
 }
 
+// Lua: count( pin [, reset] ), edges seen in gpio.COUNT mode
+static int lgpio_count( lua_State* L )
+{
+  unsigned pin=0;
+  uint32_t n;
+  pin = luaL_checkinteger( L, 1 );
+  MOD_CHECK_ID( gpio, pin );
+  if ( gpio_edge[pin].mode != COUNT )
+    return luaL_error( L, "pin is not in COUNT mode" );
+  __disable_irq();
+  n = gpio_edge[pin].count;
+  if ( lua_toboolean( L, 2 ) ) gpio_edge[pin].count = 0;
+  __enable_irq();
+  lua_pushnumber( L, n );
+  return 1;
+}
+
+// Lua: freq( pin ), edge frequency in Hz since the previous call
+static int lgpio_freq( lua_State* L )
+{
+  unsigned pin=0;
+  uint32_t n, span;
+  gpio_edge_state_t *e;
+  pin = luaL_checkinteger( L, 1 );
+  MOD_CHECK_ID( gpio, pin );
+  e = &gpio_edge[pin];
+  if ( e->mode != COUNT )
+    return luaL_error( L, "pin is not in COUNT mode" );
+  __disable_irq();
+  n = e->window;
+  span = e->stamp - e->first;
+  e->window = 0;
+  __enable_irq();
+  if ( n < 2 || span == 0 )
+    lua_pushnumber( L, 0 );
+  else
+    lua_pushnumber( L, (lua_Number)( n - 1 ) * 1000000 / span );
+  return 1;
+}
+
 // Lua: read( pin )
 static int lgpio_read( lua_State* L )
 {
@@ -189,6 +413,8 @@ const LUA_REG_TYPE gpio_map[] =
   { LSTRKEY( "read" ), LFUNCVAL( lgpio_read ) },
   { LSTRKEY( "write" ), LFUNCVAL( lgpio_write ) },
   { LSTRKEY( "toggle" ), LFUNCVAL( lgpio_toggle ) },
+  { LSTRKEY( "count" ), LFUNCVAL( lgpio_count ) },
+  { LSTRKEY( "freq" ), LFUNCVAL( lgpio_freq ) },
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "INPUT" ), LNUMVAL( INPUT ) },
   { LSTRKEY( "INPUT_PULL_UP" ), LNUMVAL( INPUT_PULL_UP ) },
@@ -199,6 +425,8 @@ const LUA_REG_TYPE gpio_map[] =
   { LSTRKEY( "OUTPUT_OPEN_DRAIN_NO_PULL" ), LNUMVAL( OUTPUT_OPEN_DRAIN_NO_PULL ) },
   { LSTRKEY( "OUTPUT_OPEN_DRAIN_PULL_UP" ), LNUMVAL( OUTPUT_OPEN_DRAIN_PULL_UP ) },
   { LSTRKEY( "INT" ), LNUMVAL( INTERRUPT ) },
+  { LSTRKEY( "CAPTURE" ), LNUMVAL( CAPTURE ) },
+  { LSTRKEY( "COUNT" ), LNUMVAL( COUNT ) },
   { LSTRKEY( "HIGH" ), LNUMVAL( HIGH ) },
   { LSTRKEY( "LOW" ), LNUMVAL( LOW ) },
 #endif        
@@ -209,6 +437,7 @@ LUALIB_API int luaopen_gpio(lua_State *L)
 {
   for(int i=0;i<NUM_GPIO;i++){
     gpio_cb_ref[i] = LUA_NOREF;
+    memset(&gpio_edge[i], 0, sizeof(gpio_edge_state_t));
   }
 #if LUA_OPTIMIZE_MEMORY > 0
     return 0;
@@ -223,10 +452,20 @@ LUALIB_API int luaopen_gpio(lua_State *L)
   MOD_REG_NUMBER( L, "OUTPUT_OPEN_DRAIN_NO_PULL", OUTPUT_OPEN_DRAIN_NO_PULL);
   MOD_REG_NUMBER( L, "OUTPUT_OPEN_DRAIN_PULL_UP", OUTPUT_OPEN_DRAIN_PULL_UP);
   MOD_REG_NUMBER( L, "INT", INTERRUPT);
+  MOD_REG_NUMBER( L, "CAPTURE", CAPTURE);
+  MOD_REG_NUMBER( L, "COUNT", COUNT);
   MOD_REG_NUMBER( L, "HIGH", HIGH);
   MOD_REG_NUMBER( L, "LOW", LOW);
   return 1;
 #endif
 }
 
+LUALIB_API int luaclose_gpio(lua_State *L)
+{
+  for(int i=0;i<NUM_GPIO;i++){
+    gpio_edge_release(L, i);
+  }
+  return 0;
+}
+
 
@@ -25,6 +25,19 @@ bool hw_IIC_Init = false;
 static bool IIC_started = false;
 #define I2C_speed 360  // Standard mode, 100 kHz
 
+// bus lock, compiled programs may run from the program thread
+static mico_mutex_t i2c_mutex = NULL;
+
+static void _i2c_lock(void)
+{
+  if (i2c_mutex != NULL) mico_rtos_lock_mutex(&i2c_mutex);
+}
+
+static void _i2c_unlock(void)
+{
+  if (i2c_mutex != NULL) mico_rtos_unlock_mutex(&i2c_mutex);
+}
+
 //-------------------------------------------------------------------------
 // we use cycle counter for precise timing with software I2C
 #define CYCLE_COUNTING_INIT() \
@@ -152,7 +165,7 @@ static int IIC_Send_Byte(uint8_t txd)
 }
 
 //---------------------------------------------------------------------------------------
-int _i2c_write(uint8_t id, uint16_t dev_adr, uint8_t* data, uint16_t count, uint16_t rep)
+static int __i2c_write(uint8_t id, uint16_t dev_adr, uint8_t* data, uint16_t count, uint16_t rep)
 {
   uint16_t i, j;
   
@@ -197,6 +210,17 @@ int _i2c_write(uint8_t id, uint16_t dev_adr, uint8_t* data, uint16_t count, uint
   }
 }
 
+//---------------------------------------------------------------------------------------
+int _i2c_write(uint8_t id, uint16_t dev_adr, uint8_t* data, uint16_t count, uint16_t rep)
+{
+  int res;
+
+  _i2c_lock();
+  res = __i2c_write(id, dev_adr, data, count, rep);
+  _i2c_unlock();
+  return res;
+}
+
 //ack=1 send ACK; ack=0 send nACK
 //---------------------------------------------
 static uint8_t IIC_Read_Byte(unsigned char ack)
@@ -216,8 +240,8 @@ static uint8_t IIC_Read_Byte(unsigned char ack)
     CYCLE_COUNTING_INIT();
     while (DWT->CYCCNT < I2C_speed) ;
     // SCL is high, read out bit
-    if (MicoGpioInputGet((mico_gpio_t)pinSDA)) receive |= 1;
     receive <<= 1;
+    if (MicoGpioInputGet((mico_gpio_t)pinSDA)) receive |= 1;
     // Set SCL low in preparation for next operation
     MicoGpioOutputLow( (mico_gpio_t)pinSCL);
   }					 
@@ -247,6 +271,440 @@ static uint8_t IIC_Read_Byte(unsigned char ack)
 }
 
 
+//---------------------------------------------------------------------------
+// Compiled transaction lists
+// A program is a list of steps. Each transfer step is one START..STOP
+// transaction: optional write, then optional read after a repeated start.
+// Programs run once from Lua or periodically from a worker thread paced
+// by a MICO timer, in which case every run appends one sample (all read bytes) to a ring buffer.
+//---------------------------------------------------------------------------
+#define I2C_MAX_PROG        4
+#define I2C_PROG_MAX_STEPS  16
+#define I2C_PROG_MAX_TX     64
+#define I2C_PROG_MAX_RX     256
+#define I2C_PROG_DEF_DEPTH  32
+
+typedef struct {
+  uint8_t  txoff;
+  uint8_t  txlen;
+  uint16_t rxlen;
+  uint16_t delay;     // ms, steps with delay do no transfer
+} i2c_step_t;
+
+typedef struct {
+  uint8_t  id;
+  uint16_t dev_id;
+  uint8_t  nsteps;
+  uint16_t rxlen;     // bytes read per run = sample size
+  i2c_step_t steps[I2C_PROG_MAX_STEPS];
+  uint8_t  tx[I2C_PROG_MAX_TX];
+  // periodic run
+  bool     running;
+  mico_timer_t timer;
+  uint8_t* ring;      // (depth+1) samples
+  uint16_t depth;
+  volatile uint16_t head;
+  volatile uint16_t tail;
+  uint32_t dropped;
+  uint32_t errors;
+} i2c_prog_t;
+
+static i2c_prog_t* i2c_prog[I2C_MAX_PROG] = {NULL};
+
+//-----------------------------------------------------------------------------------------------------------
+static int _i2c_sw_xfer(uint16_t dev_id, const uint8_t* tx, uint16_t txlen, uint8_t* rx, uint16_t rxlen)
+{
+  uint16_t i;
+
+  IIC_Start();
+  if (txlen > 0) {
+    if (IIC_Send_Byte((uint8_t)(dev_id << 1)) != 0) goto nack;
+    for (i = 0; i < txlen; i++) {
+      if (IIC_Send_Byte(tx[i]) != 0) goto nack;
+    }
+    if (rxlen > 0) IIC_Start();  // repeated start
+  }
+  if (rxlen > 0) {
+    if (IIC_Send_Byte((uint8_t)((dev_id << 1) | 1)) != 0) goto nack;
+    for (i = 0; i < rxlen; i++) {
+      rx[i] = IIC_Read_Byte((i == (rxlen-1)) ? 0 : 1);
+    }
+  }
+  IIC_Stop();
+  return 0;
+
+nack:
+  IIC_Stop();
+  return -9;
+}
+
+// Run all steps of a program, read bytes are stored to out
+// the caller holds the bus lock
+//--------------------------------------------------
+static int __i2c_prog_run(i2c_prog_t* p, uint8_t* out)
+{
+  mico_i2c_message_t i2c_msg;
+  i2c_step_t* s;
+  OSStatus err;
+  uint8_t i;
+  int res = 0;
+
+  if (((p->id == 0) && (!IIC_Init)) || ((p->id == 1) && (!hw_IIC_Init))) return -8;
+
+  for (i = 0; (i < p->nsteps) && (res == 0); i++) {
+    s = &p->steps[i];
+    if (s->delay > 0) {
+      mico_thread_msleep(s->delay);
+      continue;
+    }
+    if (p->id == 0) {
+      res = _i2c_sw_xfer(p->dev_id, &p->tx[s->txoff], s->txlen, out, s->rxlen);
+    }
+    else {
+      memset(&i2c_msg, 0, sizeof(i2c_msg));
+      if ((s->txlen > 0) && (s->rxlen > 0))
+        err = MicoI2cBuildCombinedMessage(&i2c_msg, &p->tx[s->txoff], out, s->txlen, s->rxlen, 3);
+      else if (s->txlen > 0)
+        err = MicoI2cBuildTxMessage(&i2c_msg, &p->tx[s->txoff], s->txlen, 3);
+      else
+        err = MicoI2cBuildRxMessage(&i2c_msg, out, s->rxlen, 3);
+      if (err == kNoErr) {
+        hw_i2c.address = p->dev_id;
+        err = MicoI2cTransfer(&hw_i2c, &i2c_msg, 1, 1);
+      }
+      if (err != kNoErr) res = -9;
+    }
+    out += s->rxlen;
+  }
+  return res;
+}
+
+//-------------------------------------------------
+static int _i2c_prog_run(i2c_prog_t* p, uint8_t* out)
+{
+  int res;
+
+  _i2c_lock();
+  res = __i2c_prog_run(p, out);
+  _i2c_unlock();
+  return res;
+}
+
+// Periodic runs are done by one worker thread. The timers only mark the
+// slot as due, so transfers and delay steps never block the timer daemon.
+static mico_semaphore_t i2c_prog_sem = NULL;
+static volatile bool i2c_prog_due[I2C_MAX_PROG] = {false};
+
+// timer thread, arg is the program slot
+//-------------------------------------------
+static void _i2c_prog_timer( void* arg )
+{
+  i2c_prog_due[(int)arg] = true;
+  mico_rtos_set_semaphore(&i2c_prog_sem);
+}
+
+//--------------------------------------------
+static void _i2c_prog_thread( void* arg )
+{
+  i2c_prog_t* p;
+  uint16_t next;
+  int n;
+
+  while (1) {
+    mico_rtos_get_semaphore(&i2c_prog_sem, MICO_WAIT_FOREVER);
+    for (n = 0; n < I2C_MAX_PROG; n++) {
+      if (!i2c_prog_due[n]) continue;
+      i2c_prog_due[n] = false;
+
+      // stop and free change the slot under the lock, check it here
+      _i2c_lock();
+      p = i2c_prog[n];
+      if ((p != NULL) && (p->running)) {
+        next = (p->head + 1) % (p->depth + 1);
+        if (next == p->tail) p->dropped++;  // ring full, Lua did not drain in time
+        else if (__i2c_prog_run(p, &p->ring[p->head * p->rxlen]) != 0) p->errors++;
+        else p->head = next;
+      }
+      _i2c_unlock();
+    }
+  }
+}
+
+//------------------------------------------
+static void _i2c_prog_stop( i2c_prog_t* p )
+{
+  uint8_t* ring;
+
+  if (!p->running) return;
+  mico_stop_timer(&p->timer);
+  mico_deinit_timer(&p->timer);
+  _i2c_lock();  // wait for a run in progress
+  p->running = false;
+  ring = p->ring;
+  p->ring = NULL;
+  _i2c_unlock();
+  if (ring != NULL) free(ring);
+}
+
+//------------------------------------------
+static void _i2c_prog_free( uint8_t n )
+{
+  i2c_prog_t* p = i2c_prog[n];
+
+  if (p == NULL) return;
+  _i2c_prog_stop(p);
+  _i2c_lock();
+  i2c_prog[n] = NULL;
+  _i2c_unlock();
+  free(p);
+}
+
+//-----------------------------------------------------------
+static i2c_prog_t* _i2c_check_prog( lua_State* L, int stack )
+{
+  unsigned n = luaL_checkinteger( L, stack );
+  if ((n < 1) || (n > I2C_MAX_PROG) || (i2c_prog[n-1] == NULL))
+    luaL_error( L, "wrong program" );
+  return i2c_prog[n-1];
+}
+
+//i2c.compile(id, dev_id, {{"w",reg,...},{"r",n},{"d",ms},{"p"},...})
+//"w": write bytes (numbers or strings), "r": read n bytes, a write directly
+//followed by a read is done with repeated start, "d": delay in ms,
+//"p": stop, force a new transaction. Returns the program number.
+//====================================
+static int i2c_compile( lua_State* L )
+{
+  i2c_prog_t* p;
+  i2c_step_t* s = NULL;
+  const char* op;
+  const char* pdata;
+  size_t len, j;
+  int i, k, n, slot, argn, numdata;
+  int txused = 0;
+
+  unsigned id = luaL_checkinteger( L, 1 );
+  if ((id != 0) && (id != 1)) return luaL_error( L, "id should be assigend 0 or 1" );
+  unsigned dev_id = luaL_checkinteger( L, 2 );
+  if ((dev_id < 7) || (dev_id >= ((id == 1) && (hw_i2c.address_width == I2C_ADDRESS_WIDTH_10BIT) ? 0x0400 : 0x78)))
+    return luaL_error( L, "dev_id is wrong" );
+  luaL_checktype( L, 3, LUA_TTABLE );
+
+  for (slot = 0; slot < I2C_MAX_PROG; slot++) {
+    if (i2c_prog[slot] == NULL) break;
+  }
+  if (slot >= I2C_MAX_PROG) return luaL_error( L, "max %d programs", I2C_MAX_PROG );
+
+  p = (i2c_prog_t*)malloc(sizeof(i2c_prog_t));
+  if (p == NULL) return luaL_error( L, "memory not enough" );
+  memset(p, 0, sizeof(i2c_prog_t));
+  p->id = id;
+  p->dev_id = dev_id;
+
+  n = lua_objlen( L, 3 );
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti( L, 3, i );
+    if ((!lua_istable( L, -1 )) || (lua_objlen( L, -1 ) < 1)) goto badstep;
+    argn = lua_gettop( L );
+    lua_rawgeti( L, argn, 1 );
+    op = lua_tostring( L, -1 );
+    lua_pop( L, 1 );
+    if (op == NULL) goto badstep;
+
+    if (op[0] == 'w') {
+      if (lua_objlen( L, argn ) < 2) goto badstep;
+      // continue an open write, else start a new transaction
+      if ((s == NULL) || (s->rxlen > 0) || (s->delay > 0)) {
+        if (p->nsteps >= I2C_PROG_MAX_STEPS) goto toolong;
+        s = &p->steps[p->nsteps++];
+        s->txoff = txused;
+      }
+      for (k = 2; k <= lua_objlen( L, argn ); k++) {
+        lua_rawgeti( L, argn, k );
+        if (lua_type( L, -1 ) == LUA_TNUMBER) {
+          numdata = lua_tointeger( L, -1 );
+          if ((numdata < 0) || (numdata > 255)) goto badstep;
+          if (txused >= I2C_PROG_MAX_TX) goto toolong;
+          p->tx[txused++] = (uint8_t)numdata;
+          s->txlen++;
+        }
+        else {
+          pdata = lua_tolstring( L, -1, &len );
+          if (pdata == NULL) goto badstep;
+          if ((txused + len) > I2C_PROG_MAX_TX) goto toolong;
+          for (j = 0; j < len; j++) p->tx[txused++] = (uint8_t)pdata[j];
+          s->txlen += len;
+        }
+        lua_pop( L, 1 );
+      }
+    }
+    else if (op[0] == 'r') {
+      lua_rawgeti( L, argn, 2 );
+      numdata = lua_tointeger( L, -1 );
+      lua_pop( L, 1 );
+      if (numdata <= 0) goto badstep;
+      if ((p->rxlen + numdata) > I2C_PROG_MAX_RX) goto toolong;
+      if ((s == NULL) || (s->rxlen > 0) || (s->delay > 0)) {
+        if (p->nsteps >= I2C_PROG_MAX_STEPS) goto toolong;
+        s = &p->steps[p->nsteps++];
+        s->txoff = txused;
+      }
+      s->rxlen = numdata;
+      p->rxlen += numdata;
+    }
+    else if ((op[0] == 'd') || (op[0] == 'p')) {
+      numdata = 0;
+      if (op[0] == 'd') {
+        lua_rawgeti( L, argn, 2 );
+        numdata = lua_tointeger( L, -1 );
+        lua_pop( L, 1 );
+        if ((numdata <= 0) || (numdata > 0xFFFF)) goto badstep;
+      }
+      s = NULL;
+      if (numdata > 0) {
+        if (p->nsteps >= I2C_PROG_MAX_STEPS) goto toolong;
+        s = &p->steps[p->nsteps++];
+        s->txoff = txused;
+        s->delay = numdata;
+      }
+    }
+    else goto badstep;
+    lua_settop( L, argn - 1 );
+  }
+  if (p->nsteps == 0) {
+    free(p);
+    return luaL_error( L, "empty program" );
+  }
+
+  i2c_prog[slot] = p;
+  lua_pushinteger( L, slot + 1 );
+  return 1;
+
+badstep:
+  free(p);
+  return luaL_error( L, "wrong step %d", i );
+toolong:
+  free(p);
+  return luaL_error( L, "program too long" );
+}
+
+//i2c.run(prog): run once, returns read bytes as string or nil,err
+//================================
+static int i2c_run( lua_State* L )
+{
+  uint8_t b[I2C_PROG_MAX_RX];
+  int res;
+
+  i2c_prog_t* p = _i2c_check_prog( L, 1 );
+  if (p->running) return luaL_error( L, "program is running" );
+
+  res = _i2c_prog_run(p, b);
+  if (res != 0) {
+    lua_pushnil( L );
+    lua_pushinteger( L, res );
+    return 2;
+  }
+  lua_pushlstring( L, (const char*)b, p->rxlen );
+  return 1;
+}
+
+//i2c.start(prog, interval_ms[, depth])
+//run every interval_ms, keep up to depth samples for i2c.drain
+//==================================
+static int i2c_start( lua_State* L )
+{
+  i2c_prog_t* p = _i2c_check_prog( L, 1 );
+  unsigned n = luaL_checkinteger( L, 1 );
+  unsigned interval = luaL_checkinteger( L, 2 );
+  unsigned depth = luaL_optinteger( L, 3, I2C_PROG_DEF_DEPTH );
+
+  if (p->rxlen == 0) return luaL_error( L, "program reads nothing" );
+  if (interval == 0) return luaL_error( L, "wrong interval" );
+  if ((depth < 1) || (depth > 1024)) return luaL_error( L, "depth should be 1~1024" );
+
+  if (i2c_prog_sem == NULL) {
+    if (i2c_mutex == NULL) mico_rtos_init_mutex(&i2c_mutex);
+    mico_rtos_init_semaphore(&i2c_prog_sem, I2C_MAX_PROG);
+    if (mico_rtos_create_thread(NULL, MICO_DEFAULT_WORKER_PRIORITY, "i2c_prog", _i2c_prog_thread, 0x300, NULL) != kNoErr) {
+      mico_rtos_deinit_semaphore(&i2c_prog_sem);
+      i2c_prog_sem = NULL;
+      return luaL_error( L, "create thread failed" );
+    }
+  }
+
+  _i2c_prog_stop(p);
+  p->ring = (uint8_t*)malloc((depth + 1) * p->rxlen);
+  if (p->ring == NULL) return luaL_error( L, "memory not enough" );
+  p->depth = depth;
+  p->head = 0;
+  p->tail = 0;
+  p->dropped = 0;
+  p->errors = 0;
+  i2c_prog_due[n - 1] = false;
+  p->running = true;
+  mico_init_timer(&p->timer, interval, _i2c_prog_timer, (void*)(n - 1));
+  mico_start_timer(&p->timer);
+  return 0;
+}
+
+//i2c.drain(prog[, max]): returns data, nsamples, dropped, errors
+//data holds nsamples samples of the program read size
+//==================================
+static int i2c_drain( lua_State* L )
+{
+  luaL_Buffer b;
+  uint16_t head, tail, cnt, chunk;
+
+  i2c_prog_t* p = _i2c_check_prog( L, 1 );
+  unsigned max = luaL_optinteger( L, 2, 0xFFFF );
+
+  if (p->ring == NULL) {
+    lua_pushstring( L, "" );
+    lua_pushinteger( L, 0 );
+    lua_pushinteger( L, p->dropped );
+    lua_pushinteger( L, p->errors );
+    return 4;
+  }
+
+  head = p->head;
+  tail = p->tail;
+  cnt = (head + p->depth + 1 - tail) % (p->depth + 1);
+  if (cnt > max) cnt = max;
+
+  luaL_buffinit( L, &b );
+  // at most two contiguous pieces
+  chunk = (p->depth + 1) - tail;
+  if (chunk > cnt) chunk = cnt;
+  luaL_addlstring( &b, (const char*)&p->ring[tail * p->rxlen], chunk * p->rxlen );
+  if (cnt > chunk) luaL_addlstring( &b, (const char*)&p->ring[0], (cnt - chunk) * p->rxlen );
+  p->tail = (tail + cnt) % (p->depth + 1);
+  luaL_pushresult( &b );
+
+  lua_pushinteger( L, cnt );
+  lua_pushinteger( L, p->dropped );
+  lua_pushinteger( L, p->errors );
+  return 4;
+}
+
+//i2c.stop(prog)
+//=================================
+static int i2c_stop( lua_State* L )
+{
+  i2c_prog_t* p = _i2c_check_prog( L, 1 );
+  _i2c_prog_stop(p);
+  return 0;
+}
+
+//i2c.free(prog)
+//=================================
+static int i2c_free( lua_State* L )
+{
+  _i2c_check_prog( L, 1 );
+  _i2c_prog_free(luaL_checkinteger( L, 1 ) - 1);
+  return 0;
+}
+
+
 //i2c.setup(0, pinSDA, pinSCL)
 //i2c.setup(1, adr_len, mode)
 //==================================
@@ -257,6 +715,8 @@ static int i2c_setup( lua_State* L )
 
   unsigned sda = luaL_checkinteger( L, 2 );
   unsigned scl = luaL_checkinteger( L, 3 );
+
+  if (i2c_mutex == NULL) mico_rtos_init_mutex(&i2c_mutex);
   
   if (id == 0) {
     MOD_CHECK_ID( gpio, sda );
@@ -302,6 +762,9 @@ static int i2c_deinit( lua_State* L )
   unsigned id =  luaL_checkinteger( L, 1 );
   if ((id != 0) && (id != 1)) return luaL_error( L, "id should be assigend 0 or 1" );
 
+  for (int i = 0; i < I2C_MAX_PROG; i++) {
+    if ((i2c_prog[i] != NULL) && (i2c_prog[i]->id == id)) _i2c_prog_stop(i2c_prog[i]);
+  }
   
   if (id == 0) {
     if (IIC_Init) {
@@ -426,12 +889,14 @@ static int i2c_read( lua_State* L )
       return luaL_error( L, "dev_id is wrong" );
     }
 
+    _i2c_lock();
     // Send start condition
     IIC_Start();
     // Send address
     int res = IIC_Send_Byte((dev_id << 1) | 1);
     if (res != 0) {
       IIC_Stop();
+      _i2c_unlock();
       lua_pushinteger(L, -1);
       lua_pushinteger(L, res);
       goto exit;
@@ -446,6 +911,7 @@ static int i2c_read( lua_State* L )
 
     // Send stop condition
     IIC_Stop();
+    _i2c_unlock();
   }
   else { // === hardware i2c ===
     if (!hw_IIC_Init) return luaL_error( L, "hardware i2c not initialized" );
@@ -458,8 +924,6 @@ static int i2c_read( lua_State* L )
     }
     if (dev_id == 0) return luaL_error( L, "dev_id is wrong" );
 
-    hw_i2c.address = dev_id;
-
     OSStatus err = kNoErr;
     mico_i2c_message_t i2c_msg = {NULL, NULL, 0, 0, 10, false};
 
@@ -469,7 +933,10 @@ static int i2c_read( lua_State* L )
       lua_pushinteger( L, err );
       goto exit;
     }
+    _i2c_lock();
+    hw_i2c.address = dev_id;
     err = MicoI2cTransfer(&hw_i2c, &i2c_msg, 1, 1);
+    _i2c_unlock();
     if (err != kNoErr) {
       lua_pushinteger( L, -2 );
       lua_pushinteger( L, err );
@@ -505,6 +972,12 @@ const LUA_REG_TYPE i2c_map[] =
   { LSTRKEY( "deinit" ), LFUNCVAL( i2c_deinit )},
   { LSTRKEY( "write" ),  LFUNCVAL( i2c_write )},
   { LSTRKEY( "read" ),   LFUNCVAL( i2c_read )},
+  { LSTRKEY( "compile" ), LFUNCVAL( i2c_compile )},
+  { LSTRKEY( "run" ),    LFUNCVAL( i2c_run )},
+  { LSTRKEY( "start" ),  LFUNCVAL( i2c_start )},
+  { LSTRKEY( "drain" ),  LFUNCVAL( i2c_drain )},
+  { LSTRKEY( "stop" ),   LFUNCVAL( i2c_stop )},
+  { LSTRKEY( "free" ),   LFUNCVAL( i2c_free )},
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif          
   {LNILKEY, LNILVAL}
@@ -512,6 +985,7 @@ const LUA_REG_TYPE i2c_map[] =
 
 LUALIB_API int luaopen_i2c(lua_State *L)
 {
+  if (i2c_mutex == NULL) mico_rtos_init_mutex(&i2c_mutex);
 #if LUA_OPTIMIZE_MEMORY > 0
     return 0;
 #else  
@@ -519,3 +993,9 @@ LUALIB_API int luaopen_i2c(lua_State *L)
   return 1;
 #endif
 }
+
+LUALIB_API int luaclose_i2c(lua_State *L)
+{
+  for (int i = 0; i < I2C_MAX_PROG; i++) _i2c_prog_free(i);
+  return 0;
+}
@@ -0,0 +1,849 @@
+/**
+ * json.c
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
+#include "lrotable.h"
+
+#include "user_config.h"
+
+#define JSON_MAX_DEPTH    32    // nesting limit of encoder and decoder
+#define JSON_TOKEN_MAX    256   // a longer token is carried from one feed to the next as string pieces
+#define JSON_NUMBER_MAX   32    // longest number literal
+
+#define JSON_PARSER_NAME  "json.parser"
+
+// events passed to the json.parser() callback
+#define JSON_EV_OBJECT    1     // '{'
+#define JSON_EV_ARRAY     2     // '['
+#define JSON_EV_END       3     // '}' or ']'
+#define JSON_EV_KEY       4     // object key, the key string follows
+#define JSON_EV_VALUE     5     // string, number, boolean or json.null follows
+
+// lexer states
+#define JSON_LEX_WS       0     // between tokens
+#define JSON_LEX_STR      1     // in a string
+#define JSON_LEX_STR_ESC  2     // after a backslash in a string
+#define JSON_LEX_NUM      3     // in a number
+#define JSON_LEX_LIT      4     // in true, false or null
+
+// what the grammar accepts next
+#define JSON_EXP_VALUE          0
+#define JSON_EXP_VALUE_OR_END   1   // after '['
+#define JSON_EXP_KEY_OR_END     2   // after '{'
+#define JSON_EXP_KEY            3   // after ',' in an object
+#define JSON_EXP_COLON          4
+#define JSON_EXP_COMMA_OR_END   5
+
+// json.null, encodes as null and stands for null in decoded tables
+static int json_null( lua_State* L )
+{
+  lua_pushlightfunction(L, (void*)json_null);
+  return 1;
+}
+
+static int json_isnull( lua_State* L, int idx )
+{
+  if (lua_type(L, idx) == LUA_TLIGHTFUNCTION)
+    return lua_topointer(L, idx) == (void*)json_null;
+  return lua_tocfunction(L, idx) == json_null;
+}
+
+// == Encoder ==
+
+// The output is collected in buf. A luaL_Buffer cannot be used here, it needs
+// the top of the stack while the tables being encoded are traversed on it, so
+// full blocks go to a table of chunks at a fixed stack index instead.
+typedef struct {
+  lua_State *L;
+  int chunks;                   // stack index of the chunk table
+  int nchunks;
+  int len;
+  char buf[LUAL_BUFFERSIZE];
+} json_enc_t;
+
+static void enc_flush( json_enc_t *e )
+{
+  if (e->nchunks == 0) {
+    lua_newtable(e->L);
+    lua_replace(e->L, e->chunks);
+  }
+  lua_pushlstring(e->L, e->buf, e->len);
+  lua_rawseti(e->L, e->chunks, ++e->nchunks);
+  e->len = 0;
+}
+
+static void enc_add( json_enc_t *e, const char *s, size_t len )
+{
+  size_t n;
+
+  while (len > 0) {
+    if (e->len == LUAL_BUFFERSIZE) enc_flush(e);
+    n = LUAL_BUFFERSIZE - e->len;
+    if (n > len) n = len;
+    memcpy(&e->buf[e->len], s, n);
+    e->len += n;
+    s += n;
+    len -= n;
+  }
+}
+
+static void enc_char( json_enc_t *e, char c )
+{
+  if (e->len == LUAL_BUFFERSIZE) enc_flush(e);
+  e->buf[e->len++] = c;
+}
+
+static void enc_string( json_enc_t *e, const char *s, size_t len )
+{
+  static const char hex[] = "0123456789abcdef";
+  size_t i, run = 0;
+  unsigned char c;
+
+  enc_char(e, '"');
+  for (i = 0; i < len; i++) {
+    c = (unsigned char)s[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    enc_add(e, &s[run], i - run);
+    run = i + 1;
+    enc_char(e, '\\');
+    switch (c) {
+      case '"':
+      case '\\': enc_char(e, c); break;
+      case '\b': enc_char(e, 'b'); break;
+      case '\f': enc_char(e, 'f'); break;
+      case '\n': enc_char(e, 'n'); break;
+      case '\r': enc_char(e, 'r'); break;
+      case '\t': enc_char(e, 't'); break;
+      default:
+        enc_add(e, "u00", 3);
+        enc_char(e, hex[c >> 4]);
+        enc_char(e, hex[c & 15]);
+    }
+  }
+  enc_add(e, &s[run], len - run);
+  enc_char(e, '"');
+}
+
+static void enc_number( json_enc_t *e, lua_Number n )
+{
+  char tmp[LUAI_MAXNUMBER2STR];
+  char *p = &tmp[sizeof(tmp)];
+  unsigned long u;
+
+  if (n != n || n - n != 0)
+    luaL_error(e->L, "cannot encode nan or inf");
+  // integers without sprintf, they are the common case
+  if (n > -2147483648.0 && n < 2147483648.0 && n == (lua_Number)(long)n) {
+    u = n < 0 ? -(long)n : (long)n;
+    do {
+      *--p = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    if (n < 0) *--p = '-';
+    enc_add(e, p, &tmp[sizeof(tmp)] - p);
+    return;
+  }
+  enc_add(e, tmp, lua_number2str(tmp, n));
+}
+
+static void enc_value( json_enc_t *e, int idx, int depth );
+
+static void enc_table( json_enc_t *e, int idx, int depth )
+{
+  lua_State *L = e->L;
+  size_t n = lua_objlen(L, idx), count = 0, i;
+  lua_Number k;
+  int first = 1;
+
+  if (depth >= JSON_MAX_DEPTH)
+    luaL_error(L, "nesting too deep");
+  luaL_checkstack(L, 4, "nesting too deep");
+
+  // an array if the keys are exactly 1..n
+  if (n > 0) {
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      lua_pop(L, 1);
+      k = lua_tonumber(L, -1);
+      if (lua_type(L, -1) != LUA_TNUMBER || k < 1 || k > n || k != (lua_Number)(size_t)k) {
+        lua_pop(L, 1);
+        count = 0;
+        break;
+      }
+      count++;
+    }
+  }
+  if (n > 0 && count == n) {
+    enc_char(e, '[');
+    for (i = 1; i <= n; i++) {
+      if (i > 1) enc_char(e, ',');
+      lua_rawgeti(L, idx, i);
+      enc_value(e, lua_gettop(L), depth + 1);
+      lua_pop(L, 1);
+    }
+    enc_char(e, ']');
+    return;
+  }
+
+  enc_char(e, '{');
+  lua_pushnil(L);
+  while (lua_next(L, idx)) {
+    if (!first) enc_char(e, ',');
+    first = 0;
+    if (lua_type(L, -2) == LUA_TSTRING) {
+      size_t len;
+      const char *s = lua_tolstring(L, -2, &len);
+      enc_string(e, s, len);
+    } else if (lua_type(L, -2) == LUA_TNUMBER) {
+      // not lua_tostring, that would change the key under lua_next
+      enc_char(e, '"');
+      enc_number(e, lua_tonumber(L, -2));
+      enc_char(e, '"');
+    } else
+      luaL_error(L, "cannot encode %s key", luaL_typename(L, -2));
+    enc_char(e, ':');
+    enc_value(e, lua_gettop(L), depth + 1);
+    lua_pop(L, 1);
+  }
+  enc_char(e, '}');
+}
+
+static void enc_value( json_enc_t *e, int idx, int depth )
+{
+  lua_State *L = e->L;
+
+  switch (lua_type(L, idx)) {
+    case LUA_TNIL:
+      enc_add(e, "null", 4);
+      break;
+    case LUA_TBOOLEAN:
+      if (lua_toboolean(L, idx)) enc_add(e, "true", 4);
+      else enc_add(e, "false", 5);
+      break;
+    case LUA_TNUMBER:
+      enc_number(e, lua_tonumber(L, idx));
+      break;
+    case LUA_TSTRING: {
+      size_t len;
+      const char *s = lua_tolstring(L, idx, &len);
+      enc_string(e, s, len);
+      break;
+    }
+    case LUA_TTABLE:
+      enc_table(e, idx, depth);
+      break;
+    default:
+      if (json_isnull(L, idx)) {
+        enc_add(e, "null", 4);
+        break;
+      }
+      luaL_error(L, "cannot encode %s", luaL_typename(L, idx));
+  }
+}
+
+//s = json.encode(value)
+static int json_encode( lua_State* L )
+{
+  json_enc_t e;
+  luaL_Buffer b;
+  int i;
+
+  luaL_checkany(L, 1);
+  lua_settop(L, 1);
+  lua_pushnil(L);   // chunk table, created by the first flush
+  e.L = L;
+  e.chunks = 2;
+  e.nchunks = 0;
+  e.len = 0;
+  enc_value(&e, 1, 0);
+
+  if (e.nchunks == 0) {
+    lua_pushlstring(L, e.buf, e.len);
+    return 1;
+  }
+  enc_flush(&e);
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= e.nchunks; i++) {
+    lua_rawgeti(L, 2, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
+// == Decoder ==
+
+// json.decode() and json.parser() share this incremental parser. decode
+// builds the tables on the stack, a stream parser passes events to its
+// callback instead and keeps nothing but the token it is in.
+typedef struct {
+  lua_State *L;
+  int cb_ref;                   // stream callback, LUA_NOREF for json.decode
+  unsigned pos;                 // bytes fed so far, for error messages
+  unsigned char lex;
+  unsigned char expect;
+  unsigned char esc;            // the current string has escapes
+  unsigned char key;            // the current string is an object key
+  unsigned char done;           // a complete top level value was parsed
+  unsigned char depth;
+  unsigned char is_obj[JSON_MAX_DEPTH];
+  int count[JSON_MAX_DEPTH];    // array length per level, json.decode only
+  int toklen;                   // carried length of the current token
+  int spill_ref;                // table of its pieces once it outgrew tok
+  int spill_n;
+  char tok[JSON_TOKEN_MAX];
+} json_parser_t;
+
+static void dec_spill_free( json_parser_t *p )
+{
+  if (p->spill_ref != LUA_NOREF) {
+    luaL_unref(p->L, LUA_REGISTRYINDEX, p->spill_ref);
+    p->spill_ref = LUA_NOREF;
+  }
+}
+
+static void dec_reset( json_parser_t *p )
+{
+  p->pos = 0;
+  p->lex = JSON_LEX_WS;
+  p->expect = JSON_EXP_VALUE;
+  p->done = 0;
+  p->depth = 0;
+  p->toklen = 0;
+  dec_spill_free(p);
+}
+
+static void dec_error( json_parser_t *p, const char *msg )
+{
+  unsigned pos = p->pos;
+
+  dec_reset(p);
+  luaL_error(p->L, "json: %s at byte %d", msg, pos);
+}
+
+// keep the unfinished part of a token for the next feed, a string that
+// does not fit in tok goes on in a registry table of string pieces
+static void dec_carry( json_parser_t *p, const char *s, size_t len )
+{
+  lua_State *L = p->L;
+
+  if (p->toklen == 0)
+    dec_spill_free(p);  // the pieces of the token before
+  if (p->spill_ref == LUA_NOREF && p->toklen + len <= JSON_TOKEN_MAX) {
+    memcpy(&p->tok[p->toklen], s, len);
+    p->toklen += len;
+    return;
+  }
+  if (p->spill_ref == LUA_NOREF) {
+    lua_createtable(L, 4, 0);
+    lua_pushlstring(L, p->tok, p->toklen);
+    lua_rawseti(L, -2, 1);
+    p->spill_n = 1;
+    p->spill_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, p->spill_ref);
+  lua_pushlstring(L, s, len);
+  lua_rawseti(L, -2, ++p->spill_n);
+  lua_pop(L, 1);
+  p->toklen += len;
+}
+
+// the whole token text, a carried part followed by s
+static const char *dec_text( json_parser_t *p, const char *s, size_t *len )
+{
+  lua_State *L = p->L;
+  const char *text;
+  luaL_Buffer b;
+  int i, t;
+
+  if (p->toklen == 0)
+    return s;
+  dec_carry(p, s, *len);
+  *len = p->toklen;
+  p->toklen = 0;
+  if (p->spill_ref == LUA_NOREF)
+    return p->tok;
+  // join the pieces, the table keeps the result until the next token
+  lua_rawgeti(L, LUA_REGISTRYINDEX, p->spill_ref);
+  t = lua_gettop(L);
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= p->spill_n; i++) {
+    lua_rawgeti(L, t, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  text = lua_tostring(L, -1);
+  lua_rawseti(L, t, 1);
+  for (i = 2; i <= p->spill_n; i++) {
+    lua_pushnil(L);
+    lua_rawseti(L, t, i);
+  }
+  p->spill_n = 1;
+  lua_settop(L, t - 1);
+  return text;
+}
+
+// hand a value or key on the top of the stack to the callback
+static void dec_emit( json_parser_t *p, int ev, int nval )
+{
+  lua_State *L = p->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, p->cb_ref);
+  lua_insert(L, -1 - nval);
+  lua_pushinteger(L, ev);
+  lua_insert(L, -1 - nval);
+  lua_call(L, 1 + nval, 0);
+}
+
+static void dec_begin_value( json_parser_t *p )
+{
+  if (p->expect != JSON_EXP_VALUE && p->expect != JSON_EXP_VALUE_OR_END)
+    dec_error(p, "unexpected value");
+  if (p->depth == 0) {
+    if (p->done && p->cb_ref == LUA_NOREF)
+      dec_error(p, "garbage after value");
+    p->done = 0;
+  }
+}
+
+// a value is on the top of the stack, store it in its container
+static void dec_end_value( json_parser_t *p )
+{
+  lua_State *L = p->L;
+  int d = p->depth;
+
+  if (d == 0) {
+    p->done = 1;
+    p->expect = JSON_EXP_VALUE;
+    return;
+  }
+  p->expect = JSON_EXP_COMMA_OR_END;
+  if (p->cb_ref != LUA_NOREF)
+    return;
+  if (p->is_obj[d - 1])
+    lua_rawset(L, -3);
+  else
+    lua_rawseti(L, -2, ++p->count[d - 1]);
+}
+
+static void dec_scalar( json_parser_t *p )
+{
+  if (p->cb_ref != LUA_NOREF)
+    dec_emit(p, JSON_EV_VALUE, 1);
+  dec_end_value(p);
+}
+
+static void dec_open( json_parser_t *p, int is_obj )
+{
+  dec_begin_value(p);
+  if (p->depth >= JSON_MAX_DEPTH)
+    dec_error(p, "nesting too deep");
+  p->is_obj[p->depth] = is_obj;
+  p->count[p->depth] = 0;
+  p->depth++;
+  p->expect = is_obj ? JSON_EXP_KEY_OR_END : JSON_EXP_VALUE_OR_END;
+  if (p->cb_ref != LUA_NOREF)
+    dec_emit(p, is_obj ? JSON_EV_OBJECT : JSON_EV_ARRAY, 0);
+  else {
+    luaL_checkstack(p->L, 3, "nesting too deep");
+    lua_newtable(p->L);
+  }
+}
+
+static void dec_close( json_parser_t *p, int is_obj )
+{
+  if (p->depth == 0 || p->is_obj[p->depth - 1] != is_obj ||
+      (p->expect != JSON_EXP_COMMA_OR_END &&
+       p->expect != (is_obj ? JSON_EXP_KEY_OR_END : JSON_EXP_VALUE_OR_END)))
+    dec_error(p, "unexpected end");
+  p->depth--;
+  if (p->cb_ref != LUA_NOREF)
+    dec_emit(p, JSON_EV_END, 0);
+  dec_end_value(p);
+}
+
+static int dec_hex4( json_parser_t *p, const char *s, const char *end )
+{
+  int i, v = 0;
+  char c;
+
+  if (end - s < 4)
+    dec_error(p, "invalid escape");
+  for (i = 0; i < 4; i++) {
+    c = s[i];
+    v <<= 4;
+    if (c >= '0' && c <= '9') v |= c - '0';
+    else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+    else dec_error(p, "invalid escape");
+  }
+  return v;
+}
+
+static void dec_utf8( luaL_Buffer *b, unsigned long cp )
+{
+  if (cp < 0x80)
+    luaL_addchar(b, cp);
+  else if (cp < 0x800) {
+    luaL_addchar(b, 0xC0 | (cp >> 6));
+    luaL_addchar(b, 0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    luaL_addchar(b, 0xE0 | (cp >> 12));
+    luaL_addchar(b, 0x80 | ((cp >> 6) & 0x3F));
+    luaL_addchar(b, 0x80 | (cp & 0x3F));
+  } else {
+    luaL_addchar(b, 0xF0 | (cp >> 18));
+    luaL_addchar(b, 0x80 | ((cp >> 12) & 0x3F));
+    luaL_addchar(b, 0x80 | ((cp >> 6) & 0x3F));
+    luaL_addchar(b, 0x80 | (cp & 0x3F));
+  }
+}
+
+// s, len is the string between the quotes
+static void dec_string( json_parser_t *p, const char *s, size_t len )
+{
+  lua_State *L = p->L;
+  const char *end, *bs;
+  unsigned long cp, lo;
+  luaL_Buffer b;
+
+  s = dec_text(p, s, &len);
+  if (!p->esc)
+    lua_pushlstring(L, s, len);
+  else {
+    end = s + len;
+    luaL_buffinit(L, &b);
+    while (s < end) {
+      bs = memchr(s, '\\', end - s);
+      if (bs == NULL) bs = end;
+      luaL_addlstring(&b, s, bs - s);
+      if (bs == end) break;
+      // the lexer does not end a string right after a backslash
+      s = bs + 2;
+      switch (bs[1]) {
+        case '"':
+        case '\\':
+        case '/': luaL_addchar(&b, bs[1]); break;
+        case 'b': luaL_addchar(&b, '\b'); break;
+        case 'f': luaL_addchar(&b, '\f'); break;
+        case 'n': luaL_addchar(&b, '\n'); break;
+        case 'r': luaL_addchar(&b, '\r'); break;
+        case 't': luaL_addchar(&b, '\t'); break;
+        case 'u':
+          cp = dec_hex4(p, s, end);
+          s += 4;
+          if (cp >= 0xD800 && cp < 0xDC00 && end - s >= 6 && s[0] == '\\' && s[1] == 'u') {
+            lo = dec_hex4(p, s + 2, end);
+            if (lo >= 0xDC00 && lo < 0xE000) {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+              s += 6;
+            }
+          }
+          dec_utf8(&b, cp);
+          break;
+        default:
+          dec_error(p, "invalid escape");
+      }
+    }
+    luaL_pushresult(&b);
+  }
+
+  if (p->key) {
+    p->expect = JSON_EXP_COLON;
+    if (p->cb_ref != LUA_NOREF)
+      dec_emit(p, JSON_EV_KEY, 1);
+  } else
+    dec_scalar(p);
+}
+
+static void dec_number( json_parser_t *p, const char *s, size_t len )
+{
+  char num[JSON_NUMBER_MAX];
+  char *end;
+  lua_Number n;
+
+  s = dec_text(p, s, &len);
+  if (len >= JSON_NUMBER_MAX)
+    dec_error(p, "invalid number");
+  memcpy(num, s, len);
+  num[len] = 0;
+  n = (lua_Number)strtod(num, &end);
+  if (end != &num[len])
+    dec_error(p, "invalid number");
+  lua_pushnumber(p->L, n);
+  dec_scalar(p);
+}
+
+static void dec_literal( json_parser_t *p, const char *s, size_t len )
+{
+  s = dec_text(p, s, &len);
+  if (len == 4 && !memcmp(s, "true", 4))
+    lua_pushboolean(p->L, 1);
+  else if (len == 5 && !memcmp(s, "false", 5))
+    lua_pushboolean(p->L, 0);
+  else if (len == 4 && !memcmp(s, "null", 4))
+    lua_pushlightfunction(p->L, (void*)json_null);
+  else
+    dec_error(p, "invalid literal");
+  dec_scalar(p);
+}
+
+static void dec_feed( json_parser_t *p, const char *s, size_t len )
+{
+  size_t i, start = 0;
+  unsigned char c;
+
+  for (i = 0; i < len; i++, p->pos++) {
+    c = (unsigned char)s[i];
+    switch (p->lex) {
+      case JSON_LEX_STR:
+        if (c == '"') {
+          p->lex = JSON_LEX_WS;
+          dec_string(p, &s[start], i - start);
+        } else if (c == '\\') {
+          p->esc = 1;
+          p->lex = JSON_LEX_STR_ESC;
+        } else if (c < 0x20)
+          dec_error(p, "control character in string");
+        continue;
+      case JSON_LEX_STR_ESC:
+        p->lex = JSON_LEX_STR;
+        continue;
+      case JSON_LEX_NUM:
+        if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+          continue;
+        p->lex = JSON_LEX_WS;
+        dec_number(p, &s[start], i - start);
+        break;  // c is the next token
+      case JSON_LEX_LIT:
+        if (c >= 'a' && c <= 'z')
+          continue;
+        p->lex = JSON_LEX_WS;
+        dec_literal(p, &s[start], i - start);
+        break;
+    }
+
+    switch (c) {
+      case ' ': case '\t': case '\r': case '\n':
+        break;
+      case '{':
+        dec_open(p, 1);
+        break;
+      case '[':
+        dec_open(p, 0);
+        break;
+      case '}':
+        dec_close(p, 1);
+        break;
+      case ']':
+        dec_close(p, 0);
+        break;
+      case ':':
+        if (p->expect != JSON_EXP_COLON)
+          dec_error(p, "unexpected ':'");
+        p->expect = JSON_EXP_VALUE;
+        break;
+      case ',':
+        if (p->expect != JSON_EXP_COMMA_OR_END || p->depth == 0)
+          dec_error(p, "unexpected ','");
+        p->expect = p->is_obj[p->depth - 1] ? JSON_EXP_KEY : JSON_EXP_VALUE;
+        break;
+      case '"':
+        p->key = (p->expect == JSON_EXP_KEY || p->expect == JSON_EXP_KEY_OR_END);
+        if (!p->key)
+          dec_begin_value(p);
+        p->esc = 0;
+        p->lex = JSON_LEX_STR;
+        start = i + 1;
+        break;
+      default:
+        if (c == '-' || (c >= '0' && c <= '9'))
+          p->lex = JSON_LEX_NUM;
+        else if (c >= 'a' && c <= 'z')
+          p->lex = JSON_LEX_LIT;
+        else
+          dec_error(p, "unexpected character");
+        dec_begin_value(p);
+        start = i;
+    }
+  }
+  if (p->lex != JSON_LEX_WS) {
+    // numbers and literals are short, only strings may grow
+    if ((p->lex == JSON_LEX_NUM || p->lex == JSON_LEX_LIT) &&
+        p->toklen + len - start >= JSON_NUMBER_MAX)
+      dec_error(p, "invalid token");
+    dec_carry(p, &s[start], len - start);
+  }
+}
+
+// end of input, a number or literal at the top level ends here
+static void dec_finish( json_parser_t *p )
+{
+  if (p->lex == JSON_LEX_NUM) {
+    p->lex = JSON_LEX_WS;
+    dec_number(p, "", 0);
+  } else if (p->lex == JSON_LEX_LIT) {
+    p->lex = JSON_LEX_WS;
+    dec_literal(p, "", 0);
+  }
+}
+
+//value = json.decode(s)
+static int json_decode( lua_State* L )
+{
+  json_parser_t p;
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+
+  p.L = L;
+  p.cb_ref = LUA_NOREF;
+  p.spill_ref = LUA_NOREF;
+  dec_reset(&p);
+  lua_settop(L, 1);
+  dec_feed(&p, s, len);
+  dec_finish(&p);
+  if (!p.done || p.depth || p.lex != JSON_LEX_WS)
+    dec_error(&p, "unexpected end of input");
+  dec_spill_free(&p);
+  return 1;
+}
+
+// == Stream parser ==
+
+static json_parser_t* json_check_parser( lua_State* L )
+{
+  return (json_parser_t*)luaL_checkudata(L, 1, JSON_PARSER_NAME);
+}
+
+//p = json.parser(function(event, value))
+//event is json.OBJECT, json.ARRAY, json.END, json.KEY or json.VALUE
+static int json_parser( lua_State* L )
+{
+  json_parser_t *p;
+
+  if (lua_type(L, 1) != LUA_TFUNCTION && lua_type(L, 1) != LUA_TLIGHTFUNCTION)
+    return luaL_error( L, "callback function needed" );
+  p = (json_parser_t*)lua_newuserdata(L, sizeof(json_parser_t));
+  p->L = L;
+  p->cb_ref = LUA_NOREF;
+  p->spill_ref = LUA_NOREF;
+  dec_reset(p);
+  luaL_getmetatable(L, JSON_PARSER_NAME);
+  lua_setmetatable(L, -2);
+  lua_pushvalue(L, 1);
+  p->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+//p:feed(s), s can end anywhere, the next feed continues the document
+static int json_parser_feed( lua_State* L )
+{
+  json_parser_t *p = json_check_parser(L);
+  size_t len;
+  const char *s = luaL_checklstring(L, 2, &len);
+
+  p->L = L;
+  dec_feed(p, s, len);
+  return 0;
+}
+
+//complete = p:finish(), true if the input ended between two documents
+static int json_parser_finish( lua_State* L )
+{
+  json_parser_t *p = json_check_parser(L);
+  int complete;
+
+  p->L = L;
+  dec_finish(p);
+  complete = p->depth == 0 && p->lex == JSON_LEX_WS;
+  dec_reset(p);
+  lua_pushboolean(L, complete);
+  return 1;
+}
+
+//p:reset(), drop a partial document, e.g. after an error
+static int json_parser_reset( lua_State* L )
+{
+  json_parser_t *p = json_check_parser(L);
+
+  p->L = L;
+  dec_reset(p);
+  return 0;
+}
+
+static int json_parser_gc( lua_State* L )
+{
+  json_parser_t *p = json_check_parser(L);
+
+  p->L = L;
+  dec_spill_free(p);
+  if (p->cb_ref != LUA_NOREF) {
+    luaL_unref(L, LUA_REGISTRYINDEX, p->cb_ref);
+    p->cb_ref = LUA_NOREF;
+  }
+  return 0;
+}
+
+#define MIN_OPT_LEVEL       1
+#include "lrodefs.h"
+const LUA_REG_TYPE json_parser_map[] =
+{
+  { LSTRKEY( "feed" ), LFUNCVAL( json_parser_feed ) },
+  { LSTRKEY( "finish" ), LFUNCVAL( json_parser_finish ) },
+  { LSTRKEY( "reset" ), LFUNCVAL( json_parser_reset ) },
+  {LNILKEY, LNILVAL}
+};
+
+#undef MIN_OPT_LEVEL
+#define MIN_OPT_LEVEL       2
+#include "lrodefs.h"
+const LUA_REG_TYPE json_map[] =
+{
+  { LSTRKEY( "encode" ), LFUNCVAL( json_encode ) },
+  { LSTRKEY( "decode" ), LFUNCVAL( json_decode ) },
+  { LSTRKEY( "parser" ), LFUNCVAL( json_parser ) },
+#if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "null" ), LFUNCVAL( json_null ) },
+  { LSTRKEY( "OBJECT" ), LNUMVAL( JSON_EV_OBJECT ) },
+  { LSTRKEY( "ARRAY" ), LNUMVAL( JSON_EV_ARRAY ) },
+  { LSTRKEY( "END" ), LNUMVAL( JSON_EV_END ) },
+  { LSTRKEY( "KEY" ), LNUMVAL( JSON_EV_KEY ) },
+  { LSTRKEY( "VALUE" ), LNUMVAL( JSON_EV_VALUE ) },
+#endif
+  {LNILKEY, LNILVAL}
+};
+
+LUALIB_API int luaopen_json(lua_State *L)
+{
+  // A RAM metatable, LUA_META_ROTABLES is off so a rotable cannot be one.
+  // The methods stay in the rotable behind __index.
+  luaL_newmetatable(L, JSON_PARSER_NAME);
+  lua_pushcfunction(L, json_parser_gc);
+  lua_setfield(L, -2, "__gc");
+#if LUA_OPTIMIZE_MEMORY > 0
+  lua_pushrotable(L, (void*)json_parser_map);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  return 0;
+#else
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, json_parser_map);
+  lua_pop(L, 1);
+  luaL_register( L, EXLIB_JSON, json_map );
+  lua_pushlightfunction(L, (void*)json_null);
+  lua_setfield(L, -2, "null");
+  MOD_REG_NUMBER( L, "OBJECT", JSON_EV_OBJECT );
+  MOD_REG_NUMBER( L, "ARRAY", JSON_EV_ARRAY );
+  MOD_REG_NUMBER( L, "END", JSON_EV_END );
+  MOD_REG_NUMBER( L, "KEY", JSON_EV_KEY );
+  MOD_REG_NUMBER( L, "VALUE", JSON_EV_VALUE );
+  return 1;
+#endif
+}
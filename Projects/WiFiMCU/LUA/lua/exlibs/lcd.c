@@ -15,6 +15,7 @@
 #include "user_config.h"
 #include "MICO.h"
 #include "StringUtils.h"
+#include "spi.h"
 
 #include <spiffs.h>
 #include <spiffs_nucleus.h>
@@ -186,8 +187,6 @@
    
 extern const char wifimcu_gpio_map[];
 extern uint8_t spiInit[];
-extern void _MicoLcdTransfer( uint8_t* buf, int len );
-extern void _swLcdTransfer( uint8_t* buf, int len );
 
 extern uint8_t SmallFont[];         
 extern uint8_t Font8x8[];
@@ -263,6 +262,7 @@ static dispWin_t dispWin = {
 
 static Font cfont;
 static propFont fontChar;
+static uint16_t *glyphIndex = NULL;    // glyph offsets of the proportional font
 static uint8_t _transparent = 0;
 static uint8_t _wrap = 0; // carracter wrapping to new line
 static uint8_t _forceFixed = 0;
@@ -347,6 +347,19 @@ static void _LcdSpiTransfer( uint8_t* buf, int len ) {
   else _swLcdTransfer( buf, len );
 }
 
+// hardware SPI returns while the last data block is still sent by DMA,
+// buf must not be changed before the next transfer or _LcdSpiWait()
+//---------------------------------------------------------
+static void _LcdSpiTransferAsync( uint8_t* buf, int len ) {
+  if (TFT_SPI_ID == 2) _MicoLcdTransferAsync( buf, len );
+  else _swLcdTransfer( buf, len );
+}
+
+//-----------------------------
+static void _LcdSpiWait( void ) {
+  if (TFT_SPI_ID == 2) _MicoLcdWait();
+}
+
 //---------------------------
 static void initccbuf(void) {
   ccbufPtr = 0;
@@ -1102,6 +1115,30 @@ static uint8_t getMaxWidth(void) {
   return w;
 }
 
+// char code -> offset of the glyph header in the proportional font,
+// 0 if the char is not in the font; avoids the linear search per char
+//-----------------------------------
+static void _buildGlyphIndex(void) {
+  uint16_t tempPtr = 4; // point at first char data
+  uint8_t cc,cw,ch;
+
+  if (glyphIndex == NULL) glyphIndex = (uint16_t*)malloc(256*sizeof(uint16_t));
+  if (glyphIndex == NULL) return;
+  memset(glyphIndex, 0, 256*sizeof(uint16_t));
+  do
+  {
+    cc = cfont.font[tempPtr];
+    cw = cfont.font[tempPtr+2];
+    ch = cfont.font[tempPtr+3];
+    if (cc != 0xFF) {
+      if (glyphIndex[cc] == 0) glyphIndex[cc] = tempPtr;
+      tempPtr += 6;
+      // packed bits
+      if (cw != 0) tempPtr += (((cw * ch)-1) / 8) + 1;
+    }
+  } while (cc != 0xFF);
+}
+
 //-------------------------------------
 static void TFT_setFont(uint8_t font) {
   if (font == DEJAVU_12) cfont.font=&DejaVuSans12[0];
@@ -1126,7 +1163,15 @@ static void TFT_setFont(uint8_t font) {
     cfont.y_size = cfont.font[1];
     cfont.offset = cfont.font[2];
     if (cfont.x_size != 0) cfont.numchars = cfont.font[3];
-    else cfont.numchars = getMaxWidth();
+    else {
+      cfont.numchars = getMaxWidth();
+      _buildGlyphIndex();
+      return;
+    }
+  }
+  if (glyphIndex != NULL) {
+    free(glyphIndex);
+    glyphIndex = NULL;
   }
 }
 
@@ -1135,6 +1180,13 @@ static void TFT_setFont(uint8_t font) {
 static bool getCharPtr(uint8_t c) {
   uint16_t tempPtr = 4; // point at first char data
   
+  if (glyphIndex != NULL) {
+    if ((c == 0xFF) || (glyphIndex[c] == 0)) {
+      fontChar.charCode = 0xFF;
+      return false;
+    }
+    tempPtr = glyphIndex[c];
+  }
   do {
     fontChar.charCode = cfont.font[tempPtr++];
     fontChar.adjYOffset = cfont.font[tempPtr++];
@@ -1326,10 +1378,184 @@ static int getStringWidth(char* str) {
   }
 }
 
+// === Fast text path ===
+// A text line is rasterized into a 1 bit per pixel band in RAM and sent
+// as one memory write: a single address window, then RGB565 rows expanded
+// from the band into two line buffers which are sent alternately by DMA.
+// Rotations by 90, 180 and 270 degrees only change how the band is read.
+
+#define TXT_BLOCK_SIZE  512     // max pixel bytes in one data block
+
+typedef struct {
+  uint8_t *bits;
+  int     w;
+  int     h;
+  int     stride;   // bytes per band row
+} txtBand_t;
+
+// copy one character to the band at column x, returns the advance
+//--------------------------------------------------------------
+static int _txtBandChar( txtBand_t *band, uint8_t c, int x ) {
+  uint16_t ptr;
+  int w, h, xo, yo, rowbits, adv;
+  int i, j, bx, by, bit;
+
+  if (cfont.x_size == 0) {
+    if (!getCharPtr(c)) return 0;
+    ptr = fontChar.dataPtr;
+    w = fontChar.width;
+    h = fontChar.height;
+    xo = fontChar.xOffset;
+    yo = fontChar.adjYOffset;
+    rowbits = w;
+    adv = fontChar.xDelta+1;
+  }
+  else {
+    if ((c < cfont.offset) || ((c-cfont.offset) > cfont.numchars)) c = cfont.offset;
+    rowbits = ((cfont.x_size+7)/8)*8;
+    ptr = ((c-cfont.offset)*((rowbits/8)*cfont.y_size))+4;
+    w = cfont.x_size;
+    h = cfont.y_size;
+    xo = 0;
+    yo = 0;
+    adv = cfont.x_size;
+  }
+
+  if (band != NULL) {
+    for (j=0; j<h; j++) {
+      by = j + yo;
+      if ((by < 0) || (by >= band->h)) continue;
+      for (i=0; i<w; i++) {
+        bx = x + xo + i;
+        if ((bx < 0) || (bx >= band->w)) continue;
+        bit = (j*rowbits) + i;
+        if (cfont.font[ptr + (bit >> 3)] & (0x80 >> (bit & 7))) {
+          band->bits[(by*band->stride) + (bx >> 3)] |= (0x80 >> (bx & 7));
+        }
+      }
+    }
+  }
+  return adv;
+}
+
+// print n characters at x,y, rotated by rot (0, 90, 180 or 270),
+// background is always filled; returns -1 if it can't be done this way
+//-------------------------------------------------------------------
+static int _TFT_printBand( char *st, int n, int x, int y, int rot, int *width ) {
+  txtBand_t band;
+  uint8_t *buf[2];
+  uint8_t cur = 0;
+  int i, bx, ww, wh, wx, wy, u, v, rows, r, len;
+  uint16_t color;
+  uint8_t *p;
+
+  // band size
+  band.w = 0;
+  band.h = cfont.y_size;
+  for (i=0; i<n; i++) {
+    if ((st[i] != 0x0D) && (st[i] != 0x0A)) band.w += _txtBandChar(NULL, (uint8_t)st[i], 0);
+  }
+  *width = band.w;
+  if (band.w == 0) return 0;
+
+  // screen window
+  if ((rot == 0) || (rot == 180)) {
+    ww = band.w;
+    wh = band.h;
+  }
+  else {
+    ww = band.h;
+    wh = band.w;
+  }
+  if (rot == 0) { wx = x; wy = y; }
+  else if (rot == 90) { wx = x-ww+1; wy = y; }
+  else if (rot == 180) { wx = x-ww+1; wy = y-wh+1; }
+  else { wx = x; wy = y-wh+1; }
+  if ((wx < 0) || (wy < 0) || ((wx+ww) > _width) || ((wy+wh) > _height)) return -1;
+
+  band.stride = (band.w+7)/8;
+  band.bits = (uint8_t*)malloc(band.stride*band.h);
+  if (band.bits == NULL) return -1;
+  memset(band.bits, 0, band.stride*band.h);
+  len = 8 + ((2*ww > TXT_BLOCK_SIZE) ? 2*ww : TXT_BLOCK_SIZE);
+  buf[0] = (uint8_t*)malloc(2*len);
+  if (buf[0] == NULL) {
+    free(band.bits);
+    return -1;
+  }
+  buf[1] = buf[0] + len;
+
+  bx = 0;
+  for (i=0; i<n; i++) {
+    if ((st[i] != 0x0D) && (st[i] != 0x0A)) bx += _txtBandChar(&band, (uint8_t)st[i], bx);
+  }
+
+  initccbuf();
+  _TFT_pushAddrWindow(wx, wy, wx+ww-1, wy+wh-1);
+  TFT_sendCmd(TFT_RAMWR, 0);
+  ccbufSend();
+
+  rows = TXT_BLOCK_SIZE / (2*ww);
+  if (rows == 0) rows = 1;
+  for (v=0; v<wh; v+=rows) {
+    if ((v+rows) > wh) rows = wh-v;
+    p = buf[cur];
+    *p++ = LCD_CMD_DATA;
+    *p++ = (uint8_t)((2*ww*rows) >> 8);
+    *p++ = (uint8_t)(2*ww*rows);
+    *p++ = 0; *p++ = 0; *p++ = 0; *p++ = 1;   // repeat
+    for (r=v; r<(v+rows); r++) {
+      for (u=0; u<ww; u++) {
+        // screen pixel -> band pixel
+        if (rot == 0) { bx = u; i = r; }
+        else if (rot == 90) { bx = r; i = ww-1-u; }
+        else if (rot == 180) { bx = ww-1-u; i = wh-1-r; }
+        else { bx = wh-1-r; i = u; }
+        if (band.bits[(i*band.stride) + (bx >> 3)] & (0x80 >> (bx & 7))) color = _fg;
+        else color = _bg;
+        *p++ = (uint8_t)(color >> 8);
+        *p++ = (uint8_t)color;
+      }
+    }
+    *p = 0;
+    _LcdSpiTransferAsync( buf[cur], p - buf[cur] );
+    cur ^= 1;
+  }
+  _LcdSpiWait();
+
+  free(buf[0]);
+  free(band.bits);
+  return 0;
+}
+
+// print n characters in one line at x,y, no rotation
+//-------------------------------------------------------
+static void TFT_printLine(char *st, int n, int x, int y) {
+  int i, w;
+
+  if (_TFT_printBand(st, n, x, y, 0, &w) == 0) return;
+
+  // character by character
+  for (i=0; i<n; i++) {
+    if (cfont.x_size == 0) {
+      if (getCharPtr((uint8_t)st[i])) x += printProportionalChar(x, y)+1;
+    }
+    else {
+      uint8_t ch = (uint8_t)st[i];
+      if ((ch < cfont.offset) || ((ch-cfont.offset) > cfont.numchars)) ch = cfont.offset;
+      printChar(ch, x, y);
+      x += cfont.x_size;
+    }
+  }
+}
+
 //---------------------------------------------
 static void TFT_print(char *st, int x, int y) {
   int stl, i, tmpw, tmph;
   uint8_t ch;
+  char *seg = NULL; // start of the line not yet printed by the fast path
+  int segX = 0;
+  int segY = 0;
   
   if (cfont.bitmap == 0) return; // wrong font selected
   
@@ -1337,6 +1563,28 @@ static void TFT_print(char *st, int x, int y) {
   if ((rotation != 0) && (x < -2)) return;
   
   stl = strlen(st); // number of characters in string to print
+
+  // bitmap fonts with background are printed line by line
+  int fast = ((cfont.bitmap == 1) && (!_transparent));
+  if ((fast) && ((rotation == 90) || (rotation == 180) || (rotation == 270))) {
+    int bx = x, by = y;
+    if (cfont.x_size == 0) {
+      // continue after the last rotated string
+      if (rotation == 90) by += TFT_OFFSET;
+      else if (rotation == 180) bx -= TFT_OFFSET;
+      else by -= TFT_OFFSET;
+    }
+    if (_TFT_printBand(st, stl, bx, by, rotation, &tmpw) == 0) {
+      if (cfont.x_size == 0) TFT_OFFSET += tmpw;
+      else {
+        double radian = rotation*0.0175;
+        TFT_X = (int)(x + (tmpw * cos(radian)));
+        TFT_Y = (int)(y + (tmpw * sin(radian)));
+      }
+      return;
+    }
+  }
+  if (rotation != 0) fast = 0;
   
   // set CENTER or RIGHT possition
   tmpw = getStringWidth(st);
@@ -1366,8 +1614,15 @@ static void TFT_print(char *st, int x, int y) {
     if (cfont.x_size == 0) {
       // for proportional font get char width
       if (getCharPtr(ch)) tmpw = fontChar.xDelta;
+      else if ((fast) && (ch != 0x0D) && (ch != 0x0A)) continue; // not in font
     }
     
+    if ((seg != NULL) && ((ch == 0x0D) || (ch == 0x0A) || ((TFT_X+tmpw) > (dispWin.x2+1)))) {
+      // line is complete
+      TFT_printLine(seg, (st-1) - seg, segX, segY);
+      seg = NULL;
+    }
+
     if (ch == 0x0D) { // === '\r', erase to eol ====
       if ((!_transparent) && (rotation==0)) TFT_fillRect(TFT_X, TFT_Y,  dispWin.x2+1-TFT_X, tmph, _bg);
     }
@@ -1390,7 +1645,17 @@ static void TFT_print(char *st, int x, int y) {
       }
       
       // Let's print the character
-      if (cfont.x_size == 0) {
+      if (fast) {
+        // only collect it, printed with the whole line
+        if (seg == NULL) {
+          seg = st-1;
+          segX = TFT_X;
+          segY = TFT_Y;
+        }
+        if (cfont.x_size == 0) TFT_X += tmpw+1;
+        else TFT_X += tmpw;
+      }
+      else if (cfont.x_size == 0) {
         // == proportional font
         if (rotation==0) {
           TFT_X += printProportionalChar(TFT_X, TFT_Y)+1;
@@ -1417,6 +1682,7 @@ static void TFT_print(char *st, int x, int y) {
       }
     }
   }
+  if (seg != NULL) TFT_printLine(seg, st - seg, segX, segY);
 }
 
 /********************************************************************
@@ -2067,13 +2333,124 @@ static void TFT_drawBitmapRotate(int x, int y, int sx, int sy, bitmapdatatype da
 }
 */
 
+//------------------------------------------------------------------------
+// Compressed image files
+//  0  'R','L','E'
+//  3  format: IMG_RLE_RGB565 or IMG_RLE_PALETTE
+//  4  width, height (uint16, little endian)
+//  8  IMG_RLE_PALETTE only: ncolors (0 = 256), ncolors RGB565 colors
+//     (big endian, LCD byte order)
+//  then packets until width*height pixels are decoded:
+//     c >= 0x80: run, (c & 0x7F)+1 pixels of the one pixel value that follows
+//     c <  0x80: literal, c+1 pixel values follow
+//  pixel value: RGB565 big endian, or 1 byte palette index
+// Demos/lcd/img2rle.py converts raw .img files.
+//------------------------------------------------------------------------
+#define IMG_HEADER_SIZE   8
+#define IMG_RLE_RGB565    1
+#define IMG_RLE_PALETTE   2
+#define IMG_INBUF_SIZE    256
+#define IMG_MAX_LITERAL   64   // pixels per literal block in ccbuf
+#define IMG_MIN_RUN       4    // shorter runs are sent as literal pixels
+
+typedef struct {
+  spiffs_file fd;
+  uint8_t  format;
+  uint16_t pos;
+  uint16_t len;
+  uint8_t  buf[IMG_INBUF_SIZE];
+  uint16_t palette[256];
+} img_decoder_t;
+
+//----------------------------------------
+static int imgGetByte( img_decoder_t* d ) {
+  int n;
+  if (d->pos >= d->len) {
+    n = SPIFFS_read(&fs, d->fd, d->buf, IMG_INBUF_SIZE);
+    if (n <= 0) return -1;
+    d->len = n;
+    d->pos = 0;
+  }
+  return d->buf[d->pos++];
+}
+
+//------------------------------------------
+static int imgGetPixel( img_decoder_t* d ) {
+  int hi, lo;
+  hi = imgGetByte(d);
+  if (hi < 0) return -1;
+  if (d->format == IMG_RLE_PALETTE) return d->palette[hi];
+  lo = imgGetByte(d);
+  if (lo < 0) return -1;
+  return (hi << 8) | lo;
+}
+
+// decode packets directly into ccbuf blocks of one memory write
+//---------------------------------------------------------------------------
+static void _lcd_image_rle( img_decoder_t* d, int x, int y, int w, int h ) {
+  uint32_t left = (uint32_t)w * h;
+  uint32_t n, i;
+  uint16_t litPtr = 0;
+  uint16_t litCount = 0;
+  int c, color;
+
+  initccbuf();
+  _TFT_pushAddrWindow(x, y, x+w-1, y+h-1);
+  TFT_sendCmd(TFT_RAMWR, 0);
+
+  while (left > 0) {
+    c = imgGetByte(d);
+    if (c < 0) break;
+    n = (c & 0x7F) + 1;
+    if (n > left) n = left;
+
+    if ((c & 0x80) && (n >= IMG_MIN_RUN)) {
+      color = imgGetPixel(d);
+      if (color < 0) break;
+      litCount = 0;  // close the literal block
+      ccbufFlash(11);
+      ccbufPushByte(LCD_CMD_DATA);
+      ccbufPushUint16(2);       // ndata
+      ccbufPushLong(n);         // repeat
+      ccbufPushUint16(color);
+      left -= n;
+      continue;
+    }
+
+    color = 0;
+    for (i = 0; i < n; i++) {
+      if (((c & 0x80) == 0) || (i == 0)) {
+        color = imgGetPixel(d);
+        if (color < 0) break;
+      }
+      if ((litCount == 0) || (litCount >= IMG_MAX_LITERAL)) {
+        // open a new literal block
+        ccbufFlash(8 + 2*IMG_MAX_LITERAL);
+        litPtr = ccbufPtr;
+        litCount = 0;
+        ccbufPushByte(LCD_CMD_DATA);
+        ccbufPushUint16(0);     // ndata, updated below
+        ccbufPushLong(1);       // repeat
+      }
+      ccbufPushUint16(color);
+      litCount++;
+      ccbuf[litPtr+1] = (uint8_t)((2*litCount) >> 8);
+      ccbuf[litPtr+2] = (uint8_t)(2*litCount);
+    }
+    if (i < n) break;
+    left -= n;
+  }
+  ccbufSend();
+}
+
 //==================================
 static int lcd_image( lua_State* L )
 {
   if (checkParam(5, L)) return 0;
 
   const char *fname;
-  uint8_t buf[670];
+  uint8_t* buf[2];
+  uint8_t cur = 0;
   uint32_t xrd = 0;
   size_t len,xendsize;
   
@@ -2087,19 +2464,11 @@ static int lcd_image( lua_State* L )
     l_message(NULL,"filename too long.");
     return 0;
   }
-  if ((xsize > _width) || (ysize > _height)) {
-    l_message(NULL,"image too big.");
-    return 0;
-  }
 
-  if ((x+xsize) > _width) xendsize = _width-1;
-  else xendsize = x+xsize-1;
   if(FILE_NOT_OPENED!=file_fd){
     SPIFFS_close(&fs,file_fd);
     file_fd = FILE_NOT_OPENED;
   }
-  
-  // Open the file
   file_fd = SPIFFS_open(&fs,(char*)fname,mode2flag("r"),0);
   if(file_fd < FILE_NOT_OPENED){
     file_fd = FILE_NOT_OPENED;
@@ -2107,20 +2476,78 @@ static int lcd_image( lua_State* L )
     return 0;
   }
 
+  // compressed file, size is taken from the header
+  img_decoder_t* dec = (img_decoder_t*)malloc(sizeof(img_decoder_t));
+  if (dec == NULL) {
+    l_message(NULL,"memory not enough.");
+    goto close;
+  }
+  dec->fd = (spiffs_file)file_fd;
+  dec->pos = 0;
+  dec->len = 0;
+  if ((SPIFFS_read(&fs, dec->fd, dec->buf, IMG_HEADER_SIZE) == IMG_HEADER_SIZE) &&
+      (dec->buf[0] == 'R') && (dec->buf[1] == 'L') && (dec->buf[2] == 'E')) {
+    dec->format = dec->buf[3];
+    xsize = dec->buf[4] | (dec->buf[5] << 8);
+    ysize = dec->buf[6] | (dec->buf[7] << 8);
+    if ((dec->format != IMG_RLE_RGB565) && (dec->format != IMG_RLE_PALETTE)) {
+      l_message(NULL,"unknown image format.");
+    }
+    else if ((x < 0) || (y < 0) || (xsize == 0) || (ysize == 0) ||
+             ((x+xsize) > _width) || ((y+ysize) > _height)) {
+      l_message(NULL,"image too big.");
+    }
+    else {
+      int ok = 1;
+      if (dec->format == IMG_RLE_PALETTE) {
+        int ncol = imgGetByte(dec);
+        if (ncol == 0) ncol = 256;
+        for (int i = 0; (i < ncol) && ok; i++) {
+          int hi = imgGetByte(dec);
+          int lo = imgGetByte(dec);
+          if (lo < 0) ok = 0;
+          else dec->palette[i] = (hi << 8) | lo;
+        }
+      }
+      if (ok) _lcd_image_rle(dec, x, y, xsize, ysize);
+    }
+    free(dec);
+    goto close;
+  }
+  free(dec);
+  SPIFFS_lseek(&fs, (spiffs_file)file_fd, 0, SPIFFS_SEEK_SET);
+
+  if ((xsize > _width) || (ysize > _height)) {
+    l_message(NULL,"image too big.");
+    goto close;
+  }
+
+  if ((x+xsize) > _width) xendsize = _width-1;
+  else xendsize = x+xsize-1;
+  
+  // two line buffers, one is read from file while the other is sent
+  buf[0] = (uint8_t*)malloc(2*670);
+  if (buf[0] == NULL) {
+    l_message(NULL,"memory not enough.");
+    goto close;
+  }
+  buf[1] = buf[0] + 670;
+
   do {
     // read 1 imege line from file
     initccbuf();
     _TFT_pushAddrWindow(x, y, xendsize, y);
     
-    xrd = SPIFFS_read(&fs, (spiffs_file)file_fd, &buf[ccbufPtr+7], 2*xsize);
+    xrd = SPIFFS_read(&fs, (spiffs_file)file_fd, &buf[cur][ccbufPtr+7], 2*xsize);
     if (xrd == 2*xsize) {
       ccbufPushByte(TFT_RAMWR);
       ccbufPushUint16(xrd);
       ccbufPushLong(1);
       
-      memcpy(&buf[0], &ccbuf[0], ccbufPtr);
-      buf[ccbufPtr+xrd] = 0;
-      _LcdSpiTransfer( &buf[0], ccbufPtr+xrd);
+      memcpy(&buf[cur][0], &ccbuf[0], ccbufPtr);
+      buf[cur][ccbufPtr+xrd] = 0;
+      _LcdSpiTransferAsync( &buf[cur][0], ccbufPtr+xrd);
+      cur ^= 1;
 
       y++;
       if (y < _height) ysize--;
@@ -2128,7 +2555,10 @@ static int lcd_image( lua_State* L )
     }
     else xrd = 0;
   }while ((xrd > 0) && (ysize > 0));
+  _LcdSpiWait();
+  free(buf[0]);
   
+close:
   if(FILE_NOT_OPENED!=file_fd){
     SPIFFS_close(&fs,file_fd);
     file_fd = FILE_NOT_OPENED;
@@ -374,6 +374,16 @@ static int mcu_bootreason( lua_State* L )
     return 1;
 }
 
+//mcu.unload("module")
+//releases a built-in module, it is initialized again on its next use
+//===================================
+static int mcu_unload( lua_State* L )
+{
+    const char *name = luaL_checkstring( L, 1 );
+    lua_pushboolean(L, luaR_unload(L, name));
+    return 1;
+}
+
 #define MIN_OPT_LEVEL       2
 #include "lrodefs.h"
 const LUA_REG_TYPE mcu_map[] =
@@ -389,6 +399,7 @@ const LUA_REG_TYPE mcu_map[] =
   { LSTRKEY( "setparams" ), LFUNCVAL(set_sparams)},
   { LSTRKEY( "queuepush" ), LFUNCVAL(queue_push)},
   { LSTRKEY( "random" ), LFUNCVAL(mcu_random)},
+  { LSTRKEY( "unload" ), LFUNCVAL(mcu_unload)},
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif      
   {LNILKEY, LNILVAL}
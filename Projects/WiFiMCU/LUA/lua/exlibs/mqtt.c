@@ -1021,7 +1021,7 @@ static int lmqtt_publish( lua_State* L )
   }
     
   size_t sld = 0;
-  char const *data = luaL_checklstring( L, 4, &sld );
+  char const *data = buffer_checklstring( L, 4, &sld );
   if (data == NULL) {
     l_message(NULL, "data: wrong arg type");
     lua_pushinteger(L, -5);
@@ -1166,9 +1166,13 @@ const LUA_REG_TYPE mqtt_map[] =
 
 LUALIB_API int luaopen_mqtt(lua_State *L)
 {
-    for(int i=0;i<MAX_MQTT_NUM;i++)
+    // after an unload the clients may still be closing in the mqtt thread
+    if (!mqtt_thread_is_started)
     {
-      pmqtt[i]=NULL;
+      for(int i=0;i<MAX_MQTT_NUM;i++)
+      {
+        pmqtt[i]=NULL;
+      }
     }
 #if LUA_OPTIMIZE_MEMORY > 0
     return 0;
@@ -1183,4 +1187,10 @@ LUALIB_API int luaopen_mqtt(lua_State *L)
 #endif
 }
 
+// clients are closed and freed asynchronously by the mqtt thread
+LUALIB_API int luaclose_mqtt(lua_State *L)
+{
+    return lmqtt_closeall(L);
+}
+
 
@@ -2,6 +2,8 @@
  * net.c
  */
 
+#include <ctype.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
@@ -15,6 +17,9 @@
 #include "mico_system.h"
 #include "SocketUtils.h"
 #include "mico_rtos.h"
+#include "httpd.h"
+#include <spiffs.h>
+#include <spiffs_nucleus.h>
 
 #define TCP IPPROTO_TCP
 #define UDP IPPROTO_UDP
@@ -27,6 +32,8 @@
 #define MAX_CLT_SOCKET 4
 
 extern mico_queue_t os_queue;
+extern spiffs fs;
+extern void lua_spiffs_mount();
 
 enum _req_actions{
   NO_ACTION=0,
@@ -809,7 +816,7 @@ static int lnet_send( lua_State* L )
     return luaL_error( L, "socket is not valid" );
   
   size_t len=0;
-  const char *data = luaL_checklstring( L, 2, &len );
+  const char *data = buffer_checklstring( L, 2, &len );
   if (len>1024 || data == NULL)
     return luaL_error( L, "data length must <= 1024" );  
 
@@ -930,6 +937,136 @@ static int lnet_getip( lua_State* L )
   return 2;
 }
 
+//httpd file system, called from the httpd thread
+//only files named <httpd_prefix><path> are served
+static char httpd_prefix[SPIFFS_OBJ_NAME_LEN];
+
+static bool httpd_fs_ext(const char *name, int len, const char *ext)
+{
+  int n = strlen(ext);
+  if (len < n) return false;
+  name += len - n;
+  while (*ext)
+    if (tolower((unsigned char)*name++) != *ext++) return false;
+  return true;
+}
+
+//Lua sources and bytecode may hold credentials, they are never served,
+//not even as a .gz variant
+static bool httpd_fs_hidden(const char *name)
+{
+  int len = strlen(name);
+  if (httpd_fs_ext(name, len, ".gz")) len -= 3;
+  return httpd_fs_ext(name, len, ".lua") || httpd_fs_ext(name, len, ".lc");
+}
+
+static int httpd_fs_open(const char *name)
+{
+  char path[SPIFFS_OBJ_NAME_LEN];
+  int fd;
+
+  if (httpd_fs_hidden(name)) return -1;
+  if (strlen(httpd_prefix) + strlen(name) >= sizeof(path)) return -1;
+  strcpy(path, httpd_prefix);
+  strcat(path, name);
+  fd = SPIFFS_open(&fs, path, SPIFFS_RDONLY, 0);
+  return fd > 0 ? fd : -1;
+}
+
+static int httpd_fs_read(int fd, char *buf, int len)
+{
+  int n = SPIFFS_read(&fs, (spiffs_file)fd, buf, len);
+  if (n < 0 && SPIFFS_errno(&fs) == SPIFFS_ERR_END_OF_OBJECT)
+    return 0;
+  return n;
+}
+
+static int httpd_fs_seek(int fd, int offset)
+{
+  return SPIFFS_lseek(&fs, (spiffs_file)fd, offset, SPIFFS_SEEK_SET);
+}
+
+static int httpd_fs_size(int fd)
+{
+  spiffs_stat s;
+  if (SPIFFS_fstat(&fs, (spiffs_file)fd, &s) < 0)
+    return 0;
+  return s.size;
+}
+
+// SPIFFS keeps no modification time. A write moves every object index page
+// that lists a rewritten data page, a size change also moves the header, so
+// the pages of the index, the object id and the size together change
+// whenever the file does. They are folded FNV-1a style into the tag.
+#define HTTPD_TAG_MIX(h, v) (((h) ^ (unsigned)(v)) * 16777619u)
+
+static unsigned httpd_fs_tag(int fd)
+{
+  spiffs_fd *f;
+  spiffs_page_ix pix;
+  spiffs_span_ix spix, last = 0;
+  unsigned h = 2166136261u;
+
+  SPIFFS_LOCK(&fs);
+  if (spiffs_fd_get(&fs, (spiffs_file)fd, &f) < 0)
+    goto fail;
+  h = HTTPD_TAG_MIX(h, f->obj_id);
+  h = HTTPD_TAG_MIX(h, f->size);
+  if (f->size != SPIFFS_UNDEFINED_LEN && f->size > 0)
+    last = SPIFFS_OBJ_IX_ENTRY_SPAN_IX(&fs, (f->size - 1) / SPIFFS_DATA_PAGE_SIZE(&fs));
+  for (spix = 0; spix <= last; spix++) {
+    if (spiffs_obj_lu_find_id_and_span(&fs, f->obj_id | SPIFFS_OBJ_ID_IX_FLAG, spix, 0, &pix) < 0)
+      goto fail;
+    h = HTTPD_TAG_MIX(h, pix);
+  }
+  SPIFFS_UNLOCK(&fs);
+  return h;
+fail:
+  SPIFFS_UNLOCK(&fs);
+  return 0;
+}
+
+static void httpd_fs_close(int fd)
+{
+  SPIFFS_close(&fs, (spiffs_file)fd);
+}
+
+static const struct httpd_fs httpd_spiffs = {
+  httpd_fs_open, httpd_fs_read, httpd_fs_seek, httpd_fs_size, httpd_fs_tag, httpd_fs_close
+};
+
+//net.httpd(true[, prefix]) | net.httpd(false)
+//serve the files of the file system on port 80, a request for /path gets
+//the file named prefix..path, e.g. net.httpd(true, "www/").
+//.lua and .lc files are never served
+//===================================
+static int lnet_httpd( lua_State* L )
+{
+  bool on = lua_toboolean( L, 1 );
+  size_t len;
+  const char *prefix = luaL_optlstring( L, 2, "", &len );
+  
+  if (!on)
+  {
+    if (httpd_is_running())
+      httpd_stop();
+    httpd_unregister_file_handler();
+    return 0;
+  }
+  
+  if (len >= sizeof(httpd_prefix) - 1)
+    return luaL_error( L, "prefix too long" );
+  strcpy(httpd_prefix, prefix);
+  if (SPIFFS_mounted(&fs) == false) lua_spiffs_mount();
+  if (httpd_init() != kNoErr)
+    return luaL_error( L, "httpd init failed" );
+  if (httpd_register_file_handler("/", &httpd_spiffs) != kNoErr)
+    return luaL_error( L, "memory not enough" );
+  if (httpd_start() != kNoErr)
+    return luaL_error( L, "httpd start failed" );
+  return 0;
+}
+
 #define MIN_OPT_LEVEL   2
 #include "lrodefs.h"
 const LUA_REG_TYPE net_map[] =
@@ -940,6 +1077,7 @@ const LUA_REG_TYPE net_map[] =
   {LSTRKEY("send"), LFUNCVAL(lnet_send)},
   {LSTRKEY("close"), LFUNCVAL(lnet_close)},
   {LSTRKEY("getip"), LFUNCVAL(lnet_getip)},
+  {LSTRKEY("httpd"), LFUNCVAL(lnet_httpd)},
 #if LUA_OPTIMIZE_MEMORY > 0
    { LSTRKEY( "TCP" ), LNUMVAL( TCP ) },
    { LSTRKEY( "UDP" ), LNUMVAL( UDP ) },
@@ -953,11 +1091,7 @@ LUALIB_API int luaopen_net(lua_State *L)
 {
   int i=0;
   for(i=0;i<MAX_SVR_SOCKET;i++)
-  {
     psvrsockt[i] = NULL;
-    for(int j=0;j<MAX_SVRCLT_SOCKET;j++)
-      psvrsockt[i]->psvrCltsocket[j]=NULL;
-  }
   for(i=0;i<MAX_CLT_SOCKET;i++)
     pcltsockt[i] = NULL;
     
@@ -974,3 +1108,23 @@ LUALIB_API int luaopen_net(lua_State *L)
   return 1;
 #endif
 }
+
+LUALIB_API int luaclose_net(lua_State *L)
+{
+  int i=0;
+  if(timer_net_is_started)
+  {
+    mico_stop_timer(&_timer_net);
+    mico_deinit_timer(&_timer_net);
+    timer_net_is_started = false;
+  }
+  if (httpd_is_running())
+    httpd_stop();
+  for(i=0;i<MAX_SVR_SOCKET;i++)
+    if(psvrsockt[i] != NULL)
+      closeSocket(L, psvrsockt[i]->socket);
+  for(i=0;i<MAX_CLT_SOCKET;i++)
+    if(pcltsockt[i] != NULL)
+      closeSocket(L, pcltsockt[i]->socket);
+  return 0;
+}
@@ -39,6 +39,17 @@ static uint8_t oled_i2caddr = 0x3C;
 
 static uint8_t rowbuf[132];
 
+// optional shadow of the display RAM, only changed columns are sent
+#define OLED_PAGES      (Max_Row/8)
+#define OLED_FB_OFF     0
+#define OLED_FB_AUTO    1  // flush at the end of every oled call
+#define OLED_FB_MANUAL  2  // flush by oled.flush()
+
+static uint8_t* oled_fb = NULL;
+static uint8_t oled_fbmode = OLED_FB_OFF;
+static uint8_t oled_dirty_x1[OLED_PAGES];
+static uint8_t oled_dirty_x2[OLED_PAGES];  // x2 < x1: page is clean
+
 //---------------------------------------------
 static int platform_gpio_exists( unsigned pin )
 {
@@ -95,15 +106,7 @@ static void oled_setpos(uint8_t x, uint8_t y)
 //--------------------------------------
 static int _oled_write_buf(uint16_t len)
 {
-  uint16_t i;
-  
   rowbuf[0] = 0x40;
-  if (oled_inverse) {
-    for (i=1;i<=len;i++) {
-      rowbuf[i] = rowbuf[i] ^ 0xFF;
-    }
-  }
-  
   if (oled_ID < 3) {
     MicoGpioOutputHigh( (mico_gpio_t)oled_pinDC );
     _spi_write(oled_ID, 8, &rowbuf[1], len, 1);
@@ -114,8 +117,8 @@ static int _oled_write_buf(uint16_t len)
   }
 }
 
-//----------------------------------------------------------------
-static void _oled_write_bufpos(uint8_t x, uint8_t y, uint16_t len)
+//---------------------------------------------------------------
+static void _oled_send_bufpos(uint8_t x, uint8_t y, uint16_t len)
 {
   if (oled_ID < 3) {
     oled_setpos(x,y);
@@ -130,6 +133,59 @@ static void _oled_write_bufpos(uint8_t x, uint8_t y, uint16_t len)
   }
 }
 
+//------------------------------
+static void _oled_fb_clean(void)
+{
+  uint8_t i;
+  for (i=0;i<OLED_PAGES;i++) {
+    oled_dirty_x1[i] = Max_Column;
+    oled_dirty_x2[i] = 0;
+  }
+}
+
+// send the changed column range of every page
+//------------------------------
+static void _oled_fb_flush(void)
+{
+  uint8_t i;
+  uint16_t n;
+
+  if (oled_fb == NULL) return;
+  for (i=0;i<OLED_PAGES;i++) {
+    if (oled_dirty_x2[i] < oled_dirty_x1[i]) continue;
+    n = oled_dirty_x2[i] - oled_dirty_x1[i] + 1;
+    memcpy(&rowbuf[1], &oled_fb[i*Max_Column + oled_dirty_x1[i]], n);
+    _oled_send_bufpos(oled_dirty_x1[i], i, n);
+  }
+  _oled_fb_clean();
+}
+
+// rowbuf[1..len] to page y from column x
+//----------------------------------------------------------------
+static void _oled_write_bufpos(uint8_t x, uint8_t y, uint16_t len)
+{
+  uint16_t i;
+  uint8_t* p;
+
+  if (oled_inverse) {
+    for (i=1;i<=len;i++) {
+      rowbuf[i] = rowbuf[i] ^ 0xFF;
+    }
+  }
+  if ((oled_fb == NULL) || (y >= OLED_PAGES)) {
+    _oled_send_bufpos(x, y, len);
+    return;
+  }
+  if ((x + len) > Max_Column) len = Max_Column - x;
+  p = &oled_fb[y*Max_Column];
+  for (i=0;i<len;i++) {
+    if (p[x+i] == rowbuf[i+1]) continue;
+    p[x+i] = rowbuf[i+1];
+    if ((x+i) < oled_dirty_x1[y]) oled_dirty_x1[y] = x+i;
+    if ((x+i) > oled_dirty_x2[y]) oled_dirty_x2[y] = x+i;
+  }
+}
+
 // Displays a character at the specified location, including part of the character
 // x:0~127
 // y:0~7
@@ -271,7 +327,13 @@ static void OLED_ShowString(uint8_t x,uint8_t y,uint8_t *chr)
 static void _oled_clear( void )
 {
   uint8_t i;
+  // as before the shadow buffer, I2C displays clear to the inverse colour
+  uint8_t fill = ((oled_ID >= 3) && (oled_inverse)) ? 0xFF : 0;
   
+  if (oled_fb != NULL) {
+    memset(oled_fb, fill, Max_Column*OLED_PAGES);
+    _oled_fb_clean();
+  }
 
   if (oled_ID < 3) {
     oled_setpos(0,0);
@@ -282,10 +344,10 @@ static void _oled_clear( void )
   }
   else {
     for (i=1;i<=128;i++) {
-      rowbuf[i] = 0;
+      rowbuf[i] = fill;
     }
     for (i=0;i<8;i++) {
-      _oled_write_bufpos(0,i,128);
+      _oled_send_bufpos(0,i,128);
     }
   }
 }
@@ -454,6 +516,7 @@ static int oled_write( lua_State* L )
       y = oled_lastY;
     }
   }  
+  if (oled_fbmode == OLED_FB_AUTO) _oled_fb_flush();
   return 0;
 }
 
@@ -468,6 +531,7 @@ static int oled_writechar( lua_State* L )
   uint8_t chr = luaL_checkinteger( L, 3 );
   
   OLED_ShowChar(x, y, chr);
+  if (oled_fbmode == OLED_FB_AUTO) _oled_fb_flush();
   return 0;
 }
 
@@ -541,6 +605,42 @@ static int oled_seti2caddr( lua_State* L )
   return 0;
 }
 
+//oled.buffer(mode)
+//mode: 0 off, 1 flush after every write, 2 flush by oled.flush()
+//the buffer starts with the screen cleared
+//====================================
+static int oled_buffer( lua_State* L )
+{
+  if (oled_ID > 4) {
+    l_message( NULL, "oled not yet initialized" );
+    return 0;
+  }
+
+  uint8_t mode = luaL_checkinteger( L, 1 );
+  if (mode > OLED_FB_MANUAL) return luaL_error( L, "mode should be 0~2" );
+
+  if (mode == OLED_FB_OFF) {
+    _oled_fb_flush();
+    if (oled_fb != NULL) free(oled_fb);
+    oled_fb = NULL;
+  }
+  else if (oled_fb == NULL) {
+    oled_fb = (uint8_t*)malloc(Max_Column*OLED_PAGES);
+    if (oled_fb == NULL) return luaL_error( L, "memory not enough" );
+    _oled_clear();
+  }
+  oled_fbmode = mode;
+  return 0;
+}
+
+//===================================
+static int oled_flush( lua_State* L )
+{
+  if (oled_ID > 4) return 0;
+  _oled_fb_flush();
+  return 0;
+}
+
 
 
 #define MIN_OPT_LEVEL       2
@@ -556,6 +656,8 @@ const LUA_REG_TYPE oled_map[] =
   { LSTRKEY( "fixedwidth" ), LFUNCVAL( oled_fixed )},
   { LSTRKEY( "charspace" ), LFUNCVAL( oled_charspace )},
   { LSTRKEY( "seti2caddr" ), LFUNCVAL( oled_seti2caddr )},
+  { LSTRKEY( "buffer" ), LFUNCVAL( oled_buffer )},
+  { LSTRKEY( "flush" ), LFUNCVAL( oled_flush )},
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif      
   {LNILKEY, LNILVAL}
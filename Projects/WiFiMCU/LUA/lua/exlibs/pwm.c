@@ -2,6 +2,10 @@
  * pwm.c
  */
 
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
@@ -56,11 +60,271 @@ static int lpwm_start( lua_State* L )
   MicoGpioFinalize((mico_gpio_t)wifimcu_gpio_map[pin]); 
   MicoGpioInitialize((mico_gpio_t)wifimcu_gpio_map[pin],OUTPUT_PUSH_PULL);
     
-  MicoPwmInitialize((mico_pwm_t)pwmPinID,(uint32_t)freq,(float)duty);
+  // D15/D16 share their timer with adc.start streams
+  if (MicoPwmInitialize((mico_pwm_t)pwmPinID,(uint32_t)freq,(float)duty) == kAlreadyInUseErr)
+    return luaL_error( L, "pin in use by adc stream" );
   MicoPwmStart((mico_pwm_t)pwmPinID);
   return 0;
 }
 
+// == Waveforms ==
+// Duty cycle tables are strings of uint16 LE values, 0~65535 for 0~100%.
+// Each table entry is held for div PWM periods, the DMA buffer is refilled
+// from the DMA interrupt, so Lua is not involved while a waveform plays.
+
+#define WAVE_SLOTS          2   // timers with waveform DMA
+#define WAVE_HALF_FRAMES    16  // frames per DMA half buffer
+
+typedef struct {
+  bool                    used;
+  uint8_t                 count;
+  mico_pwm_t              pwm[MICO_PWM_WAVE_MAX_CHANNELS];
+  mico_pwm_wave_layout_t  layout;
+  const uint8_t*          table[MICO_PWM_WAVE_MAX_CHANNELS];
+  uint32_t                len[MICO_PWM_WAVE_MAX_CHANNELS];   // entries
+  uint32_t                pos[MICO_PWM_WAVE_MAX_CHANNELS];
+  int                     ref[MICO_PWM_WAVE_MAX_CHANNELS];   // keeps the tables
+  uint32_t                div;
+  uint32_t                rep;
+  bool                    loop;
+  uint32_t*               buffer;
+} pwm_wave_t;
+
+static pwm_wave_t pwm_wave[WAVE_SLOTS];
+
+// == DMA half buffer handler, interrupt context ==
+// returns false when a one shot waveform reached its end
+static bool _pwm_wave_fill( uint32_t* frames, uint32_t count, void* arg )
+{
+  pwm_wave_t* w = (pwm_wave_t*)arg;
+  const uint8_t* t;
+  uint32_t f, v;
+  uint8_t c;
+  bool more = true;
+  bool end;
+
+  for (f = 0; f < count; f++) {
+    for (c = 0; c < w->count; c++) {
+      t = w->table[c] + 2*w->pos[c];
+      v = t[0] | (t[1] << 8);
+      frames[w->layout.column[c]] = (v * w->layout.period) / 0xFFFF;
+    }
+    frames += w->layout.width;
+
+    if (++w->rep >= w->div) {
+      w->rep = 0;
+      end = true;
+      for (c = 0; c < w->count; c++) {
+        if (++w->pos[c] >= w->len[c]) {
+          // one shot tables stay at their last entry
+          w->pos[c] = (w->loop) ? 0 : w->len[c]-1;
+        }
+        else end = false;
+      }
+      if (end && !w->loop) more = false;
+    }
+  }
+  return more;
+}
+
+static void _pwm_wave_free( lua_State* L, pwm_wave_t* w )
+{
+  uint8_t c;
+
+  if (!w->used) return;
+  MicoPwmWaveStop(w->pwm[0]);
+  for (c = 0; c < w->count; c++) {
+    if (w->ref[c] != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, w->ref[c]);
+    w->ref[c] = LUA_NOREF;
+  }
+  if (w->buffer != NULL) free(w->buffer);
+  w->buffer = NULL;
+  w->used = false;
+}
+
+// stop the waveform using the timer of pwm
+static void _pwm_wave_stop( lua_State* L, mico_pwm_t pwm )
+{
+  mico_pwm_t pair[2];
+  mico_pwm_wave_layout_t layout;
+  int i;
+
+  for (i = 0; i < WAVE_SLOTS; i++) {
+    if (!pwm_wave[i].used) continue;
+    pair[0] = pwm_wave[i].pwm[0];
+    pair[1] = pwm;
+    if (MicoPwmWaveLayout(pair, 2, &layout) == kNoErr) _pwm_wave_free(L, &pwm_wave[i]);
+  }
+}
+
+static mico_pwm_t _pwm_check_pin( lua_State* L, unsigned pin )
+{
+  MOD_CHECK_ID( pwmpin, pin);
+  return (mico_pwm_t)wifimcu_pwm_map[wifimcu_gpio_map[pin]];
+}
+
+//pwm.wave(pin|{pins},freq,table|{tables},rate[,loop])
+//tables: strings of uint16 LE duty values (0~65535), see pwm.ramp/pwm.sine
+//rate:   table entries per second, the pins must be PWM channels of one timer
+static int lpwm_wave( lua_State* L )
+{
+  pwm_wave_t* w = NULL;
+  const char* s;
+  size_t len;
+  unsigned pins[MICO_PWM_WAVE_MAX_CHANNELS];
+  uint8_t count = 0;
+  uint8_t c;
+  int i;
+
+  if (lua_type(L, 1) == LUA_TTABLE) {
+    if ((lua_objlen(L, 1) == 0) || (lua_objlen(L, 1) > MICO_PWM_WAVE_MAX_CHANNELS))
+      return luaL_error( L, "1~%d pins", MICO_PWM_WAVE_MAX_CHANNELS );
+    count = lua_objlen(L, 1);
+    for (c = 0; c < count; c++) {
+      lua_rawgeti(L, 1, c+1);
+      pins[c] = luaL_checkinteger( L, -1 );
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    pins[0] = luaL_checkinteger( L, 1 );
+    count = 1;
+  }
+  int freq = luaL_checkinteger( L, 2);
+  if(freq <= 0 || freq>10000)
+    return luaL_error( L, "0< freq < 10kHz" );
+  if ((lua_type(L, 3) == LUA_TTABLE) && (lua_objlen(L, 3) != count))
+    return luaL_error( L, "one table per pin needed" );
+  int rate = luaL_checkinteger( L, 4);
+  if ((rate <= 0) || (rate > freq))
+    return luaL_error( L, "0< rate <= freq" );
+  for (c = 0; c < count; c++) {
+    _pwm_check_pin(L, pins[c]);
+    if (lua_type(L, 3) == LUA_TTABLE) lua_rawgeti(L, 3, c+1);
+    else lua_pushvalue(L, 3);
+    luaL_checklstring( L, -1, &len );
+    lua_pop(L, 1);
+    if (len < 2) return luaL_error( L, "table is empty" );
+  }
+
+  for (i = 0; i < WAVE_SLOTS; i++) {
+    if (!pwm_wave[i].used) {
+      w = &pwm_wave[i];
+      break;
+    }
+  }
+  for (c = 0; c < count; c++) {
+    mico_pwm_t pwm = _pwm_check_pin(L, pins[c]);
+    _pwm_wave_stop(L, pwm);
+  }
+  // a slot may just have been freed
+  if (w == NULL) {
+    for (i = 0; i < WAVE_SLOTS; i++) {
+      if (!pwm_wave[i].used) {
+        w = &pwm_wave[i];
+        break;
+      }
+    }
+  }
+  if (w == NULL) return luaL_error( L, "no free waveform" );
+
+  memset(w, 0, sizeof(pwm_wave_t));
+  for (c = 0; c < MICO_PWM_WAVE_MAX_CHANNELS; c++) w->ref[c] = LUA_NOREF;
+  w->count = count;
+  w->loop = true;
+  if (lua_gettop(L) > 4) w->loop = lua_toboolean(L, 5);
+  w->div = (freq + rate/2) / rate;
+
+  for (c = 0; c < count; c++) {
+    w->pwm[c] = _pwm_check_pin(L, pins[c]);
+    if (lua_type(L, 3) == LUA_TTABLE) lua_rawgeti(L, 3, c+1);
+    else lua_pushvalue(L, 3);
+    s = lua_tolstring( L, -1, &len );
+    w->table[c] = (const uint8_t*)s;
+    w->len[c] = len / 2;
+    w->ref[c] = luaL_ref(L, LUA_REGISTRYINDEX);
+    w->used = true;
+  }
+
+  if (MicoPwmWaveLayout(w->pwm, count, &w->layout) != kNoErr) {
+    _pwm_wave_free(L, w);
+    return luaL_error( L, "pins don't support waveforms together" );
+  }
+  w->buffer = (uint32_t*)malloc(2 * WAVE_HALF_FRAMES * w->layout.width * sizeof(uint32_t));
+  if (w->buffer == NULL) {
+    _pwm_wave_free(L, w);
+    return luaL_error( L, "memory not enough" );
+  }
+  memset(w->buffer, 0, 2 * WAVE_HALF_FRAMES * w->layout.width * sizeof(uint32_t));
+
+  for (c = 0; c < count; c++) {
+    const uint8_t* t = w->table[c];
+    float duty = (float)(t[0] | (t[1] << 8)) * 100.0f / 65535.0f;
+
+    MicoGpioFinalize((mico_gpio_t)wifimcu_gpio_map[pins[c]]);
+    MicoGpioInitialize((mico_gpio_t)wifimcu_gpio_map[pins[c]],OUTPUT_PUSH_PULL);
+    MicoPwmInitialize(w->pwm[c],(uint32_t)freq,duty);
+  }
+  // period is only known after the timer is initialised
+  MicoPwmWaveLayout(w->pwm, count, &w->layout);
+  if (MicoPwmWaveStart(w->pwm, count, w->buffer, 2 * WAVE_HALF_FRAMES, _pwm_wave_fill, w) != kNoErr) {
+    _pwm_wave_free(L, w);
+    return luaL_error( L, "waveform start failed" );
+  }
+  // channels of one timer, all start together
+  for (c = 0; c < count; c++) MicoPwmStart(w->pwm[c]);
+  return 0;
+}
+
+static int _pwm_check_duty( lua_State* L, int index )
+{
+  lua_Number duty = luaL_checknumber( L, index );
+  if( duty<0 || duty>100)
+    luaL_error( L, "0< duty < 100" );
+  return (int)(duty * 65535 / 100 + 0.5);
+}
+
+static void _pwm_push_entry( luaL_Buffer* b, int v )
+{
+  luaL_addchar(b, (char)(v & 0xFF));
+  luaL_addchar(b, (char)(v >> 8));
+}
+
+//pwm.ramp(n,from,to), n entries from 'from' to 'to' duty (%)
+static int lpwm_ramp( lua_State* L )
+{
+  luaL_Buffer b;
+  int n = luaL_checkinteger( L, 1 );
+  int from = _pwm_check_duty( L, 2 );
+  int to = _pwm_check_duty( L, 3 );
+  int i;
+
+  if (n < 2) return luaL_error( L, "n >= 2" );
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; i++) _pwm_push_entry(&b, from + ((to - from) * i) / (n - 1));
+  luaL_pushresult(&b);
+  return 1;
+}
+
+//pwm.sine(n,min,max), one period in n entries, starts at 'min' duty (%)
+static int lpwm_sine( lua_State* L )
+{
+  luaL_Buffer b;
+  int n = luaL_checkinteger( L, 1 );
+  int lo = _pwm_check_duty( L, 2 );
+  int hi = _pwm_check_duty( L, 3 );
+  int i;
+
+  if (n < 2) return luaL_error( L, "n >= 2" );
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; i++) {
+    float k = (1.0f - cosf(2.0f * 3.14159265f * i / n)) / 2.0f;
+    _pwm_push_entry(&b, lo + (int)((hi - lo) * k + 0.5f));
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
 //lpwm_stop(pin)
 static int lpwm_stop( lua_State* L )
 {
@@ -68,6 +332,7 @@ static int lpwm_stop( lua_State* L )
   MOD_CHECK_ID( pwmpin, pin);
   int pwmPinID = wifimcu_pwm_map[wifimcu_gpio_map[pin]];
    
+  _pwm_wave_stop(L, (mico_pwm_t)pwmPinID);
   MicoPwmStop((mico_pwm_t)pwmPinID);
   return 0;
 }
@@ -78,6 +343,9 @@ const LUA_REG_TYPE pwm_map[] =
 {
   { LSTRKEY( "start" ), LFUNCVAL( lpwm_start ) },
   { LSTRKEY( "stop" ), LFUNCVAL( lpwm_stop ) },
+  { LSTRKEY( "wave" ), LFUNCVAL( lpwm_wave ) },
+  { LSTRKEY( "ramp" ), LFUNCVAL( lpwm_ramp ) },
+  { LSTRKEY( "sine" ), LFUNCVAL( lpwm_sine ) },
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif    
   {LNILKEY, LNILVAL}
@@ -93,4 +361,10 @@ LUALIB_API int luaopen_pwm(lua_State *L)
 #endif
 }
 
+LUALIB_API int luaclose_pwm(lua_State *L)
+{
+  for (int i = 0; i < WAVE_SLOTS; i++) _pwm_wave_free(L, &pwm_wave[i]);
+  return 0;
+}
+
 
@@ -15,6 +15,8 @@
 #include "mico_system.h"
 
 extern void luaWdgReload( void );
+extern uint32_t gpio_time_us( void );
+extern mico_queue_t os_queue;
 
 // we use cycle counter for precise timing
 #define CYCLE_COUNTING_INIT() \
@@ -961,12 +963,244 @@ static uint8_t DHT11_Check(void)
   return 0;  // OK
 }
 
+//*****************************************************************
+// Asynchronous reads
+// DHT: the start pulse and the capture window are timed by a MICO
+// timer, the response is captured by edge interrupts with us time
+// stamps and decoded in the Lua thread.
+// DS18B20: the conversion wait runs on a MICO timer instead of
+// sleeping in the Lua thread, only the short command and scratchpad
+// transfers are bit-banged.
+//*****************************************************************
+
+#define SENSOR_DHT           0
+#define SENSOR_DS18B20       1
+
+#define DHT_START_MS         20  // start pulse and capture window
+#define DHT_MAX_EDGES        96  // 2 + 2*41 edges in a full response
+
+#define OW_POLL_MS           10  // recheck interval if conversion is not done
+#define OW_MAX_POLLS         20
+
+typedef struct {
+  uint8_t  state;
+  int      cb_ref;
+  lua_State* L;
+  mico_timer_t timer;
+  volatile uint8_t nedge;
+  uint32_t t[DHT_MAX_EDGES];
+  uint8_t  lvl[DHT_MAX_EDGES];
+} dht_async_t;
+
+typedef struct {
+  uint8_t  state;
+  uint8_t  dev;
+  uint8_t  polls;
+  int      cb_ref;
+  lua_State* L;
+  uint32_t tick;
+  mico_timer_t timer;
+} ow_async_t;
+
+// ASYNC_LOST: the queue was full, the Lua thread drops the read on its next use
+enum { ASYNC_IDLE = 0, ASYNC_START, ASYNC_CAPTURE, ASYNC_DONE, ASYNC_LOST };
+
+static dht_async_t dht_async = { ASYNC_IDLE, LUA_NOREF };
+static ow_async_t ow_async = { ASYNC_IDLE, 0, 0, LUA_NOREF };
+
+//-----------------------------------------------------
+static bool _sensor_post( lua_State* L, uint8_t kind, int ref )
+{
+  queue_msg_t msg;
+  msg.L = L;
+  msg.source = onSENSOR;
+  msg.para1 = kind;
+  msg.para2 = ref;
+  msg.para3 = NULL;
+  msg.para4 = NULL;
+  return mico_rtos_push_to_queue( &os_queue, &msg, 0 ) == kNoErr;
+}
+
+//---------------------------------
+static void _dht_irq( void* arg )
+{
+  uint8_t n = dht_async.nedge;
+  if (n >= DHT_MAX_EDGES) return;
+  dht_async.t[n] = gpio_time_us();
+  dht_async.lvl[n] = MicoGpioInputGet((mico_gpio_t)PinID_DHT11) ? 1 : 0;
+  dht_async.nedge = n + 1;
+}
+
+// timer thread: release the line after the start pulse, then end the capture
+//-----------------------------------
+static void _dht_timer( void* arg )
+{
+  if (dht_async.state == ASYNC_START) {
+    dht_async.nedge = 0;
+    dht_async.state = ASYNC_CAPTURE;
+    MicoGpioInitialize((mico_gpio_t)PinID_DHT11, (mico_gpio_config_t)INPUT_PULL_UP);
+    MicoGpioEnableIRQ((mico_gpio_t)PinID_DHT11, IRQ_TRIGGER_BOTH_EDGES, _dht_irq, NULL);
+  }
+  else if (dht_async.state == ASYNC_CAPTURE) {
+    MicoGpioDisableIRQ((mico_gpio_t)PinID_DHT11);
+    mico_stop_timer(&dht_async.timer);
+    dht_async.state = ASYNC_DONE;
+    if (!_sensor_post(dht_async.L, SENSOR_DHT, dht_async.cb_ref)) dht_async.state = ASYNC_LOST;
+  }
+}
+
+// decode the captured edges, same status codes as dht11.get
+//-----------------------------------------------------------
+static uint8_t _dht_decode( int* t, int* h )
+{
+  uint8_t pulse[DHT_MAX_EDGES/2];
+  uint8_t buf[5];
+  uint8_t i, n = 0, first;
+  uint32_t len;
+
+  // high pulse lengths; the last 40 are the data bits
+  for (i = 0; (i + 1) < dht_async.nedge; i++) {
+    if ((dht_async.lvl[i] == 1) && (dht_async.lvl[i+1] == 0)) {
+      len = dht_async.t[i+1] - dht_async.t[i];
+      pulse[n++] = (len > 255) ? 255 : len;
+    }
+  }
+  // response pulse + 40 bits
+  if (n < 41) return 3;
+  if ((pulse[n-41] < 40) || (pulse[n-41] >= 100)) return 3;
+
+  first = n - 40;
+  memset(buf, 0, sizeof(buf));
+  for (i = 0; i < 40; i++) {
+    len = pulse[first + i];
+    if ((len < 10) || (len >= 90)) return 1;
+    buf[i/8] <<= 1;
+    if (len > 40) buf[i/8] |= 1;
+  }
+  if (((buf[0]+buf[1]+buf[2]+buf[3]) & 0xFF) != buf[4]) return 2;
+
+  if (DHT11_22) { // DHT22
+    *h = (buf[0]<<8) | buf[1];
+    if (buf[2] & 0x80) *t = (((buf[2]&0x7f)<<8) | buf[3]) * -1;
+    else *t = (buf[2]<<8) | buf[3];
+  }
+  else { // DHT11
+    *h = buf[0];
+    if (buf[2] & 0x80) *t = (buf[2]&0x7f) * -1;
+    else *t = buf[2];
+  }
+  return 0;
+}
+
+// timer thread: conversion time elapsed
+//----------------------------------
+static void _ow_timer( void* arg )
+{
+  if (ow_async.state != ASYNC_START) return;
+  mico_stop_timer(&ow_async.timer);
+  ow_async.state = ASYNC_DONE;
+  if (!_sensor_post(ow_async.L, SENSOR_DS18B20, ow_async.cb_ref)) ow_async.state = ASYNC_LOST;
+}
+
+//---------------------------------------------------------
+static void _ow_arm( uint32_t ms )
+{
+  mico_deinit_timer(&ow_async.timer);
+  mico_init_timer(&ow_async.timer, ms, _ow_timer, NULL);
+  ow_async.state = ASYNC_START;
+  mico_start_timer(&ow_async.timer);
+}
+
+//-------------------------------------
+static void _dht_async_free( lua_State* L )
+{
+  if (dht_async.state != ASYNC_IDLE) {
+    mico_stop_timer(&dht_async.timer);
+    if (PinID_DHT11 != 255) MicoGpioDisableIRQ((mico_gpio_t)PinID_DHT11);
+    mico_deinit_timer(&dht_async.timer);
+  }
+  if (dht_async.cb_ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, dht_async.cb_ref);
+  dht_async.cb_ref = LUA_NOREF;
+  dht_async.state = ASYNC_IDLE;
+}
+
+//------------------------------------
+static void _ow_async_free( lua_State* L )
+{
+  if (ow_async.state != ASYNC_IDLE) {
+    mico_stop_timer(&ow_async.timer);
+    mico_deinit_timer(&ow_async.timer);
+  }
+  if (ow_async.cb_ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, ow_async.cb_ref);
+  ow_async.cb_ref = LUA_NOREF;
+  ow_async.state = ASYNC_IDLE;
+}
+
+// back to idle after a result that could not be posted, its callback is
+// released here since the timer thread can't touch the registry
+//------------------------------------
+static void _sensor_reclaim( lua_State* L )
+{
+  if (dht_async.state == ASYNC_LOST) _dht_async_free(L);
+  if (ow_async.state == ASYNC_LOST) _ow_async_free(L);
+}
+
+// Lua thread, called from the queue task
+//-------------------------------------------
+void _sensor_handle( lua_State* L, int kind )
+{
+  owState_t stat;
+  float temper;
+  int t = 0, h = 0;
+  uint8_t res;
+
+  if (kind == SENSOR_DHT) {
+    if (dht_async.state != ASYNC_DONE) return;
+    res = _dht_decode(&t, &h);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, dht_async.cb_ref);
+    _dht_async_free(L);
+    if (!lua_isfunction(L, -1)) {
+      lua_pop(L, 1);
+      return;
+    }
+    lua_pushinteger(L, t);
+    lua_pushinteger(L, h);
+    lua_pushinteger(L, res);
+    lua_call(L, 3, 0);
+  }
+  else if (kind == SENSOR_DS18B20) {
+    if (ow_async.state != ASYNC_DONE) return;
+    stat = TM_DS18B20_Read(ow_roms[ow_async.dev-1], &temper);
+    if ((stat == owError_NotFinished) && (++ow_async.polls < OW_MAX_POLLS)) {
+      _ow_arm(OW_POLL_MS);
+      return;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ow_async.cb_ref);
+    _ow_async_free(L);
+    if (!lua_isfunction(L, -1)) {
+      lua_pop(L, 1);
+      return;
+    }
+    if (stat == owOK) {
+      lua_pushnumber(L, temper);
+      lua_pushinteger(L, mico_get_time()-ow_async.tick);
+    }
+    else {
+      lua_pushinteger(L, -9999);
+      lua_pushinteger(L, (stat == owError_NotFinished) ? -2 : stat);
+    }
+    lua_call(L, 2, 0);
+  }
+}
+
 //===========================================
 static int lsensor_dht11_init( lua_State* L )
 {
   unsigned pin=0;
   pin = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( gpio, pin );
+  _sensor_reclaim(L);
+  if (dht_async.state != ASYNC_IDLE) return luaL_error( L, "dht read in progress" );
   PinID_DHT11 = wifimcu_gpio_map[pin];
   DHT11_22 = 0;
   
@@ -995,6 +1229,8 @@ static int lsensor_dht11_get( lua_State* L )
     lua_pushinteger(L, 4);
     return 3;
   }
+  _sensor_reclaim(L);
+  if (dht_async.state != ASYNC_IDLE) return luaL_error( L, "dht read in progress" );
   
   uint8_t i,j,dat,len,stat;
   uint8_t buf[5];
@@ -1055,6 +1291,31 @@ static int lsensor_dht11_get( lua_State* L )
   return 3;
 }
 
+//sensor.dht11.read(function(t, h, stat) ... end)
+//starts a read and returns at once, func gets the dht11.get results
+//===========================================
+static int lsensor_dht11_read( lua_State* L )
+{
+  if (PinID_DHT11 == 255) return luaL_error( L, "init DHT11 first" );
+  _sensor_reclaim(L);
+  if (dht_async.state != ASYNC_IDLE) return luaL_error( L, "dht read in progress" );
+  if (lua_type(L, 1) != LUA_TFUNCTION && lua_type(L, 1) != LUA_TLIGHTFUNCTION)
+    return luaL_error( L, "callback function needed" );
+
+  lua_pushvalue(L, 1);
+  dht_async.cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  dht_async.L = L;
+  dht_async.nedge = 0;
+  dht_async.state = ASYNC_START;
+
+  // start pulse, the timer releases the line
+  MicoGpioOutputLow((mico_gpio_t)PinID_DHT11);
+  MicoGpioInitialize((mico_gpio_t)PinID_DHT11, (mico_gpio_config_t)OUTPUT_PUSH_PULL);
+  mico_init_timer(&dht_async.timer, DHT_START_MS, _dht_timer, NULL);
+  mico_start_timer(&dht_async.timer);
+  return 0;
+}
+
 //----------------------------
 uint8_t check_dev(uint8_t n) {
   if (((ow_numdev == 0)) || (n == 0) || (n > ow_numdev)) {
@@ -1175,6 +1436,40 @@ static int lsensor_18b20_gettemp( lua_State* L )
   return 2;
 }
 
+//sensor.ds18b20.read(dev, function(temp, time) ... end)
+//starts a conversion and returns at once, func gets the gettemp results
+//===========================================
+static int lsensor_18b20_read( lua_State* L )
+{
+  uint8_t dev = 0;
+  uint8_t res;
+
+  dev = luaL_checkinteger( L, 1 );
+  if (check_dev(dev)) return luaL_error( L, "wrong device" );
+  _sensor_reclaim(L);
+  if (ow_async.state != ASYNC_IDLE) return luaL_error( L, "conversion in progress" );
+  if (lua_type(L, 2) != LUA_TFUNCTION && lua_type(L, 2) != LUA_TLIGHTFUNCTION)
+    return luaL_error( L, "callback function needed" );
+
+  res = TM_DS18B20_GetResolution(ow_roms[dev-1]);
+  if ((res < 9) || (res > 12)) res = 12;
+
+  lua_pushvalue(L, 2);
+  ow_async.cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  ow_async.L = L;
+  ow_async.dev = dev;
+  ow_async.polls = 0;
+  ow_async.tick = mico_get_time();
+
+  /* Start temperature conversion on all devices on one bus */
+  TM_DS18B20_StartAll();
+  // 750 ms at 12 bits, halved for every bit less
+  mico_init_timer(&ow_async.timer, (750 >> (12 - res)) + OW_POLL_MS, _ow_timer, NULL);
+  ow_async.state = ASYNC_START;
+  mico_start_timer(&ow_async.timer);
+  return 0;
+}
+
 //=============================================
 static int lsensor_18b20_startm( lua_State* L )
 {
@@ -1328,6 +1623,7 @@ static const LUA_REG_TYPE dht11_map[] =
 {
   { LSTRKEY( "init" ), LFUNCVAL ( lsensor_dht11_init ) },
   { LSTRKEY( "get" ),  LFUNCVAL ( lsensor_dht11_get ) },
+  { LSTRKEY( "read" ), LFUNCVAL ( lsensor_dht11_read ) },
 #if LUA_OPTIMIZE_MEMORY > 0
 #endif        
   { LNILKEY, LNILVAL }
@@ -1339,6 +1635,7 @@ static const LUA_REG_TYPE ds18b20_map[] =
   { LSTRKEY( "gettemp" ), LFUNCVAL(lsensor_18b20_gettemp ) },  
   { LSTRKEY( "get" ),  LFUNCVAL(lsensor_18b20_get ) },  
   { LSTRKEY( "startm" ),  LFUNCVAL(lsensor_18b20_startm ) },  
+  { LSTRKEY( "read" ),    LFUNCVAL(lsensor_18b20_read ) },  
   { LSTRKEY( "search" ),  LFUNCVAL(lsensor_18b20_search ) },  
   { LSTRKEY( "getres" ),  LFUNCVAL(lsensor_18b20_getres ) },  
   { LSTRKEY( "setres" ),  LFUNCVAL(lsensor_18b20_setres ) },  
@@ -1396,3 +1693,10 @@ LUALIB_API int luaopen_sensor(lua_State *L)
   return 1;
 #endif  
 }
+
+LUALIB_API int luaclose_sensor(lua_State *L)
+{
+  _dht_async_free(L);
+  _ow_async_free(L);
+  return 0;
+}
@@ -8,12 +8,16 @@
 #include "lrotable.h"
 
 #include "mico_platform.h"
+#include "spi.h"
 //#include "platform_config.h"
 //#include "platform_peripheral.h"
 
 #define BITS_8          8
 #define BITS_16         16
 
+#define SPI_DMA_MIN_LENGTH   32  // shorter transfers are cheaper without DMA setup
+#define SPI_MAX_SEGMENTS     16  // strings per spi.transfer call
+
 extern const char wifimcu_gpio_map[];
 
 #define NUM_GPIO 18
@@ -243,16 +247,150 @@ static void _spi_writeByte( const platform_spi_t* spi, uint16_t data )
   while (SPI_I2S_GetFlagStatus(spi->port, SPI_I2S_FLAG_BSY) == SET);
 }
 
+//------------------------------------------------------------------------------
+// LCD DMA engine
+// Data blocks of LCD_DMA_MIN_LENGTH bytes or more are sent by TX DMA.
+// Solid fills (rep > 1) repeat the color from a non incrementing source,
+// 2-byte colors are sent as 16-bit SPI frames, other patterns are
+// replicated into lcd_pattern first.
+//------------------------------------------------------------------------------
+#define LCD_DMA_MIN_LENGTH   32
+#define LCD_DMA_MAX_COUNT    0xFFFF  // NDTR is 16 bits wide
+#define LCD_PATTERN_SIZE     240
+
+static uint8_t lcd_pattern[LCD_PATTERN_SIZE];
+static uint16_t lcd_fill_data;
+static bool lcd_dma_pending = false;
+static const platform_gpio_t* lcd_dma_cs = NULL;
+
+//---------------------------------------------------------------
+static volatile uint32_t* _lcd_dma_isr( DMA_Stream_TypeDef* stream )
+{
+  if ( stream <= DMA1_Stream3 ) return &DMA1->LISR;
+  else if ( stream <= DMA1_Stream7 ) return &DMA1->HISR;
+  else if ( stream <= DMA2_Stream3 ) return &DMA2->LISR;
+  return &DMA2->HISR;
+}
+
+//-------------------------------------------------------------------------------------------------------
+static void _lcd_dma_start( const platform_spi_t* spi, const void* src, uint32_t count, bool inc, bool half )
+{
+  DMA_InitTypeDef dma_init;
+  volatile uint32_t* isr = _lcd_dma_isr( spi->tx_dma.stream );
+
+  RCC_AHB1PeriphClockCmd( (spi->tx_dma.controller == DMA1) ? RCC_AHB1Periph_DMA1 : RCC_AHB1Periph_DMA2, ENABLE );
+  DMA_DeInit( spi->tx_dma.stream );
+
+  dma_init.DMA_Channel            = spi->tx_dma.channel;
+  dma_init.DMA_PeripheralBaseAddr = ( uint32_t )&spi->port->DR;
+  dma_init.DMA_Memory0BaseAddr    = ( uint32_t )src;
+  dma_init.DMA_DIR                = DMA_DIR_MemoryToPeripheral;
+  dma_init.DMA_BufferSize         = count;
+  dma_init.DMA_PeripheralInc      = DMA_PeripheralInc_Disable;
+  dma_init.DMA_MemoryInc          = inc ? DMA_MemoryInc_Enable : DMA_MemoryInc_Disable;
+  dma_init.DMA_PeripheralDataSize = half ? DMA_PeripheralDataSize_HalfWord : DMA_PeripheralDataSize_Byte;
+  dma_init.DMA_MemoryDataSize     = half ? DMA_MemoryDataSize_HalfWord : DMA_MemoryDataSize_Byte;
+  dma_init.DMA_Mode               = DMA_Mode_Normal;
+  dma_init.DMA_Priority           = DMA_Priority_High;
+  dma_init.DMA_FIFOMode           = DMA_FIFOMode_Disable;
+  dma_init.DMA_FIFOThreshold      = DMA_FIFOThreshold_Full;
+  dma_init.DMA_MemoryBurst        = DMA_MemoryBurst_Single;
+  dma_init.DMA_PeripheralBurst    = DMA_PeripheralBurst_Single;
+  DMA_Init( spi->tx_dma.stream, &dma_init );
+
+  // clear flags, IFCR bits are at the same positions as in ISR
+  *(isr + 2) = spi->tx_dma.complete_flags | spi->tx_dma.error_flags;
+
+  SPI_I2S_DMACmd( spi->port, SPI_I2S_DMAReq_Tx, ENABLE );
+  DMA_Cmd( spi->tx_dma.stream, ENABLE );
+}
+
+//--------------------------------------------------
+static void _lcd_dma_finish( const platform_spi_t* spi )
+{
+  volatile uint32_t* isr = _lcd_dma_isr( spi->tx_dma.stream );
+
+  while ( ( *isr & ( spi->tx_dma.complete_flags | spi->tx_dma.error_flags ) ) == 0 );
+  DMA_Cmd( spi->tx_dma.stream, DISABLE );
+  SPI_I2S_DMACmd( spi->port, SPI_I2S_DMAReq_Tx, DISABLE );
+  // wait for the last frame to leave the shift register
+  while ( SPI_I2S_GetFlagStatus( spi->port, SPI_I2S_FLAG_TXE ) == RESET );
+  while ( SPI_I2S_GetFlagStatus( spi->port, SPI_I2S_FLAG_BSY ) == SET );
+  // nothing was read, clear RXNE and OVR
+  (void)SPI_I2S_ReceiveData( spi->port );
+  (void)spi->port->SR;
+}
+
+//-------------------------------------------------------------------------------------------
+static void _lcd_dma_send( const platform_spi_t* spi, const void* src, uint32_t count, bool inc, bool half )
+{
+  uint32_t n;
+  const uint8_t* p = ( const uint8_t* )src;
+
+  if (half) {
+    SPI_Cmd( spi->port, DISABLE );
+    SPI_DataSizeConfig( spi->port, SPI_DataSize_16b );
+    SPI_Cmd( spi->port, ENABLE );
+  }
+  while (count > 0) {
+    n = (count > LCD_DMA_MAX_COUNT) ? LCD_DMA_MAX_COUNT : count;
+    _lcd_dma_start( spi, p, n, inc, half );
+    _lcd_dma_finish( spi );
+    if (inc) p += (half) ? 2*n : n;
+    count -= n;
+  }
+  if (half) {
+    SPI_Cmd( spi->port, DISABLE );
+    SPI_DataSizeConfig( spi->port, SPI_DataSize_8b );
+    SPI_Cmd( spi->port, ENABLE );
+  }
+}
+
+// send ndata bytes rep times, CS is active
+//---------------------------------------------------------------------------------------------------
+static void _lcd_send_block( const platform_spi_t* spi, uint8_t* buf, uint16_t ndata, uint32_t rep )
+{
+  uint32_t i, n, k;
+  uint16_t j;
+
+  if ((ndata * rep) < LCD_DMA_MIN_LENGTH) {
+    for (i=0; i<rep; i++) {
+      for (j=0; j<ndata; j++) _spi_writeByte( spi, buf[j] );
+    }
+  }
+  else if (rep == 1) _lcd_dma_send( spi, buf, ndata, true, false );
+  else if (ndata == 1) _lcd_dma_send( spi, buf, rep, false, false );
+  else if (ndata == 2) {
+    // 16-bit frames are sent MSB first, same byte order as the color
+    lcd_fill_data = (uint16_t)(buf[0] << 8) | buf[1];
+    _lcd_dma_send( spi, &lcd_fill_data, rep, false, true );
+  }
+  else if (ndata <= (LCD_PATTERN_SIZE/2)) {
+    // as many whole patterns as fit into lcd_pattern
+    k = LCD_PATTERN_SIZE / ndata;
+    for (i=0; i<k; i++) memcpy(&lcd_pattern[i*ndata], buf, ndata);
+    while (rep > 0) {
+      n = (rep > k) ? k : rep;
+      _lcd_dma_send( spi, lcd_pattern, n*ndata, true, false );
+      rep -= n;
+    }
+  }
+  else {
+    for (i=0; i<rep; i++) _lcd_dma_send( spi, buf, ndata, true, false );
+  }
+}
+
 // buf structure:
 // cmd ndata rep data1...datan cmd ......
+// with async set, a last single data block of DMA size is left running,
+// _MicoLcdWait() completes it
 //----------------------------------------------------------------------------------------------------------------------------
-static void _platform_lcd_transfer( platform_spi_driver_t* driver, const platform_spi_config_t* config, uint8_t* buf, int len)
+static void _platform_lcd_transfer( platform_spi_driver_t* driver, const platform_spi_config_t* config, uint8_t* buf, int len, bool async)
 {
   int count = len;
-  uint16_t ndata, j;
-  uint32_t rep,i;
+  uint16_t ndata;
+  uint32_t rep;
   uint16_t data;
-  uint8_t* tmpbuf;
   
   platform_mcu_powersave_disable();
   
@@ -260,16 +398,18 @@ static void _platform_lcd_transfer( platform_spi_driver_t* driver, const platfor
     data = *buf++; // get command
     if (data == 0) break;
 
-    // send command, DC=0
-    MicoGpioOutputLow( (mico_gpio_t)TFT_pinDC );
-    // --- Activate chip select --------------------
-    platform_gpio_output_low( config->chip_select );
     count--;
-    // --- send command byte ---
-    _spi_writeByte( driver->peripheral, data );
+    if (data != LCD_CMD_DATA) {
+      // send command, DC=0
+      MicoGpioOutputLow( (mico_gpio_t)TFT_pinDC );
+      // --- Activate chip select --------------------
+      platform_gpio_output_low( config->chip_select );
+      // --- send command byte ---
+      _spi_writeByte( driver->peripheral, data );
     
-    // --- Deactivate chip select -------------------
-    platform_gpio_output_high( config->chip_select );
+      // --- Deactivate chip select -------------------
+      platform_gpio_output_high( config->chip_select );
+    }
 
     // get ndata & rep    
     ndata = (uint16_t)(*buf++ << 8);
@@ -284,14 +424,15 @@ static void _platform_lcd_transfer( platform_spi_driver_t* driver, const platfor
       MicoGpioOutputHigh( (mico_gpio_t)TFT_pinDC );
       // --- Activate chip select --------------------
       platform_gpio_output_low( config->chip_select );
-      for (i=0; i<rep; i++) {
-        tmpbuf = buf;
-        for (j=0; j<ndata; j++) {
-          data = *tmpbuf++;
-          // --- send data byte ---
-          _spi_writeByte( driver->peripheral, data );
-        }
+      if ((async) && (rep == 1) && (ndata >= LCD_DMA_MIN_LENGTH) &&
+          ((count <= ndata) || (buf[ndata] == 0))) {
+        // last block, keep it on the bus while the caller prepares the next one
+        _lcd_dma_start( driver->peripheral, buf, ndata, true, false );
+        lcd_dma_cs = config->chip_select;
+        lcd_dma_pending = true;
+        return;
       }
+      _lcd_send_block( driver->peripheral, buf, ndata, rep );
       buf += ndata;
       count -= ndata;
       // --- Deactivate chip select -------------------
@@ -302,19 +443,48 @@ static void _platform_lcd_transfer( platform_spi_driver_t* driver, const platfor
   platform_mcu_powersave_enable( );
 }
 
-//--------------------------------------------
-void _MicoLcdTransfer( uint8_t* buf, int len )
+// complete a transfer left running by _MicoLcdTransferAsync
+//----------------------
+void _MicoLcdWait( void )
+{
+  if (!lcd_dma_pending) return;
+  _lcd_dma_finish( platform_spi_drivers[HW_SPI5.port].peripheral );
+  // --- Deactivate chip select -------------------
+  platform_gpio_output_high( lcd_dma_cs );
+  platform_mcu_powersave_enable( );
+  lcd_dma_pending = false;
+  mico_rtos_unlock_mutex( &platform_spi_drivers[HW_SPI5.port].spi_mutex );
+}
+
+//-----------------------------------------------------------------
+static void _MicoLcdTransferMode( uint8_t* buf, int len, bool async )
 {
   platform_spi_config_t config;
 
+  _MicoLcdWait();
+
   config.chip_select = &platform_gpio_pins[HW_SPI5.chip_select];
   config.speed       = HW_SPI5.speed;
   config.mode        = HW_SPI5.mode;
   config.bits        = HW_SPI5.bits;
 
   mico_rtos_lock_mutex( &platform_spi_drivers[HW_SPI5.port].spi_mutex );
-  _platform_lcd_transfer( &platform_spi_drivers[HW_SPI5.port], &config, buf, len );
-  mico_rtos_unlock_mutex( &platform_spi_drivers[HW_SPI5.port].spi_mutex );
+  _platform_lcd_transfer( &platform_spi_drivers[HW_SPI5.port], &config, buf, len, async );
+  // the port stays locked while a DMA block is pending
+  if (!lcd_dma_pending) mico_rtos_unlock_mutex( &platform_spi_drivers[HW_SPI5.port].spi_mutex );
+}
+
+//--------------------------------------------
+void _MicoLcdTransfer( uint8_t* buf, int len )
+{
+  _MicoLcdTransferMode( buf, len, false );
+}
+
+// buf must stay valid until the next LCD transfer or _MicoLcdWait()
+//-------------------------------------------------
+void _MicoLcdTransferAsync( uint8_t* buf, int len )
+{
+  _MicoLcdTransferMode( buf, len, true );
 }
 
 //==============================================================================
@@ -367,19 +537,21 @@ void _swLcdTransfer( uint8_t* buf, int len )
     data = *buf++; // get command
     if (data == 0) break;
 
-    // send command, DC=0
-    MicoGpioOutputLow( (mico_gpio_t)TFT_pinDC );
-    // activate CS
-    MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinCS );
-    if (SW_SPI.speed >= 10) spi_delay();
-
     count--;
-    // --- send command byte ---
-    _swspi_writeByte( data );
+    if (data != LCD_CMD_DATA) {
+      // send command, DC=0
+      MicoGpioOutputLow( (mico_gpio_t)TFT_pinDC );
+      // activate CS
+      MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinCS );
+      if (SW_SPI.speed >= 10) spi_delay();
+
+      // --- send command byte ---
+      _swspi_writeByte( data );
     
-    // deactivate CS
-    MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinCS );
-    if (SW_SPI.speed >= 10) spi_delay();
+      // deactivate CS
+      MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinCS );
+      if (SW_SPI.speed >= 10) spi_delay();
+    }
 
     // get ndata & rep    
     ndata = (uint16_t)(*buf++ << 8);
@@ -589,6 +761,87 @@ static void sw_spi_read(uint8_t databits, uint8_t* databuf, uint16_t count)
   MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinCS );
 }
 
+// Full duplex byte exchange over software SPI, CS is handled by the caller
+//---------------------------------------------------------------------------
+static void sw_spi_transfer(const uint8_t* txbuf, uint8_t* rxbuf, uint32_t count)
+{
+  uint8_t i;
+  uint8_t data, rxdata;
+
+  while (count--) {
+    data = (txbuf != NULL) ? *txbuf++ : 0xFF;
+    rxdata = 0;
+    for(i=0;i<8;i++)
+    {
+      // set clk state before write edge
+      if ((SW_SPI.spiMode == 0) || (SW_SPI.spiMode == 2)) MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinSCK );
+      else MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinSCK );
+
+      // set data bit -> MOSI
+      if((data & 0x80)==0x80) MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinMOSI );
+      else MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinMOSI );
+      if (SW_SPI.speed >= 10) spi_delay();
+
+      // set clk write edge
+      if ((SW_SPI.spiMode == 0) || (SW_SPI.spiMode == 2)) MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinSCK );
+      else MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinSCK );
+      if (SW_SPI.speed >= 10) spi_delay();
+
+      // get data bit <- MISO
+      rxdata=(rxdata<<1);
+      if ((SW_SPI.pinMISO != 255) && MicoGpioInputGet((mico_gpio_t)SW_SPI.pinMISO)) rxdata |= 1;
+
+      data=(data<<1);  // next bit
+    }
+    if (rxbuf != NULL) *rxbuf++ = rxdata;
+  }
+}
+
+// Sends all segments under one chip select. Hardware SPI1 uses DMA for
+// transactions of SPI_DMA_MIN_LENGTH bytes or more. SPI5 is always polled,
+// its RX stream (DMA2_Stream5) is the SPI1 TX stream used by the flash
+// driver, and the two ports do not share a lock.
+//----------------------------------------------------------------------------------------------------
+static OSStatus _spi_transfer_segments(uint8_t id, mico_spi_message_segment_t* segments, uint16_t nseg)
+{
+  mico_spi_device_t* hw;
+  mico_spi_device_t dev;
+  uint32_t total = 0;
+  uint16_t i;
+  OSStatus err;
+
+  if (id == 0) {
+    // set clk inactive state
+    if (SW_SPI.spiMode > 1) MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinSCK );
+    else MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinSCK );
+    // activate CS
+    MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinCS );
+    if (SW_SPI.speed >= 10) spi_delay();
+    for (i=0; i<nseg; i++)
+      sw_spi_transfer((const uint8_t*)segments[i].tx_buffer, (uint8_t*)segments[i].rx_buffer, segments[i].length);
+    // set clk inactive state
+    if (SW_SPI.spiMode > 1) MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinSCK );
+    else MicoGpioOutputLow( (mico_gpio_t)SW_SPI.pinSCK );
+    // deactivate CS
+    MicoGpioOutputHigh( (mico_gpio_t)SW_SPI.pinCS );
+    return kNoErr;
+  }
+
+  hw = (id == 2) ? &HW_SPI5 : &HW_SPI1;
+  for (i=0; i<nseg; i++) total += segments[i].length;
+
+  // MicoSpiTransfer re-initializes the port with dev, SPI1 is shared with the flash
+  dev = *hw;
+  dev.bits = 8;
+  if ((id == 1) && (total >= SPI_DMA_MIN_LENGTH)) dev.mode |= SPI_USE_DMA;
+  else dev.mode &= ~SPI_USE_DMA;
+  err = MicoSpiTransfer(&dev, segments, nseg);
+
+  // spi.write/read do not re-initialize, restore their word size
+  if (hw->bits != 8) MicoSpiInitialize(hw);
+  return err;
+}
+
 //-------------------------------------------------------------------------------------------
 uint16_t _spi_write(uint8_t id, uint8_t databits,uint8_t* data, uint32_t count, uint32_t rep)
 {
@@ -1096,6 +1349,100 @@ static int spi_readbytes( lua_State* L )
   return 1;
 }
 
+//spi.transfer(id,txdata[,rxlen])
+//txdata: string, buffer or table of them, sent back to back under one chip select
+//rxlen:  bytes to clock and return, default #txdata, extra bytes are sent as 0xFF
+//        0 for write only, then the number of bytes written is returned
+//=====================================
+static int spi_transfer( lua_State* L )
+{
+  mico_spi_message_segment_t segments[SPI_MAX_SEGMENTS+1];
+  uint16_t nseg = 0;
+  uint32_t txlen = 0, rxlen, n;
+  uint8_t* rxbuf = NULL;
+  size_t len;
+  const char* pdata;
+  int i;
+
+  uint8_t id = luaL_checkinteger( L, 1 );
+  if ((id !=0) && (id !=1) && (id !=2)) {
+    l_message( NULL, "id should assigend 0,1 or 2" );
+    lua_pushinteger( L, -1 );
+    return 1;
+  }
+  if (!spiInit[id]) {
+    l_message( NULL, "spi not yet initialized" );
+    lua_pushinteger( L, -2 );
+    return 1;
+  }
+
+  if (lua_istable( L, 2 )) {
+    n = lua_objlen( L, 2 );
+    if (n > SPI_MAX_SEGMENTS)
+      return luaL_error( L, "max %d strings", SPI_MAX_SEGMENTS );
+    for (i=1; i<=n; i++) {
+      lua_rawgeti( L, 2, i );
+      pdata = buffer_checklstring( L, -1, &len );
+      lua_pop( L, 1 );  // still referenced by the table
+      if (len == 0) continue;
+      segments[nseg].tx_buffer = pdata;
+      segments[nseg].rx_buffer = NULL;
+      segments[nseg].length = len;
+      nseg++;
+      txlen += len;
+    }
+  }
+  else if (!lua_isnoneornil( L, 2 )) {
+    pdata = buffer_checklstring( L, 2, &len );
+    if (len > 0) {
+      segments[nseg].tx_buffer = pdata;
+      segments[nseg].rx_buffer = NULL;
+      segments[nseg].length = len;
+      nseg++;
+      txlen = len;
+    }
+  }
+
+  i = luaL_optinteger( L, 3, txlen );
+  if (i < 0) return luaL_error( L, "rxlen must be >= 0" );
+  rxlen = i;
+  n = (rxlen > txlen) ? rxlen : txlen;
+  if (n == 0) {
+    if (rxlen == 0 && lua_gettop(L) >= 3) lua_pushinteger( L, 0 );
+    else lua_pushstring( L, "" );
+    return 1;
+  }
+  if (rxlen > txlen) {
+    // clock out the remaining bytes as 0xFF
+    segments[nseg].tx_buffer = NULL;
+    segments[nseg].rx_buffer = NULL;
+    segments[nseg].length = rxlen - txlen;
+    nseg++;
+  }
+
+  if (rxlen > 0) {
+    rxbuf = (uint8_t*)malloc(n);
+    if (rxbuf == NULL) return luaL_error( L, "memory not enough" );
+    len = 0;
+    for (i=0; i<nseg; i++) {
+      segments[i].rx_buffer = rxbuf + len;
+      len += segments[i].length;
+    }
+  }
+
+  if (_spi_transfer_segments(id, segments, nseg) != kNoErr) {
+    if (rxbuf != NULL) free(rxbuf);
+    return luaL_error( L, "spi transfer failed" );
+  }
+
+  if (rxbuf != NULL) {
+    lua_pushlstring( L, (const char*)rxbuf, rxlen );
+    free(rxbuf);
+  }
+  else lua_pushinteger( L, txlen );
+  return 1;
+}
+
 //===================================
 static int spi_deinit( lua_State* L )
 {
@@ -1145,6 +1492,7 @@ const LUA_REG_TYPE spi_map[] =
   { LSTRKEY( "repeatwrite" ), LFUNCVAL( spi_repeatwrite )},
   { LSTRKEY( "read" ), LFUNCVAL( spi_read )},
   { LSTRKEY( "readbytes" ), LFUNCVAL( spi_readbytes )},
+  { LSTRKEY( "transfer" ), LFUNCVAL( spi_transfer )},
   { LSTRKEY( "deinit" ), LFUNCVAL( spi_deinit )},
 #if LUA_OPTIMIZE_MEMORY > 0
   { LSTRKEY( "BITS_8" ), LNUMVAL( BITS_8 ) },
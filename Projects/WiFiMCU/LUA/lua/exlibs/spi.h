@@ -1,6 +1,14 @@
 #ifndef __SPI_H_
 #define __SPI_H_
 
-uint16_t _spi_write(uint8_t id, uint8_t databits,uint8_t data);
+uint16_t _spi_write(uint8_t id, uint8_t databits,uint8_t* data, uint32_t count, uint32_t rep);
+
+// ccbuf pseudo command, data only: continues the previous memory write
+#define LCD_CMD_DATA    0xFF
+
+void _MicoLcdTransfer( uint8_t* buf, int len );
+void _MicoLcdTransferAsync( uint8_t* buf, int len );
+void _MicoLcdWait( void );
+void _swLcdTransfer( uint8_t* buf, int len );
 
 #endif
\ No newline at end of file
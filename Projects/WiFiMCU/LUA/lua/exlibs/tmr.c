@@ -2,6 +2,9 @@
  * tmr.c
  */
 
+#include <string.h>
+#include <stdlib.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
@@ -15,18 +18,335 @@
 
 #define NUM_TMR 16
 
+// All timers, the 16 tmr.start() ids and any number of tmr.create() objects,
+// are kept in one hierarchical timing wheel driven by a single MICO timer.
+// 4 levels of 64 slots, level n slots are 64^n ticks wide. Due times are
+// kept in ms, a timer only waits in the wheel for the tick that covers its
+// next due time, so intervals are not rounded to the tick.
+#define TMR_TICK_MS       10
+#define TMR_WHEEL_BITS    6
+#define TMR_WHEEL_SIZE    (1 << TMR_WHEEL_BITS)
+#define TMR_WHEEL_MASK    (TMR_WHEEL_SIZE-1)
+#define TMR_LEVELS        4
+#define TMR_MAX_TICKS     ((1UL << (TMR_WHEEL_BITS*TMR_LEVELS)) - 1)
+
+#define TMR_ONESHOT       0
+#define TMR_PERIODIC      1
+
+#define TMR_OBJ_NAME      "tmr.timer"
+
 extern mico_queue_t os_queue;
 extern void luaWdgReload( void );
 
+typedef struct tmr_obj {
+  struct tmr_obj  *next;      // wheel slot list
+  struct tmr_obj  **pprev;
+  struct tmr_obj  *dnext;     // dispatch list
+  uint32_t        expires;    // wheel tick
+  uint32_t        at;         // ms from tmr_epoch, next due time
+  uint32_t        interval;   // ms
+  bool            periodic;
+  int             cb_ref;
+  int             self_ref;   // keeps a started timer object alive
+  bool            armed;
+  bool            pending;    // expired, waiting in the dispatch list
+  uint32_t        due;        // ms, time of the expiry being dispatched
+  uint32_t        runs;       // expiries to dispatch, several if interval < tick
+  uint32_t        fired;
+  uint32_t        missed;     // expiries while the previous one was pending
+  uint32_t        maxlate;    // ms, max. dispatch delay
+} tmr_obj_t;
+
 static int platform_tmr_exists( unsigned pin )
 {
   return pin < NUM_TMR;
 }
 
-static int tmr_cb_ref[NUM_TMR];
 static lua_State* gL = NULL;
-static mico_timer_t _timer[NUM_TMR];
-static bool tmr_is_started[NUM_TMR];
+static tmr_obj_t _tmr[NUM_TMR];
+
+static tmr_obj_t *tmr_wheel[TMR_LEVELS][TMR_WHEEL_SIZE];
+static uint32_t tmr_now = 0;          // next tick to process
+static uint32_t tmr_epoch = 0;        // ms of tick 0
+static uint32_t tmr_armed = 0;        // number of armed timers
+static tmr_obj_t *tmr_dhead = NULL;   // expired timers, in expiry order
+static tmr_obj_t *tmr_dtail = NULL;
+static bool tmr_posted = false;       // dispatch message is in the queue
+static mico_timer_t tmr_hw;
+static bool tmr_hw_init = false;
+static bool tmr_hw_running = false;
+static mico_mutex_t tmr_mutex = NULL;
+
+static void _tmr_lock(void)
+{
+  if (tmr_mutex != NULL) mico_rtos_lock_mutex(&tmr_mutex);
+}
+
+static void _tmr_unlock(void)
+{
+  if (tmr_mutex != NULL) mico_rtos_unlock_mutex(&tmr_mutex);
+}
+
+// == Timer wheel, called with the lock held ==
+
+// first tick at or after ms, never before tmr_now
+static uint32_t _tmr_tick_of( uint32_t ms )
+{
+  int32_t d = (int32_t)(ms - (tmr_now * TMR_TICK_MS));
+
+  if (d <= 0) return tmr_now;
+  return tmr_now + (((uint32_t)d + TMR_TICK_MS - 1) / TMR_TICK_MS);
+}
+
+static void _wheel_insert( tmr_obj_t *t )
+{
+  uint32_t delta = t->expires - tmr_now;
+  tmr_obj_t **slot;
+
+  if ((int32_t)delta < 0) slot = &tmr_wheel[0][tmr_now & TMR_WHEEL_MASK];
+  else if (delta < (1UL << TMR_WHEEL_BITS))
+    slot = &tmr_wheel[0][t->expires & TMR_WHEEL_MASK];
+  else if (delta < (1UL << (2*TMR_WHEEL_BITS)))
+    slot = &tmr_wheel[1][(t->expires >> TMR_WHEEL_BITS) & TMR_WHEEL_MASK];
+  else if (delta < (1UL << (3*TMR_WHEEL_BITS)))
+    slot = &tmr_wheel[2][(t->expires >> (2*TMR_WHEEL_BITS)) & TMR_WHEEL_MASK];
+  else
+    slot = &tmr_wheel[3][(t->expires >> (3*TMR_WHEEL_BITS)) & TMR_WHEEL_MASK];
+
+  t->next = *slot;
+  if (t->next != NULL) t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void _wheel_remove( tmr_obj_t *t )
+{
+  *t->pprev = t->next;
+  if (t->next != NULL) t->next->pprev = t->pprev;
+  t->next = NULL;
+  t->pprev = NULL;
+}
+
+static void _dispatch_remove( tmr_obj_t *t )
+{
+  tmr_obj_t **pp = &tmr_dhead;
+  tmr_obj_t *prev = NULL;
+
+  while (*pp != NULL) {
+    if (*pp == t) {
+      *pp = t->dnext;
+      if (tmr_dtail == t) tmr_dtail = prev;
+      break;
+    }
+    prev = *pp;
+    pp = &(*pp)->dnext;
+  }
+  t->dnext = NULL;
+  t->pending = false;
+}
+
+// move all timers of a higher level slot down, returns the slot index
+static uint32_t _wheel_cascade( int level )
+{
+  uint32_t idx = (tmr_now >> (level*TMR_WHEEL_BITS)) & TMR_WHEEL_MASK;
+  tmr_obj_t *t = tmr_wheel[level][idx];
+
+  tmr_wheel[level][idx] = NULL;
+  while (t != NULL) {
+    tmr_obj_t *next = t->next;
+    _wheel_insert(t);
+    t = next;
+  }
+  return idx;
+}
+
+static void _wheel_tick( void )
+{
+  uint32_t idx = tmr_now & TMR_WHEEL_MASK;
+  tmr_obj_t *t;
+  uint32_t due, n;
+  int level;
+
+  for (level = 1; (idx == 0) && (level < TMR_LEVELS); level++) {
+    idx = _wheel_cascade(level);
+  }
+  idx = tmr_now & TMR_WHEEL_MASK;
+
+  t = tmr_wheel[0][idx];
+  tmr_wheel[0][idx] = NULL;
+  while (t != NULL) {
+    tmr_obj_t *next = t->next;
+    t->next = NULL;
+    t->pprev = NULL;
+    // count the due times this tick covers, the next one follows from the
+    // scheduled one, so the period doesn't drift
+    due = t->at;
+    n = 0;
+    do {
+      n++;
+      t->at += t->interval;
+    } while ((t->periodic) && ((int32_t)(t->at - (tmr_now * TMR_TICK_MS)) <= 0));
+    if (t->pending) t->missed += n;
+    else {
+      // all timers expired before the next dispatch share one queue message
+      t->pending = true;
+      t->due = tmr_epoch + due;
+      t->runs = n;
+      t->dnext = NULL;
+      if (tmr_dtail != NULL) tmr_dtail->dnext = t;
+      else tmr_dhead = t;
+      tmr_dtail = t;
+    }
+    if (t->periodic) {
+      t->expires = _tmr_tick_of(t->at);
+      _wheel_insert(t);
+    }
+    else {
+      t->armed = false;
+      tmr_armed--;
+    }
+    t = next;
+  }
+  tmr_now++;
+}
+
+// == Timer interrupt handler =======
+static void _tmr_handler( void* arg )
+{
+  uint32_t target;
+
+  _tmr_lock();
+  // catch up if ticks were delayed
+  target = (mico_get_time() - tmr_epoch) / TMR_TICK_MS;
+  while ((int32_t)(target - tmr_now) >= 0) _wheel_tick();
+
+  if ((tmr_dhead != NULL) && (!tmr_posted)) {
+    queue_msg_t msg;
+    msg.L = gL;
+    msg.source = TMR;
+    msg.para1 = 0;
+    msg.para2 = LUA_NOREF;
+    if (mico_rtos_push_to_queue( &os_queue, &msg, 0) == kNoErr) tmr_posted = true;
+  }
+  _tmr_unlock();
+}
+// ==================================
+
+// start or stop the wheel timer, called from Lua thread without the lock
+static void _tmr_hw_update( void )
+{
+  if ((tmr_armed > 0) && (!tmr_hw_running)) {
+    if (!tmr_hw_init) {
+      mico_init_timer(&tmr_hw, TMR_TICK_MS, _tmr_handler, NULL);
+      tmr_hw_init = true;
+    }
+    mico_start_timer(&tmr_hw);
+    tmr_hw_running = true;
+  }
+  else if ((tmr_armed == 0) && (tmr_hw_running)) {
+    mico_stop_timer(&tmr_hw);
+    tmr_hw_running = false;
+  }
+}
+
+static void _tmr_init( tmr_obj_t *t )
+{
+  memset(t, 0, sizeof(tmr_obj_t));
+  t->cb_ref = LUA_NOREF;
+  t->self_ref = LUA_NOREF;
+}
+
+// stop the timer, func is released if unref is true
+static void _tmr_stop( lua_State* L, tmr_obj_t *t, bool unref )
+{
+  _tmr_lock();
+  if (t->armed) {
+    _wheel_remove(t);
+    t->armed = false;
+    tmr_armed--;
+  }
+  if (t->pending) _dispatch_remove(t);
+  _tmr_unlock();
+
+  if (t->self_ref != LUA_NOREF) {
+    luaL_unref(L, LUA_REGISTRYINDEX, t->self_ref);
+    t->self_ref = LUA_NOREF;
+  }
+  if ((unref) && (t->cb_ref != LUA_NOREF)) {
+    luaL_unref(L, LUA_REGISTRYINDEX, t->cb_ref);
+    t->cb_ref = LUA_NOREF;
+  }
+  _tmr_hw_update();
+}
+
+static void _tmr_arm( tmr_obj_t *t, bool periodic )
+{
+  _tmr_lock();
+  // an idle wheel continues its time from now
+  if (!tmr_hw_running) tmr_epoch = mico_get_time() - (tmr_now * TMR_TICK_MS);
+  if (t->armed) _wheel_remove(t);
+  else tmr_armed++;
+  t->armed = true;
+  t->periodic = periodic;
+  t->at = mico_get_time() - tmr_epoch + t->interval;
+  t->expires = _tmr_tick_of(t->at);
+  _wheel_insert(t);
+  _tmr_unlock();
+  _tmr_hw_update();
+}
+
+// execute the functions of all expired timers, one queue message
+//-----------------------------------
+void _tmr_dispatch( lua_State* L )
+{
+  tmr_obj_t *t;
+  uint32_t late, runs;
+  int nargs;
+
+  _tmr_lock();
+  tmr_posted = false;
+  _tmr_unlock();
+
+  for (;;) {
+    _tmr_lock();
+    t = tmr_dhead;
+    if (t != NULL) {
+      tmr_dhead = t->dnext;
+      if (tmr_dhead == NULL) tmr_dtail = NULL;
+      t->dnext = NULL;
+      t->pending = false;
+      runs = t->runs;
+    }
+    _tmr_unlock();
+    if (t == NULL) break;
+
+    late = mico_get_time() - t->due;
+    if (late > t->maxlate) t->maxlate = late;
+
+    // an interval below the tick has several expiries per tick, the
+    // callback runs for each until it stops the timer
+    while (runs-- > 0) {
+      t->fired++;
+      if (t->cb_ref == LUA_NOREF) break;
+      lua_rawgeti(L, LUA_REGISTRYINDEX, t->cb_ref);
+      nargs = 0;
+      if (t->self_ref != LUA_NOREF) {
+        // timer object is the argument
+        lua_rawgeti(L, LUA_REGISTRYINDEX, t->self_ref);
+        nargs = 1;
+        if (!t->armed) {
+          // one shot timer is done, object is now only held by the stack
+          luaL_unref(L, LUA_REGISTRYINDEX, t->self_ref);
+          t->self_ref = LUA_NOREF;
+        }
+      }
+      lua_call(L, nargs, 0);
+      // t may be collected once the stack no longer holds it
+      if (!t->armed) break;
+    }
+  }
+  _tmr_hw_update();
+}
 
 //tmr.tick()
 static int ltmr_tick( lua_State* L )
@@ -41,29 +361,35 @@ static int ltmr_stop( lua_State* L )
 {
   unsigned id = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( tmr, id );
-  if(tmr_is_started[id]==true)
-    mico_stop_timer(&_timer[id]);
-  tmr_is_started[id]=false;
-  if(tmr_cb_ref[id] != LUA_NOREF)
-   {
-     luaL_unref(L, LUA_REGISTRYINDEX, tmr_cb_ref[id]);
-   }
-    tmr_cb_ref[id] = LUA_NOREF;
+  _tmr_stop(L, &_tmr[id], true);
   return 0;
 }
+
+// first armed or pending timer, the wheel is scanned with the lock held
+static tmr_obj_t *_tmr_first( void )
+{
+  tmr_obj_t *t = NULL;
+  int i, j;
+
+  _tmr_lock();
+  for (i=0; (t == NULL) && (i<TMR_LEVELS); i++) {
+    for (j=0; (t == NULL) && (j<TMR_WHEEL_SIZE); j++) t = tmr_wheel[i][j];
+  }
+  if (t == NULL) t = tmr_dhead;
+  _tmr_unlock();
+  return t;
+}
+
+// stop all timers, also tmr.create() timers
 static int ltmr_stopall( lua_State* L )
 {
-  for(int i=0;i<NUM_TMR;i++)
+  tmr_obj_t *t;
+  int i;
+  for(i=0;i<NUM_TMR;i++)
   {
-    if(tmr_is_started[i]==true)
-      mico_stop_timer(&_timer[i]);
-    tmr_is_started[i]=false;
-    if(tmr_cb_ref[i] != LUA_NOREF)
-    {
-      luaL_unref(L, LUA_REGISTRYINDEX, tmr_cb_ref[i]);
-    }
-    tmr_cb_ref[i] = LUA_NOREF;
+    _tmr_stop(L, &_tmr[i], true);
   }
+  while ((t = _tmr_first()) != NULL) _tmr_stop(L, t, false);
   return 0;
 }
 //tmr.delayms()
@@ -92,21 +418,13 @@ static int ltmr_wdclr( lua_State* L )
   return 0;
 }
 
-// == Timer interrupt handler =======
-static void _tmr_handler( void* arg )
+static unsigned _tmr_check_interval( lua_State* L, int index )
 {
-  unsigned id = (unsigned)arg;
-  if(id<NUM_TMR)
-  {
-    queue_msg_t msg;
-    msg.L = gL;
-    msg.source = TMR;
-    //msg.para1 = tmr_cb_ref[id];
-    msg.para2 = tmr_cb_ref[id];
-    mico_rtos_push_to_queue( &os_queue, &msg,0);
-  }
+  int interval = luaL_checkinteger( L, index );
+  if (( interval <= 0 ) || ( (uint32_t)interval > ((TMR_MAX_TICKS - 1) * TMR_TICK_MS) ))
+    luaL_error( L, "wrong arg range" );
+  return (unsigned)interval;
 }
-// ==================================
 
 //tmr.start(id,interval,function)
 //id:0~15
@@ -115,25 +433,16 @@ static int ltmr_start( lua_State* L )
   unsigned id = luaL_checkinteger( L, 1 );
   MOD_CHECK_ID( tmr, id);
   
-  unsigned interval = luaL_checkinteger( L, 2 );
-  if ( interval <= 0 ) 
-    return luaL_error( L, "wrong arg range" );
+  unsigned interval = _tmr_check_interval( L, 2 );
   
   if (lua_type(L, 3) == LUA_TFUNCTION || lua_type(L, 3) == LUA_TLIGHTFUNCTION)
   {
+    _tmr_stop(L, &_tmr[id], true);
     lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
-    if(tmr_cb_ref[id] != LUA_NOREF)
-    {
-      luaL_unref(L, LUA_REGISTRYINDEX, tmr_cb_ref[id]);
-    }
     gL = L;
-    tmr_cb_ref[id] = luaL_ref(L, LUA_REGISTRYINDEX);
-
-    mico_stop_timer(&_timer[id]);
-    mico_deinit_timer( &_timer[id] );
-    mico_init_timer(&_timer[id], interval, _tmr_handler, (void*)id);
-    mico_start_timer(&_timer[id]);    
-    tmr_is_started[id] = true;   
+    _tmr[id].cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    _tmr[id].interval = interval;
+    _tmr_arm(&_tmr[id], true);
   }
   else
     return luaL_error( L, "callback function needed" );
@@ -141,6 +450,114 @@ static int ltmr_start( lua_State* L )
   return 0;
 }
 
+// == Timer objects ==
+
+typedef struct {
+  tmr_obj_t *t;
+  uint8_t   mode;
+} tmr_ud_t;
+
+static tmr_ud_t* _tmr_check_ud( lua_State* L )
+{
+  tmr_ud_t *ud = (tmr_ud_t*)luaL_checkudata(L, 1, TMR_OBJ_NAME);
+  if (ud->t == NULL) luaL_error( L, "timer is freed" );
+  return ud;
+}
+
+//t = tmr.create(interval,function[,tmr.ONESHOT|tmr.PERIODIC])
+//function(t) is called on expiry, the timer is started with t:start()
+static int ltmr_create( lua_State* L )
+{
+  unsigned interval = _tmr_check_interval( L, 1 );
+  uint8_t mode = TMR_PERIODIC;
+
+  if (lua_type(L, 2) != LUA_TFUNCTION && lua_type(L, 2) != LUA_TLIGHTFUNCTION)
+    return luaL_error( L, "callback function needed" );
+  if (lua_gettop(L) > 2) {
+    mode = luaL_checkinteger( L, 3 );
+    if ((mode != TMR_ONESHOT) && (mode != TMR_PERIODIC))
+      return luaL_error( L, "wrong arg range" );
+  }
+
+  tmr_ud_t *ud = (tmr_ud_t*)lua_newuserdata(L, sizeof(tmr_ud_t));
+  ud->t = NULL;
+  ud->mode = mode;
+  luaL_getmetatable(L, TMR_OBJ_NAME);
+  lua_setmetatable(L, -2);
+
+  ud->t = (tmr_obj_t*)malloc(sizeof(tmr_obj_t));
+  if (ud->t == NULL) return luaL_error( L, "memory not enough" );
+  _tmr_init(ud->t);
+  ud->t->interval = interval;
+  lua_pushvalue(L, 2);
+  ud->t->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 1;
+}
+
+//t:start([interval])
+static int ltmr_obj_start( lua_State* L )
+{
+  tmr_ud_t *ud = _tmr_check_ud(L);
+
+  if (lua_gettop(L) > 1) ud->t->interval = _tmr_check_interval( L, 2 );
+  if (ud->t->self_ref == LUA_NOREF) {
+    lua_pushvalue(L, 1);
+    ud->t->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  gL = L;
+  _tmr_arm(ud->t, (ud->mode == TMR_PERIODIC));
+  return 0;
+}
+
+//t:stop()
+static int ltmr_obj_stop( lua_State* L )
+{
+  tmr_ud_t *ud = _tmr_check_ud(L);
+  _tmr_stop(L, ud->t, false);
+  return 0;
+}
+
+//running = t:state()
+static int ltmr_obj_state( lua_State* L )
+{
+  tmr_ud_t *ud = _tmr_check_ud(L);
+  lua_pushboolean(L, ud->t->armed);
+  return 1;
+}
+
+//fired, missed, maxlate = t:stats()
+static int ltmr_obj_stats( lua_State* L )
+{
+  tmr_ud_t *ud = _tmr_check_ud(L);
+  lua_pushinteger(L, ud->t->fired);
+  lua_pushinteger(L, ud->t->missed);
+  lua_pushinteger(L, ud->t->maxlate);
+  return 3;
+}
+
+static int ltmr_obj_gc( lua_State* L )
+{
+  tmr_ud_t *ud = (tmr_ud_t*)luaL_checkudata(L, 1, TMR_OBJ_NAME);
+  if (ud->t != NULL) {
+    _tmr_stop(L, ud->t, true);
+    free(ud->t);
+    ud->t = NULL;
+  }
+  return 0;
+}
+
+#define MIN_OPT_LEVEL       1
+#include "lrodefs.h"
+const LUA_REG_TYPE tmr_obj_map[] =
+{
+  { LSTRKEY( "start" ), LFUNCVAL( ltmr_obj_start ) },
+  { LSTRKEY( "stop" ), LFUNCVAL( ltmr_obj_stop ) },
+  { LSTRKEY( "state" ), LFUNCVAL( ltmr_obj_state ) },
+  { LSTRKEY( "stats" ), LFUNCVAL( ltmr_obj_stats ) },
+  {LNILKEY, LNILVAL}
+};
+
+#undef MIN_OPT_LEVEL
 #define MIN_OPT_LEVEL       2
 #include "lrodefs.h"
 const LUA_REG_TYPE tmr_map[] =
@@ -151,8 +568,11 @@ const LUA_REG_TYPE tmr_map[] =
   { LSTRKEY( "start" ), LFUNCVAL( ltmr_start ) },
   { LSTRKEY( "stop" ), LFUNCVAL( ltmr_stop ) },
   { LSTRKEY( "stopall" ), LFUNCVAL( ltmr_stopall ) },
+  { LSTRKEY( "create" ), LFUNCVAL( ltmr_create ) },
   { LSTRKEY( "wdclr" ), LFUNCVAL( ltmr_wdclr) },
 #if LUA_OPTIMIZE_MEMORY > 0
+  { LSTRKEY( "ONESHOT" ), LNUMVAL( TMR_ONESHOT ) },
+  { LSTRKEY( "PERIODIC" ), LNUMVAL( TMR_PERIODIC ) },
 #endif   
   {LNILKEY, LNILVAL}
 };
@@ -160,15 +580,38 @@ const LUA_REG_TYPE tmr_map[] =
 LUALIB_API int luaopen_tmr(lua_State *L)
 {
   for(int i=0;i<NUM_TMR;i++){
-    tmr_cb_ref[i] = LUA_NOREF;
-    tmr_is_started[i] = false;
+    _tmr_init(&_tmr[i]);
   }
+  if (tmr_mutex == NULL) mico_rtos_init_mutex(&tmr_mutex);
+  luaL_newmetatable(L, TMR_OBJ_NAME);
+  lua_pushcfunction(L, ltmr_obj_gc);
+  lua_setfield(L, -2, "__gc");
 #if LUA_OPTIMIZE_MEMORY > 0
-    return 0;
+  lua_pushrotable(L, (void*)tmr_obj_map);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
+  return 0;
 #else
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, tmr_obj_map);
+  lua_pop(L, 1);
   luaL_register( L, EXLIB_TMR, tmr_map );
+  MOD_REG_NUMBER( L, "ONESHOT", TMR_ONESHOT );
+  MOD_REG_NUMBER( L, "PERIODIC", TMR_PERIODIC );
   return 1;
 #endif
 }
 
-
+LUALIB_API int luaclose_tmr(lua_State *L)
+{
+  ltmr_stopall(L);
+  if (tmr_hw_init) {
+    mico_stop_timer(&tmr_hw);
+    mico_deinit_timer(&tmr_hw);
+    tmr_hw_init = false;
+    tmr_hw_running = false;
+  }
+  tmr_posted = false;
+  return 0;
+}
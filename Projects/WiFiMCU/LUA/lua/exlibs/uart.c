@@ -656,8 +656,7 @@ static int uart_send( lua_State* L )
     }
     else
     {
-      luaL_checktype( L, s, LUA_TSTRING );
-      buf = lua_tolstring( L, s, &len );
+      buf = buffer_checklstring( L, s, &len );
       if (id == 1) {
         MicoUartSend( LUA_USR_UART, buf,len);
       }
@@ -24,6 +24,8 @@
 #define USE_RTC_MODULE
 // #define USE_OLED_MODULE
 #define USE_MQTT_MODULE
+#define USE_JSON_MODULE
+#define USE_BUFFER_MODULE
 //#define USE_FTP_MODULE
 
 #define MOD_REG_NUMBER( L, name, val )\
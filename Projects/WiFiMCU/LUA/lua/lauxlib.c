@@ -415,7 +415,7 @@ LUALIB_API const char *luaL_findtable (lua_State *L, int idx,
     lua_rawget(L, -2);
     if (lua_isnil(L, -1)) {
       /* If looking for a global variable, check the rotables too */
-      void *ptable = luaR_findglobal(fname, e - fname);
+      void *ptable = luaR_findglobal(L, fname, e - fname);
       if (ptable) {
         lua_pop(L, 1);
         lua_pushrotable(L, ptable);
@@ -561,7 +561,7 @@ static int luaB_index(lua_State *L) {
     lua_pushliteral(L, LUA_VERSION);
     return 1;
   }
-  void *res = luaR_findglobal(keyname, strlen(keyname));
+  void *res = luaR_findglobal(L, keyname, strlen(keyname));
   if (!res)
     return 0;
   else {
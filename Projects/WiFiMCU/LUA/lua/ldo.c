@@ -502,6 +502,8 @@ struct SParser {  /* data to `f_parser' */
   ZIO *z;
   Mbuffer buff;  /* buffer to be used by the scanner */
   const char *name;
+  luaY_CloseHook hook;  /* see luaY_parser_hook */
+  void *hookud;
 };
 
 static void f_parser (lua_State *L, void *ud) {
@@ -512,8 +514,10 @@ static void f_parser (lua_State *L, void *ud) {
   int c = luaZ_lookahead(p->z);
   luaC_checkGC(L);
   set_block_gc(L);  /* stop collector during parsing */
-  tf = ((c == LUA_SIGNATURE[0]) ? luaU_undump : luaY_parser)(L, p->z,
-                                                             &p->buff, p->name);
+  if (c == LUA_SIGNATURE[0])
+    tf = luaU_undump(L, p->z, &p->buff, p->name);
+  else
+    tf = luaY_parser_hook(L, p->z, &p->buff, p->name, p->hook, p->hookud);
   cl = luaF_newLclosure(L, tf->nups, hvalue(gt(L)));
   cl->l.p = tf;
   for (i = 0; i < tf->nups; i++)  /* initialize eventual upvalues */
@@ -525,9 +529,16 @@ static void f_parser (lua_State *L, void *ud) {
 
 
 int luaD_protectedparser (lua_State *L, ZIO *z, const char *name) {
+  return luaD_protectedparser_hook(L, z, name, NULL, NULL);
+}
+
+
+int luaD_protectedparser_hook (lua_State *L, ZIO *z, const char *name,
+                               luaY_CloseHook hook, void *ud) {
   struct SParser p;
   int status;
   p.z = z; p.name = name;
+  p.hook = hook; p.hookud = ud;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
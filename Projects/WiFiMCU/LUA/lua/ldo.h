@@ -9,6 +9,7 @@
 
 
 #include "lobject.h"
+#include "lparser.h"
 #include "lstate.h"
 #include "lzio.h"
 
@@ -38,6 +39,8 @@
 typedef void (*Pfunc) (lua_State *L, void *ud);
 
 LUAI_FUNC int luaD_protectedparser (lua_State *L, ZIO *z, const char *name);
+LUAI_FUNC int luaD_protectedparser_hook (lua_State *L, ZIO *z, const char *name,
+                                         luaY_CloseHook hook, void *ud);
 LUAI_FUNC void luaD_callhook (lua_State *L, int event, int line);
 LUAI_FUNC int luaD_precall (lua_State *L, StkId func, int nresults);
 LUAI_FUNC void luaD_call (lua_State *L, StkId func, int nResults);
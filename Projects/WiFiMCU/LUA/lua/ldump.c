@@ -196,10 +196,9 @@ static void DumpString(const TString* s, DumpState* D)
 
 static void DumpFunction(const Proto* f, const TString* p, DumpState* D);
 
-static void DumpConstants(const Proto* f, DumpState* D)
+static void DumpConstantValues(const Proto* f, DumpState* D)
 {
  int i,n=f->sizek;
- DumpInt(n,D);
  for (i=0; i<n; i++)
  {
   const TValue* o=&f->k[i];
@@ -222,6 +221,13 @@ static void DumpConstants(const Proto* f, DumpState* D)
 	break;
   }
  }
+}
+
+static void DumpConstants(const Proto* f, DumpState* D)
+{
+ int i,n=f->sizek;
+ DumpInt(n,D);
+ DumpConstantValues(f,D);
  n=f->sizep;
  DumpInt(n,D);
  for (i=0; i<n; i++) DumpFunction(f->p[i],f->source,D);
@@ -286,6 +292,63 @@ static void DumpHeader(DumpState* D)
  DumpBlock(buf,LUAC_HEADERSIZE,D);
 }
 
+static int NullWriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ UNUSED(L); UNUSED(p); UNUSED(size); UNUSED(u);
+ return 0;
+}
+
+/*
+** Dump the main function whose nested functions were already written by
+** luaU_dump_proto into a stream starting at offset 0. That stream is copied
+** in place of f->p; nil constants are appended as padding so that it lands
+** on the same 4 byte alignment it was dumped with.
+*/
+static void DumpMainStreamed(const Proto* f, lua_Reader r, void* rdata, DumpState* D)
+{
+ DumpState M=*D;
+ int i,pad;
+ DumpString(D->strip ? NULL : f->source,D);
+ DumpInt(f->linedefined,D);
+ DumpInt(f->lastlinedefined,D);
+ DumpChar(f->nups,D);
+ DumpChar(f->numparams,D);
+ DumpChar(f->is_vararg,D);
+ DumpChar(f->maxstacksize,D);
+ DumpCode(f,D);
+ /* measure constants to find the padding needed before the nested functions */
+ M.writer=NullWriter;
+ M.wrote=D->wrote+D->target.sizeof_int;
+ DumpConstantValues(f,&M);
+ pad=(int)((4-((M.wrote+D->target.sizeof_int)&3))&3);
+ DumpInt(f->sizek+pad,D);
+ DumpConstantValues(f,D);
+ for (i=0; i<pad; i++) DumpChar(LUA_TNIL,D);
+ DumpInt(f->sizep,D);
+ lua_assert((D->wrote&3)==0);
+ for (;;)
+ {
+  size_t size;
+  const char* b;
+  if (D->status!=0) break;
+  b=(*r)(D->L,rdata,&size);
+  if (b==NULL || size==0) break;
+  DumpBlock(b,size,D);
+ }
+ DumpDebug(f,D);
+}
+
+static void LocalTarget(DumpTargetInfo* target)
+{
+ int test=1;
+ target->little_endian=*(char*)&test;
+ target->sizeof_int=sizeof(int);
+ target->sizeof_strsize_t=sizeof(strsize_t);
+ target->sizeof_lua_Number=sizeof(lua_Number);
+ target->lua_Number_integral=(((lua_Number)0.5)==0);
+ target->is_arm_fpa=0;
+}
+
 /*
 ** dump Lua function as precompiled chunk with specified target
 */
@@ -310,12 +373,44 @@ int luaU_dump_crosscompile (lua_State* L, const Proto* f, lua_Writer w, void* da
 int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip)
 {
  DumpTargetInfo target;
- int test=1;
- target.little_endian=*(char*)&test;
- target.sizeof_int=sizeof(int);
- target.sizeof_strsize_t=sizeof(strsize_t);
- target.sizeof_lua_Number=sizeof(lua_Number);
- target.lua_Number_integral=(((lua_Number)0.5)==0);
- target.is_arm_fpa=0;
+ LocalTarget(&target);
  return luaU_dump_crosscompile(L,f,w,data,strip,target);
 }
+
+/*
+** dump a single nested function (no header) with local machine as target;
+** *wrote is the offset of the output stream and is updated
+*/
+int luaU_dump_proto (lua_State* L, const Proto* f, const TString* source, lua_Writer w, void* data, int strip, size_t* wrote)
+{
+ DumpState D;
+ D.L=L;
+ D.writer=w;
+ D.data=data;
+ D.strip=strip;
+ D.status=0;
+ LocalTarget(&D.target);
+ D.wrote=*wrote;
+ DumpFunction(f,source,&D);
+ *wrote=D.wrote;
+ return D.status;
+}
+
+/*
+** dump main function as precompiled chunk with local machine as target,
+** reading its nested functions from a stream made by luaU_dump_proto
+*/
+int luaU_dump_streamed (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, lua_Reader r, void* rdata)
+{
+ DumpState D;
+ D.L=L;
+ D.writer=w;
+ D.data=data;
+ D.strip=strip;
+ D.status=0;
+ LocalTarget(&D.target);
+ D.wrote=0;
+ DumpHeader(&D);
+ DumpMainStreamed(f,r,rdata,&D);
+ return D.status;
+}
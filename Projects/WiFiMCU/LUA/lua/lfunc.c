@@ -151,6 +151,32 @@ void luaF_freeproto (lua_State *L, Proto *f) {
 }
 
 
+/*
+** Free the body of a prototype (and of its nested prototypes) that is no
+** longer needed, e.g. after it was dumped by a streaming compile. The header
+** stays valid so the object is still collected normally.
+*/
+void luaF_releaseproto (lua_State *L, Proto *f) {
+  int i;
+  for (i = 0; i < f->sizep; i++)
+    luaF_releaseproto(L, f->p[i]);
+  luaM_freearray(L, f->p, f->sizep, Proto *);
+  luaM_freearray(L, f->k, f->sizek, TValue);
+  luaM_freearray(L, f->locvars, f->sizelocvars, struct LocVar);
+  luaM_freearray(L, f->upvalues, f->sizeupvalues, TString *);
+  if (!proto_is_readonly(f)) {
+    luaM_freearray(L, f->code, f->sizecode, Instruction);
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo, int);
+  }
+  f->p = NULL; f->sizep = 0;
+  f->k = NULL; f->sizek = 0;
+  f->locvars = NULL; f->sizelocvars = 0;
+  f->upvalues = NULL; f->sizeupvalues = 0;
+  f->code = NULL; f->sizecode = 0;
+  f->lineinfo = NULL; f->sizelineinfo = 0;
+}
+
+
 void luaF_freeclosure (lua_State *L, Closure *c) {
   int size = (c->c.isC) ? sizeCclosure(c->c.nupvalues) :
                           sizeLclosure(c->l.nupvalues);
@@ -197,6 +197,12 @@ extern const luaR_entry mqtt_map[];
 #ifdef USE_FTP_MODULE
 extern const luaR_entry ftp_map[];
 #endif
+#ifdef USE_JSON_MODULE
+extern const luaR_entry json_map[];
+#endif
+#ifdef USE_BUFFER_MODULE
+extern const luaR_entry buffer_map[];
+#endif
 
 
 const luaR_table lua_rotable[] = 
@@ -207,58 +213,64 @@ const luaR_table lua_rotable[] =
     {LUA_TABLIBNAME, tab_funcs},
 #if LUA_OPTIMIZE_MEMORY > 0
 #ifdef USE_ADC_MODULE
-    {LUA_ADCLIBNAME, adc_map},
+    {LUA_ADCLIBNAME, adc_map, luaopen_adc, luaclose_adc},
 #endif
 #ifdef USE_GPIO_MODULE
-    {LUA_GPIOLIBNAME, gpio_map},
+    {LUA_GPIOLIBNAME, gpio_map, luaopen_gpio, luaclose_gpio},
 #endif
 #ifdef USE_MCU_MODULE
-    {LUA_MCULIBNAME, mcu_map},
+    {LUA_MCULIBNAME, mcu_map, luaopen_mcu, NULL},
 #endif
 #ifdef USE_WIFI_MODULE
-    {LUA_WIFILIBNAME, wifi_map},
+    {LUA_WIFILIBNAME, wifi_map, luaopen_wifi, NULL},
 #endif
 #ifdef USE_FILE_MODULE
-    {LUA_FILELIBNAME, file_map},
+    {LUA_FILELIBNAME, file_map, luaopen_file, NULL},
 #endif    
 #ifdef USE_I2C_MODULE
-    {LUA_I2CLIBNAME, i2c_map},
+    {LUA_I2CLIBNAME, i2c_map, luaopen_i2c, luaclose_i2c},
 #endif
 #ifdef USE_NET_MODULE
-    {LUA_NETLIBNAME, net_map},
+    {LUA_NETLIBNAME, net_map, luaopen_net, luaclose_net},
 #endif
 #ifdef USE_PWM_MODULE
-    {LUA_PWMLIBNAME, pwm_map},
+    {LUA_PWMLIBNAME, pwm_map, luaopen_pwm, luaclose_pwm},
 #endif
 #ifdef USE_SPI_MODULE
-    {LUA_SPILIBNAME, spi_map},
+    {LUA_SPILIBNAME, spi_map, luaopen_spi, NULL},
 #endif
 #ifdef USE_TMR_MODULE
-    {LUA_TMRLIBNAME, tmr_map},
+    {LUA_TMRLIBNAME, tmr_map, luaopen_tmr, luaclose_tmr},
 #endif
 #ifdef USE_UART_MODULE
-    {LUA_UARTLIBNAME, uart_map},
+    {LUA_UARTLIBNAME, uart_map, luaopen_uart, NULL},
 #endif
 #ifdef USE_BIT_MODULE
-    {LUA_BITLIBNAME, bit_map},
+    {LUA_BITLIBNAME, bit_map, luaopen_bit, NULL},
 #endif    
 #ifdef USE_SENSOR_MODULE
-    {LUA_SENSORLIBNAME, sensor_map},
+    {LUA_SENSORLIBNAME, sensor_map, luaopen_sensor, luaclose_sensor},
 #endif    
 #ifdef USE_RTC_MODULE
-    {LUA_RTCLIBNAME, rtc_map},
+    {LUA_RTCLIBNAME, rtc_map, luaopen_rtc, NULL},
 #endif    
 #ifdef USE_OLED_MODULE
-    {LUA_OLEDLIBNAME, oled_map},
+    {LUA_OLEDLIBNAME, oled_map, luaopen_oled, NULL},
 #endif    
 #ifdef USE_LCD_MODULE
-    {LUA_LCDLIBNAME, lcd_map},
+    {LUA_LCDLIBNAME, lcd_map, luaopen_lcd, NULL},
 #endif    
 #ifdef USE_MQTT_MODULE
-    {LUA_MQTTLIBNAME, mqtt_map},
+    {LUA_MQTTLIBNAME, mqtt_map, luaopen_mqtt, luaclose_mqtt},
 #endif    
 #ifdef USE_FTP_MODULE
-    {LUA_FTPLIBNAME, ftp_map},
+    {LUA_FTPLIBNAME, ftp_map, luaopen_ftp, NULL},
+#endif    
+#ifdef USE_JSON_MODULE
+    {LUA_JSONLIBNAME, json_map, luaopen_json, NULL},
+#endif    
+#ifdef USE_BUFFER_MODULE
+    {LUA_BUFFERLIBNAME, buffer_map, luaopen_buffer, NULL},
 #endif    
     
     
@@ -280,6 +292,9 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
       lua_pushstring(L, lib->name);
       lua_call(L, 1, 0);
     }
+#if LUA_OPTIMIZE_MEMORY == 0
+  /* With rotables the exlibs are initialized by luaR_findglobal on their
+     first use instead, see the hooks in lua_rotable above */
 #ifdef USE_ADC_MODULE
   luaopen_adc(L);
 #endif
@@ -347,5 +362,13 @@ LUALIB_API void luaL_openlibs (lua_State *L) {
 #ifdef USE_FTP_MODULE
   luaopen_ftp(L);
 #endif
-}
 
+#ifdef USE_JSON_MODULE
+  luaopen_json(L);
+#endif
+
+#ifdef USE_BUFFER_MODULE
+  luaopen_buffer(L);
+#endif
+#endif
+}
@@ -64,6 +64,8 @@ typedef struct LexState {
   Mbuffer *buff;  /* buffer for tokens */
   TString *source;  /* current source name */
   char decpoint;  /* locale decimal point */
+  void (*closehook) (struct lua_State *L, Proto *f, void *ud);  /* see luaY_parser_hook */
+  void *closeud;  /* user data for `closehook' */
 } LexState;
 
 
@@ -466,7 +466,7 @@ static int ll_require (lua_State *L) {
     return 1;  /* package is already loaded */
   }
   /* Is this a readonly table? */
-  void *res = luaR_findglobal(name, strlen(name));
+  void *res = luaR_findglobal(L, name, strlen(name));
   if (res) {
     lua_pushrotable(L, res);
     return 1;
@@ -555,7 +555,7 @@ static void modinit (lua_State *L, const char *modname) {
 
 static int ll_module (lua_State *L) {
   const char *modname = luaL_checkstring(L, 1);
-  if (luaR_findglobal(modname, strlen(modname)))
+  if (luaR_findglobal(L, modname, strlen(modname)))
     return 0;
   int loaded = lua_gettop(L) + 1;  /* index of _LOADED table */
   lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
@@ -373,6 +373,8 @@ static void close_func (LexState *ls) {
   f->sizeupvalues = f->nups;
   lua_assert(luaG_checkcode(f));
   lua_assert(fs->bl == NULL);
+  if (ls->closehook && fs->prev && fs->prev->prev == NULL)
+    (*ls->closehook)(L, f, ls->closeud);  /* whole subtree is final now */
   ls->fs = fs->prev;
   /* last token read was anchored in defunct function; must reanchor it */
   if (fs) anchor_token(ls);
@@ -381,12 +383,26 @@ static void close_func (LexState *ls) {
 
 
 Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff, const char *name) {
+  return luaY_parser_hook(L, z, buff, name, NULL, NULL);
+}
+
+
+/*
+** Parse with a hook called for every function closed directly inside the
+** main chunk. The hook may write out the function and release its body with
+** luaF_releaseproto: the parser does not look at it again, so peak memory
+** is bounded by the largest top level function instead of the whole chunk.
+*/
+Proto *luaY_parser_hook (lua_State *L, ZIO *z, Mbuffer *buff,
+                         const char *name, luaY_CloseHook hook, void *ud) {
   struct LexState lexstate;
   struct FuncState funcstate;
   TString *tname = luaS_new(L, name);
   setsvalue2s(L, L->top, tname);  /* protect name */
   incr_top(L);
   lexstate.buff = buff;
+  lexstate.closehook = hook;
+  lexstate.closeud = ud;
   luaX_setinput(L, &lexstate, z, tname);
   open_func(&lexstate, &funcstate);
   funcstate.f->is_vararg = VARARG_ISVARARG;  /* main func. is always vararg */
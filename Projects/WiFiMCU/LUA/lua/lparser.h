@@ -75,8 +75,14 @@ typedef struct FuncState {
 } FuncState;
 
 
+/* called each time a function nested directly in the main chunk is closed */
+typedef void (*luaY_CloseHook) (lua_State *L, Proto *f, void *ud);
+
 LUAI_FUNC Proto *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                                             const char *name);
+LUAI_FUNC Proto *luaY_parser_hook (lua_State *L, ZIO *z, Mbuffer *buff,
+                                   const char *name, luaY_CloseHook hook,
+                                   void *ud);
 
 
 #endif
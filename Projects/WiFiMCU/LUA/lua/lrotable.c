@@ -15,17 +15,54 @@
 /* Externally defined read-only table array */
 extern const luaR_table lua_rotable[];
 
-/* Find a global "read only table" in the constant lua_rotable array */
-void* luaR_findglobal(const char *name, unsigned len) {
-  unsigned i;    
-  
+/* Modules whose init hook already ran, bit i is lua_rotable[i] */
+static unsigned long luaR_opened = 0;
+
+static int luaR_findindex(const char *name, unsigned len) {
+  unsigned i;
+
   if (strlen(name) > LUA_MAX_ROTABLE_NAME)
-    return NULL;
+    return -1;
   for (i=0; lua_rotable[i].name; i ++)
-    if (*lua_rotable[i].name != '\0' && strlen(lua_rotable[i].name) == len && !strncmp(lua_rotable[i].name, name, len)) {
-      return (void*)(lua_rotable[i].pentries);
-    }
-  return NULL;
+    if (*lua_rotable[i].name != '\0' && strlen(lua_rotable[i].name) == len && !strncmp(lua_rotable[i].name, name, len))
+      return i;
+  return -1;
+}
+
+/* Find a global "read only table" in the constant lua_rotable array,
+   running the module init hook on the first lookup */
+void* luaR_findglobal(lua_State *L, const char *name, unsigned len) {
+  int i = luaR_findindex(name, len);
+
+  if (i < 0)
+    return NULL;
+  if (lua_rotable[i].openf && i < LUA_MAX_ROTABLE_MODULES && !(luaR_opened & (1UL << i))) {
+    int top = lua_gettop(L);
+    luaR_opened |= 1UL << i;  /* before the call, the hook may look itself up */
+    lua_rotable[i].openf(L);
+    lua_settop(L, top);
+  }
+  return (void*)(lua_rotable[i].pentries);
+}
+
+/* Release the resources of a module; its init hook runs again on the next
+   lookup. Returns 1 if the module was initialized. */
+int luaR_unload(lua_State *L, const char *name) {
+  int i = luaR_findindex(name, strlen(name));
+  unsigned long bit;
+
+  if (i < 0 || i >= LUA_MAX_ROTABLE_MODULES)
+    return 0;
+  bit = 1UL << i;
+  if (!(luaR_opened & bit))
+    return 0;
+  luaR_opened &= ~bit;
+  if (lua_rotable[i].closef) {
+    int top = lua_gettop(L);
+    lua_rotable[i].closef(L);
+    lua_settop(L, top);
+  }
+  return 1;
 }
 
 /* Find an entry in a rotable and return it */
@@ -61,9 +61,15 @@ typedef struct
 {
   const char *name;
   const luaR_entry *pentries;
+  lua_CFunction openf;   /* module init, run on first lookup (may be NULL) */
+  lua_CFunction closef;  /* releases module resources on unload (may be NULL) */
 } luaR_table;
 
-void* luaR_findglobal(const char *key, unsigned len);
+/* Maximum number of entries in lua_rotable with lazy init hooks */
+#define LUA_MAX_ROTABLE_MODULES   32
+
+void* luaR_findglobal(lua_State *L, const char *key, unsigned len);
+int luaR_unload(lua_State *L, const char *name);
 int luaR_findfunction(lua_State *L, const luaR_entry *ptable);
 const TValue* luaR_findentry(void *data, const char *strkey, luaR_numkey numkey, unsigned *ppos);
 void luaR_getcstr(char *dest, const TString *src, size_t maxsize);
@@ -382,6 +382,8 @@ enum{
   onMQTTmsg,
   onFTP,
   USER,
+  onADC,
+  onSENSOR,
 };
 
 typedef struct _msg
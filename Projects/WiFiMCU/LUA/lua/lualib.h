@@ -42,11 +42,13 @@ LUALIB_API int (luaopen_package) (lua_State *L);
 #ifdef USE_ADC_MODULE
 #define LUA_ADCLIBNAME	"adc"
 LUALIB_API int (luaopen_adc) (lua_State *L);
+LUALIB_API int (luaclose_adc) (lua_State *L);
 #endif
 
 #ifdef USE_GPIO_MODULE
 #define LUA_GPIOLIBNAME	"gpio"
 LUALIB_API int (luaopen_gpio) (lua_State *L);
+LUALIB_API int (luaclose_gpio) (lua_State *L);
 #endif
 
 #ifdef USE_MCU_MODULE
@@ -67,16 +69,19 @@ LUALIB_API int (luaopen_file) (lua_State *L);
 #ifdef USE_I2C_MODULE
 #define LUA_I2CLIBNAME	"i2c"
 LUALIB_API int (luaopen_i2c) (lua_State *L);
+LUALIB_API int (luaclose_i2c) (lua_State *L);
 #endif
 
 #ifdef USE_NET_MODULE
 #define LUA_NETLIBNAME	"net"
 LUALIB_API int (luaopen_net) (lua_State *L);
+LUALIB_API int (luaclose_net) (lua_State *L);
 #endif
 
 #ifdef USE_PWM_MODULE
 #define LUA_PWMLIBNAME	"pwm"
 LUALIB_API int (luaopen_pwm) (lua_State *L);
+LUALIB_API int (luaclose_pwm) (lua_State *L);
 #endif
 
 #ifdef USE_SPI_MODULE
@@ -87,6 +92,7 @@ LUALIB_API int (luaopen_spi) (lua_State *L);
 #ifdef USE_TMR_MODULE
 #define LUA_TMRLIBNAME	"tmr"
 LUALIB_API int (luaopen_tmr) (lua_State *L);
+LUALIB_API int (luaclose_tmr) (lua_State *L);
 #endif
 
 #ifdef USE_UART_MODULE
@@ -102,6 +108,7 @@ LUALIB_API int (luaopen_bit) (lua_State *L);
 #ifdef USE_SENSOR_MODULE
 #define LUA_SENSORLIBNAME	"sensor"
 LUALIB_API int (luaopen_sensor) (lua_State *L);
+LUALIB_API int (luaclose_sensor) (lua_State *L);
 #endif
 
 #ifdef USE_RTC_MODULE
@@ -122,6 +129,7 @@ LUALIB_API int (luaopen_lcd) (lua_State *L);
 #ifdef USE_MQTT_MODULE
 #define LUA_MQTTLIBNAME	"mqtt"
 LUALIB_API int (luaopen_mqtt) (lua_State *L);
+LUALIB_API int (luaclose_mqtt) (lua_State *L);
 #endif
 
 #ifdef USE_FTP_MODULE
@@ -129,6 +137,22 @@ LUALIB_API int (luaopen_mqtt) (lua_State *L);
 LUALIB_API int (luaopen_ftp) (lua_State *L);
 #endif
 
+#ifdef USE_JSON_MODULE
+#define LUA_JSONLIBNAME	"json"
+LUALIB_API int (luaopen_json) (lua_State *L);
+#endif
+
+/* buffer_checklstring() takes a string or a buffer, for modules that send bytes */
+#ifdef USE_BUFFER_MODULE
+#define LUA_BUFFERLIBNAME	"buffer"
+LUALIB_API int (luaopen_buffer) (lua_State *L);
+LUALIB_API const char *(buffer_checklstring) (lua_State *L, int narg, size_t *len);
+LUALIB_API int (buffer_isstring) (lua_State *L, int narg);
+#else
+#define buffer_checklstring	luaL_checklstring
+#define buffer_isstring	lua_isstring
+#endif
+
 /* open all previous libraries */
 LUALIB_API void (luaL_openlibs) (lua_State *L); 
 
@@ -36,6 +36,10 @@ int luaU_dump_crosscompile (lua_State* L, const Proto* f, lua_Writer w, void* da
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip);
 
+/* streaming dump, nested functions first; from ldump.c */
+LUAI_FUNC int luaU_dump_proto (lua_State* L, const Proto* f, const TString* source, lua_Writer w, void* data, int strip, size_t* wrote);
+LUAI_FUNC int luaU_dump_streamed (lua_State* L, const Proto* f, lua_Writer w, void* data, int strip, lua_Reader r, void* rdata);
+
 #ifdef luac_c
 /* print one chunk; from print.c */
 LUAI_FUNC void luaU_print (const Proto* f, int full);
@@ -122,13 +122,18 @@
 // SPIFFS_LOCK and SPIFFS_UNLOCK protects spiffs from reentrancy on api level
 // These should be defined on a multithreaded system
 
+// The file system is used from the Lua thread and the httpd thread, the
+// mutex lives in file.c next to the spiffs instance
+void spiffs_api_lock(void);
+void spiffs_api_unlock(void);
+
 // define this to enter a mutex if you're running on a multithreaded system
 #ifndef SPIFFS_LOCK
-#define SPIFFS_LOCK(fs)
+#define SPIFFS_LOCK(fs)                 spiffs_api_lock()
 #endif
 // define this to exit a mutex if you're running on a multithreaded system
 #ifndef SPIFFS_UNLOCK
-#define SPIFFS_UNLOCK(fs)
+#define SPIFFS_UNLOCK(fs)               spiffs_api_unlock()
 #endif
 
 
@@ -12,6 +12,10 @@ extern platform_uart_driver_t platform_uart_drivers[];
 extern const platform_uart_t  platform_uart_peripherals[];
 extern unsigned char boot_reason;
 extern void _timer_net_handle( lua_State* gL );
+extern void _tmr_dispatch( lua_State* L );
+extern void _gpio_irq_handle( lua_State* L, int id );
+extern void _adc_stream_handle( lua_State* L );
+extern void _sensor_handle( lua_State* L, int kind );
 extern void _do_freeBuf(uint8_t id);
 //extern uint8_t *MQTT_topicbuf;
 //extern uint8_t *MQTT_msgbuf;
@@ -131,11 +135,24 @@ extern char gWiFiPSW[];
 //=========================================
 static void do_queue_task(queue_msg_t* msg)
 {
-  if ((msg->source == TMR) || (msg->source == GPIO))
-  { // === execute timer or gpio interrupt function ===
-    if(msg->para2 == LUA_NOREF) return;
-    lua_rawgeti(msg->L, LUA_REGISTRYINDEX, msg->para2);
-    lua_call(msg->L, 0, 0);
+  if (msg->source == TMR)
+  { // === execute functions of all expired timers ===
+    _tmr_dispatch(msg->L);
+    lua_gc(msg->L, LUA_GCCOLLECT, 0);
+  }
+  else if (msg->source == GPIO)
+  { // === execute gpio interrupt function ===
+    _gpio_irq_handle(msg->L, msg->para1);
+    lua_gc(msg->L, LUA_GCCOLLECT, 0);
+  }
+  else if (msg->source == onADC)
+  { // === execute adc stream block function ===
+    _adc_stream_handle(msg->L);
+    lua_gc(msg->L, LUA_GCCOLLECT, 0);
+  }
+  else if (msg->source == onSENSOR)
+  { // === execute async sensor read function ===
+    _sensor_handle(msg->L, msg->para1);
     lua_gc(msg->L, LUA_GCCOLLECT, 0);
   }
   else if (msg->source == NETTMR)
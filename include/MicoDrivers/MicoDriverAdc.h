@@ -45,6 +45,8 @@
  *                   Macros
  ******************************************************/  
 
+#define MICO_ADC_STREAM_MAX_CHANNELS  (16)  /* length of the regular conversion sequence */
+
 /******************************************************
  *                   Enumerations
  ******************************************************/
@@ -53,6 +55,8 @@
  *                 Type Definitions
  ******************************************************/
 
+typedef platform_adc_stream_callback_t          mico_adc_stream_handler_t;
+
  /******************************************************
  *                    Structures
  ******************************************************/
@@ -116,6 +120,34 @@ OSStatus MicoAdcTakeSample( mico_adc_t adc, uint16_t* output );
 OSStatus MicoAdcTakeSampleStream( mico_adc_t adc, void* buffer, uint16_t buffer_length );
 
 
+/** Starts continuous sampling of one or more ADC interfaces
+ *
+ * A hardware timer triggers one conversion of every interface per frame,
+ * DMA stores the results into a circular buffer and the handler is called
+ * from interrupt context each time half of the buffer has been filled.
+ *
+ * @param adcs          : the interfaces which should be sampled
+ * @param adc_count     : number of interfaces, 1 ~ MICO_ADC_STREAM_MAX_CHANNELS
+ * @param sample_rate   : frames per second
+ * @param buffer        : circular buffer which will receive interleaved samples
+ * @param buffer_length : length of buffer in samples, a multiple of 2 * adc_count
+ * @param handler       : function called with each filled half of buffer
+ * @param arg           : argument passed to handler
+ *
+ * @return    kNoErr        : on success.
+ * @return    kGeneralErr   : if an error occurred with any step
+ */
+OSStatus MicoAdcStreamStart( const mico_adc_t* adcs, uint8_t adc_count, uint32_t sample_rate, uint16_t* buffer, uint32_t buffer_length, mico_adc_stream_handler_t handler, void* arg );
+
+
+/** Stops sampling started by MicoAdcStreamStart
+ *
+ * @return    kNoErr        : on success.
+ * @return    kGeneralErr   : if an error occurred with any step
+ */
+OSStatus MicoAdcStreamStop( void );
+
+
 /** De-initialises an ADC interface
  *
  * Turns off an ADC hardware interface
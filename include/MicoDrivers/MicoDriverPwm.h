@@ -40,6 +40,12 @@
 * @{
 */
 
+/******************************************************
+ *                   Macros
+ ******************************************************/
+
+#define MICO_PWM_WAVE_MAX_CHANNELS  (4)  /* channels of one timer */
+
 /******************************************************
  *                   Enumerations
  ******************************************************/
@@ -48,6 +54,10 @@
  *                 Type Definitions
  ******************************************************/
 
+typedef platform_pwm_wave_callback_t            mico_pwm_wave_handler_t;
+
+typedef platform_pwm_wave_layout_t              mico_pwm_wave_layout_t;
+
  /******************************************************
  *                 Function Declarations
  ******************************************************/
@@ -95,6 +105,51 @@ OSStatus MicoPwmStart(mico_pwm_t pwm);
  */
 OSStatus MicoPwmStop(mico_pwm_t pwm);
 
+
+/** Gets the frame layout of a waveform on one or more PWM interfaces
+ *
+ * @param pwms       : the PWM interfaces, which must use the same timer
+ * @param pwm_count  : number of interfaces, 1 ~ MICO_PWM_WAVE_MAX_CHANNELS
+ * @param layout     : receives the CCR value for 100% duty cycle, the number
+ *                     of values per frame and the position of each interface
+ *
+ * @return    kNoErr          : on success.
+ * @return    kUnsupportedErr : if the timer can't be used for waveforms
+ * @return    kParamErr       : if the interfaces use different timers
+ */
+OSStatus MicoPwmWaveLayout( const mico_pwm_t* pwms, uint8_t pwm_count, mico_pwm_wave_layout_t* layout );
+
+
+/** Starts updating the duty cycles of initialised PWM interfaces by DMA
+ *
+ * Every PWM period one frame of CCR values is written to all interfaces at
+ * once. The handler is called from interrupt context each time half of the
+ * circular buffer has been sent, to fill it with the next frames.
+ *
+ * @param pwms          : the PWM interfaces, which must use the same timer
+ * @param pwm_count     : number of interfaces, 1 ~ MICO_PWM_WAVE_MAX_CHANNELS
+ * @param buffer        : circular buffer of frames, see MicoPwmWaveLayout
+ * @param buffer_frames : length of buffer in frames, a multiple of 2
+ * @param handler       : function called to fill each half of buffer
+ * @param arg           : argument passed to handler
+ *
+ * @return    kNoErr        : on success.
+ * @return    kGeneralErr   : if an error occurred with any step
+ */
+OSStatus MicoPwmWaveStart( const mico_pwm_t* pwms, uint8_t pwm_count, uint32_t* buffer, uint32_t buffer_frames, mico_pwm_wave_handler_t handler, void* arg );
+
+
+/** Stops the waveform running on the timer of a PWM interface
+ *
+ * The PWM output keeps running with the last duty cycles.
+ *
+ * @param pwm        : the PWM interface
+ *
+ * @return    kNoErr        : on success.
+ * @return    kGeneralErr   : if an error occurred with any step
+ */
+OSStatus MicoPwmWaveStop( mico_pwm_t pwm );
+
 /** @} */
 /** @} */
 
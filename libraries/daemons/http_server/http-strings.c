@@ -122,6 +122,8 @@ const char http_header_200_keepalive[66] =
 const char http_header_200[] = "HTTP/1.1 200 OK\r\n";
 
 const char http_header_304_prologue[] = "HTTP/1.1 304 Not Modified\r\n";
+const char http_header_206[] = "HTTP/1.1 206 Partial Content\r\n";
+const char http_header_416[] = "HTTP/1.1 416 Range Not Satisfiable\r\n";
 const char http_header_404[] = "HTTP/1.1 404 Not Found\r\n";
 const char http_header_400[] = "HTTP/1.1 400 Bad Request\r\n";
 const char http_header_500[] = "HTTP/1.1 500 Internal Server Error\r\n";
@@ -61,6 +61,8 @@ extern const char http_header_pragma_no_cache[];
 extern const char http_header_200_keepalive[66];
 extern const char http_header_200[];
 extern const char http_header_304_prologue[];
+extern const char http_header_206[];
+extern const char http_header_416[];
 extern const char http_header_404[];
 extern const char http_header_400[];
 extern const char http_header_500[];
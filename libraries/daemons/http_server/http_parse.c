@@ -294,6 +294,35 @@ done:
 }
 
 
+/* Parse a single "bytes=first-last" range, lists of ranges are ignored and
+* get the whole entity. */
+static void httpd_parse_range(const char *data_p, httpd_request_t *req_p)
+{
+  char *end;
+  
+  while (*data_p == ISO_space)
+    data_p++;
+  if (strncasecmp(data_p, "bytes=", sizeof("bytes=") - 1) != 0 || strchr(data_p, ','))
+    return;
+  data_p += sizeof("bytes=") - 1;
+  
+  req_p->range_first = -1;
+  req_p->range_last = -1;
+  if (*data_p != '-') {
+    req_p->range_first = strtol(data_p, &end, 10);
+    if (end == data_p)
+      return;
+    data_p = end;
+  }
+  if (*data_p++ != '-')
+    return;
+  if (*data_p >= '0' && *data_p <= '9')
+    req_p->range_last = strtol(data_p, NULL, 10);
+  else if (req_p->range_first < 0)
+    return;
+  req_p->range = TRUE;
+}
+
 /* Parse the individual components of the HTTP header and reflect it in
 * httpd_request_t structure. */
 static int __httpd_parse_hdr_tags(char *data_p, int len,
@@ -334,12 +363,17 @@ static int __httpd_parse_hdr_tags(char *data_p, int len,
     }
     
     const char *etag_start = ++first_double_quote;
-    req_p->etag_val = strtol(etag_start, NULL, 16);
+    req_p->etag_val = strtoul(etag_start, NULL, 16);
     req_p->if_none_match = TRUE;
   } else if (strncasecmp(data_p, http_encoding, sizeof(http_encoding) - 1) == 0) {
     if (!strncasecmp(&data_p[sizeof(http_encoding) - 1],
                      HTTP_CHUNKED, sizeof(HTTP_CHUNKED) - 1))
       req_p->chunked = 1;
+  } else if (strncasecmp(data_p, "Accept-Encoding:", sizeof("Accept-Encoding:") - 1) == 0) {
+    if (strstr(data_p, "gzip"))
+      req_p->accept_gzip = 1;
+  } else if (strncasecmp(data_p, "Range:", sizeof("Range:") - 1) == 0) {
+    httpd_parse_range(data_p + sizeof("Range:") - 1, req_p);
   }
   return kNoErr;
 }
@@ -84,7 +84,14 @@ static bool httpd_stop_req;
 
 static int http_sockfd;
 
-int client_sockfd;
+/* One slot per open client connection, sock is -1 when the slot is free */
+typedef struct {
+  int sock;
+  uint32_t last_active;
+  httpd_request_t req;
+} httpd_conn_t;
+
+static httpd_conn_t httpd_conns[HTTPD_MAX_CONNECTIONS];
 static bool https_active;
 
 bool httpd_is_https_active()
@@ -97,9 +104,21 @@ static int net_get_sock_error( int sock)
   return -kInProgressErr;
 }
 
+static int httpd_close_client(httpd_conn_t *conn)
+{
+  int ret;
+  
+  htsys_rxbuf_detach(conn->sock);
+  ret = close(conn->sock);
+  if (ret != 0)
+    httpd_d("Failed to close client socket: %d", net_get_sock_error(conn->sock));
+  conn->sock = -1;
+  return ret != 0 ? -kInProgressErr : kNoErr;
+}
+
 static int httpd_close_sockets()
 {
-  int ret, status = kNoErr;
+  int i, ret, status = kNoErr;
   
   if (http_sockfd != -1) {
     ret = close(http_sockfd);
@@ -110,13 +129,9 @@ static int httpd_close_sockets()
   http_sockfd = -1;
   }
   
-  if (client_sockfd != -1) {
-    ret = close(client_sockfd);
-    if (ret != 0) {
-      httpd_d("Failed to close client socket: %d", net_get_sock_error(client_sockfd));
+  for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+    if (httpd_conns[i].sock != -1 && httpd_close_client(&httpd_conns[i]) != kNoErr)
       status = -kInProgressErr;
-    }
-    client_sockfd = -1;
   }
   
   return status;
@@ -198,7 +213,7 @@ static int httpd_select(int max_sock, const fd_set *readfds,
   memcpy(&local_readfds, readfds, sizeof(fd_set));
   httpd_d("WAITING for activity");
   
-  activefds_cnt = select(1, &local_readfds, NULL, NULL, timeout_secs >= 0 ? &timeout : NULL);
+  activefds_cnt = select(max_sock + 1, &local_readfds, NULL, NULL, timeout_secs >= 0 ? &timeout : NULL);
   if (activefds_cnt < 0) {
     httpd_d("Select failed: %d", timeout_secs);
     httpd_suspend_thread(true);
@@ -222,20 +237,16 @@ static int httpd_select(int max_sock, const fd_set *readfds,
   return HTTPD_TIMEOUT_EVENT;
 }
 
-static int  httpd_accept_client_socket(const fd_set *active_readfds)
+static int  httpd_accept_client_socket(httpd_conn_t *conn)
 {
-  int main_sockfd = -1;
+  int client_sockfd;
   struct sockaddr_t addr_from;
   int addr_from_len;
   
-  if (FD_ISSET(http_sockfd, active_readfds)) {
-    main_sockfd = http_sockfd;
-    https_active  = FALSE;
-  }
-  
+  https_active  = FALSE;
   addr_from_len = sizeof(addr_from);
   
-  client_sockfd = accept(main_sockfd, &addr_from, &addr_from_len);
+  client_sockfd = accept(http_sockfd, &addr_from, &addr_from_len);
   if (client_sockfd < 0) {
     httpd_d("net_accept client socket failed %d.", client_sockfd);
     return -kInProgressErr;
@@ -252,7 +263,7 @@ static int  httpd_accept_client_socket(const fd_set *active_readfds)
   * We are doing this as we have single threaded web server with
   * synchronous (blocking) API usage like send, recv and they might get
   * blocked due to un-availability of peer end, causing web server to
-  * be in-responsive forever.
+  * be in-responsive forever, for all connections in the pool.
   */
   int optval = true;
   if (setsockopt(client_sockfd, SOL_SOCKET, 0x0008, &optval, sizeof(optval)) == -1) {
@@ -281,111 +292,118 @@ static int  httpd_accept_client_socket(const fd_set *active_readfds)
   
   httpd_d("connecting %d to %d.", client_sockfd, addr_from.s_port);
   
+  conn->sock = client_sockfd;
+  conn->last_active = mico_get_time();
+  htsys_rxbuf_attach(client_sockfd);
   return kNoErr;
 }
 
-static void httpd_handle_client_connection(const fd_set *active_readfds)
+static void httpd_handle_client_connection(httpd_conn_t *conn)
 {
-  int activefds_cnt, status;
-  fd_set readfds;
+  int status;
   
-  if (httpd_stop_req) {
-    httpd_d("HTTPD stop request received");
-    httpd_stop_req = FALSE;
-    httpd_suspend_thread(false);
+  httpd_d("Handling %d", conn->sock);
+  /* Note:
+  * A connection is handled with one call to httpd_handle_message per
+  * request (kNoErr) and a last call when there is no more data to
+  * receive (client closed connection), which returns HTTPD_DONE and
+  * closes the socket.
+  */
+  status = httpd_handle_message(conn->sock, &conn->req);
+  conn->last_active = mico_get_time();
+  if (status == kNoErr) {
+    /* The handlers are expected more data on the
+    socket */
+    return;
   }
   
-  status = httpd_accept_client_socket(active_readfds);
-  if (status != kNoErr)
-    return;
+  /* Either there was some error or everything went well */
+  httpd_d("Close socket %d.  %s: %d", conn->sock, status == HTTPD_DONE ? "Handler done" : "Handler failed", status);
   
-  httpd_d("Client socket accepted: %d", client_sockfd);
-  FD_ZERO(&readfds);
-  FD_SET(client_sockfd, &readfds);
+  if (httpd_close_client(conn) != kNoErr)
+    httpd_suspend_thread(true);
+}
+
+/* Close connections that had no request for HTTPD_CLIENT_SOCK_TIMEOUT */
+static void httpd_expire_idle_connections(void)
+{
+  int i;
+  uint32_t now = mico_get_time();
   
-  while (1) {
-    if (httpd_stop_req) {
-      httpd_d("HTTPD stop request received");
-      httpd_stop_req = FALSE;
-      httpd_suspend_thread(false);
-    }
-    
-    httpd_d("Waiting on client socket");
-    activefds_cnt = httpd_select(client_sockfd, &readfds, NULL, HTTPD_CLIENT_SOCK_TIMEOUT);
-    
-    if (httpd_stop_req) {
-      httpd_d("HTTPD stop request received");
-      httpd_stop_req = FALSE;
-      httpd_suspend_thread(false);
-    }
-    
-    if (activefds_cnt == HTTPD_TIMEOUT_EVENT) {
-      /* Timeout has occured */
-      httpd_d("Client socket timeout occurred. " "Force closing socket");
-
-      status = close(client_sockfd);
-      if (status != kNoErr) {
-        status = net_get_sock_error(client_sockfd);
-        httpd_d("Failed to close socket %d", status);
-        httpd_suspend_thread(true);
-      }
-      
-      client_sockfd = -1;
-      break;
-    }
-    
-    httpd_d("Handling %d", client_sockfd);
-    /* Note:
-    * Connection will be handled with call to
-    * httpd_handle_message twice, first for
-    * handling request (kNoErr) and second
-    * time as there is no more data to receive
-    * (client closed connection) and hence
-    * will return with status HTTPD_DONE
-    * closing socket.
-    */
-    /* FIXME: remove this memset if all is working well */
-    /* memset(&httpd_message_in[0], 0, sizeof(httpd_message_in)); */
-    status = httpd_handle_message(client_sockfd);
-    if (status == kNoErr) {
-      /* The handlers are expected more data on the
-      socket */
+  for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+    if (httpd_conns[i].sock == -1)
       continue;
-    }
-    
-    /* Either there was some error or everything went well */
-    httpd_d("Close socket %d.  %s: %d", client_sockfd, status == HTTPD_DONE ? "Handler done" : "Handler failed", status);
-    
-    status = close(client_sockfd);
-    if (status != kNoErr) {
-      status = net_get_sock_error(client_sockfd);
-      httpd_d("Failed to close socket %d", status);
+    if (now - httpd_conns[i].last_active < HTTPD_CLIENT_SOCK_TIMEOUT * 1000)
+      continue;
+    httpd_d("Client socket %d timeout occurred. Force closing socket", httpd_conns[i].sock);
+    if (httpd_close_client(&httpd_conns[i]) != kNoErr)
       httpd_suspend_thread(true);
-    }
-    client_sockfd = -1;
-    
-    break;
   }
 }
 
 static void httpd_main(void *arg)
 {
-  int status, max_sockfd = -1;
+  int status, i, max_sockfd, nconns, npending;
+  httpd_conn_t *free_conn;
   fd_set readfds, active_readfds;
   
   status = httpd_setup_main_sockets();
   if (status != kNoErr)
     httpd_suspend_thread(true);
   
-  FD_ZERO(&readfds);
-  
-  FD_SET(http_sockfd, &readfds);
-  max_sockfd = http_sockfd;
-  
   while (1) {
-    httpd_d("Waiting on main socket");
-    httpd_select(max_sockfd, &readfds, &active_readfds, -1);
-    httpd_handle_client_connection(&active_readfds);
+    /* Wait on every open client, and on the listening socket while there
+     * is a free slot; otherwise new clients stay in the listen backlog. */
+    FD_ZERO(&readfds);
+    max_sockfd = -1;
+    nconns = 0;
+    npending = 0;
+    free_conn = NULL;
+    for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+      if (httpd_conns[i].sock == -1) {
+        if (free_conn == NULL)
+          free_conn = &httpd_conns[i];
+        continue;
+      }
+      FD_SET(httpd_conns[i].sock, &readfds);
+      if (httpd_conns[i].sock > max_sockfd)
+        max_sockfd = httpd_conns[i].sock;
+      nconns++;
+      if (htsys_rxbuf_pending(httpd_conns[i].sock))
+        npending++;
+    }
+    if (free_conn != NULL) {
+      FD_SET(http_sockfd, &readfds);
+      if (http_sockfd > max_sockfd)
+        max_sockfd = http_sockfd;
+    }
+    
+    /* Requests already in a receive buffer do not wake up select() */
+    httpd_d("Waiting on %d client sockets", nconns);
+    status = httpd_select(max_sockfd, &readfds, &active_readfds, npending ? 0 : nconns ? 1 : -1);
+    if (status == HTTPD_TIMEOUT_EVENT)
+      FD_ZERO(&active_readfds);
+    
+    if (status != HTTPD_TIMEOUT_EVENT || npending) {
+      for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+        if (httpd_conns[i].sock != -1 && (FD_ISSET(httpd_conns[i].sock, &active_readfds) ||
+                                          htsys_rxbuf_pending(httpd_conns[i].sock))) {
+          httpd_handle_client_connection(&httpd_conns[i]);
+          if (httpd_stop_req) {
+            httpd_d("HTTPD stop request received");
+            httpd_stop_req = FALSE;
+            httpd_suspend_thread(false);
+          }
+        }
+      }
+      
+      if (free_conn != NULL && FD_ISSET(http_sockfd, &active_readfds)) {
+        if (httpd_accept_client_socket(free_conn) == kNoErr)
+          httpd_d("Client socket accepted: %d", free_conn->sock);
+      }
+    }
+    
+    httpd_expire_idle_connections();
   }
   
   /*
@@ -553,14 +571,15 @@ int httpd_shutdown(void)
 /* This pairs with httpd_shutdown() */
 int httpd_init()
 {
-  int status;
+  int i, status;
   
   if (httpd_state != HTTPD_INACTIVE)
     return kNoErr;
   
   httpd_d("Initializing");
   
-  client_sockfd = -1;
+  for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++)
+    httpd_conns[i].sock = -1;
   http_sockfd  = -1;
   
   status = httpd_wsgi_init();
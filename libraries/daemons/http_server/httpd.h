@@ -474,6 +474,21 @@ enum wm_httpd_errno {
  */
 #define HTTPD_MAX_CONTENT_TYPE_LENGTH 128
 
+/** Maximum number of simultaneous client connections
+ *
+ *  The httpd thread keeps up to HTTPD_MAX_CONNECTIONS client sockets open and
+ *  waits on all of them, and on the listening socket, in one select loop.
+ *  Each connection owns its own \ref httpd_request_t, so a browser that keeps
+ *  one connection alive no longer holds off every other client.  Requests are
+ *  still handled one at a time; the connections are interleaved between
+ *  requests.  While all slots are busy new connections wait in the listen
+ *  backlog.  Every slot costs one TCP socket and sizeof(httpd_request_t) of
+ *  RAM.
+ */
+#ifndef HTTPD_MAX_CONNECTIONS
+#define HTTPD_MAX_CONNECTIONS 4
+#endif
+
 #define ISO_nl      0x0a
 #define ISO_cr      0x0d
 #define ISO_tab     0x09
@@ -573,6 +588,15 @@ typedef struct {
 	bool if_none_match;
 	/** Used for storing the etag of an URI */
 	unsigned etag_val;
+	/** Set to 1 if the client accepts gzip Content-Encoding */
+	unsigned char accept_gzip;
+	/** True if a single "Range: bytes=" range is present in the incoming
+	 * HTTP Request */
+	bool range;
+	/** First byte of the range, -1 for a suffix range "bytes=-n" */
+	int range_first;
+	/** Last byte of the range, -1 if open ended, n of a suffix range */
+	int range_last;
 } httpd_request_t;
 
 /** Initialize the httpd
@@ -765,6 +789,57 @@ int httpd_unregister_wsgi_handler(struct httpd_wsgi_call *wsgi_call);
 int httpd_unregister_wsgi_handlers(struct httpd_wsgi_call *wsgi_call_list,
 					int handler_cnt);
 
+/** File system used by the static file handler
+ *
+ *  The httpd does not depend on a particular file system. An application that
+ *  wants files served provides these functions, they are called from the httpd
+ *  thread.
+ */
+struct httpd_fs {
+	/** Open a file for reading, return a handle >= 0 or < 0 if the file
+	 * does not exist */
+	int (*open) (const char *name);
+	/** Read up to len bytes, return the number read, 0 at the end of the
+	 * file or < 0 on error */
+	int (*read) (int fd, char *buf, int len);
+	/** Move to offset from the start of the file, return < 0 on error */
+	int (*seek) (int fd, int offset);
+	/** Return the size of the file in bytes */
+	int (*size) (int fd);
+	/** Return a tag that changes whenever the file is written, it is sent
+	 * as the ETag. 0 if there is none for this file, NULL if the file
+	 * system has none, no ETag is sent then */
+	unsigned (*tag) (int fd);
+	/** Close the file */
+	void (*close) (int fd);
+};
+
+/** Register the static file handler
+ *
+ *  GET and HEAD requests below \a uri are answered with the file named by the
+ *  rest of the path, "index.html" if that is empty or ends with '/'.  The file
+ *  is streamed in HTTPD_MAX_MESSAGE sized pieces.
+ *
+ *  - If the client accepts gzip and "<name>.gz" exists, that file is sent with
+ *    Content-Encoding: gzip.
+ *  - The ETag is the tag of the file system, a matching If-None-Match is
+ *    answered with 304 Not Modified.
+ *  - A single "Range: bytes=" range is answered with 206 Partial Content.
+ *
+ *  Only one file handler can be registered.
+ *
+ *  \param[in] uri URI prefix, e.g. "/". The string must stay valid while the
+ *  handler is registered.
+ *  \param[in] fs file system functions.
+ *
+ *  \return WM_SUCCESS if successful
+ *  \return -WM_FAIL otherwise
+ */
+int httpd_register_file_handler(const char *uri, const struct httpd_fs *fs);
+
+/** Unregister the static file handler */
+void httpd_unregister_file_handler(void);
+
 /** Maximum length of virtual SSI arguments
  *
  *  The supported format for virtual SSI directives is:
@@ -0,0 +1,255 @@
+/**
+******************************************************************************
+* @file    httpd_file.c 
+* @author  QQ DING
+* @version V1.0.0
+* @date    1-September-2015
+* @brief   This file contains the static file handler of the httpd. Files are
+*          read through the struct httpd_fs registered by the application and
+*          streamed to the client, with gzip variants, ETag and Range support.
+******************************************************************************
+*
+*  The MIT License
+*  Copyright (c) 2014 MXCHIP Inc.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy 
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights 
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is furnished
+*  to do so, subject to the following conditions:
+*
+*  The above copyright notice and this permission notice shall be included in
+*  all copies or substantial portions of the Software.
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR 
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, 
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE 
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+*  WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR 
+*  IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+******************************************************************************
+*/
+
+#include <string.h>
+#include <stdio.h>
+
+#include "httpd.h"
+#include "http-strings.h"
+
+#include "httpd_priv.h"
+
+/* Room for the path, "index.html" and ".gz" */
+#define HTTPD_FILE_NAME_LEN \
+	(HTTPD_MAX_URI_LENGTH + sizeof(http_index_html) + sizeof(http_gz))
+
+static const struct httpd_fs *file_fs;
+
+static int httpd_file_get(httpd_request_t *req);
+
+static struct httpd_wsgi_call file_call = {
+	NULL, 0, APP_HTTP_FLAGS_NO_EXACT_MATCH, httpd_file_get, NULL, NULL, NULL
+};
+
+static const struct {
+	const char *ext;
+	const char *type;
+} file_types[] = {
+	{ http_html, http_content_type_html },
+	{ http_htm, http_content_type_html },
+	{ http_css, http_content_type_css },
+	{ http_js, http_content_type_js },
+	{ http_png, http_content_type_png },
+	{ http_gif, http_content_type_gif },
+	{ http_jpg, http_content_type_jpg },
+	{ http_txt, http_content_type_plain },
+	{ ".json", http_content_type_json_nocrlf },
+};
+
+static const char *httpd_file_type(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+	int i;
+
+	if (ext) {
+		for (i = 0; i < sizeof(file_types) / sizeof(file_types[0]); i++)
+			if (!strcasecmp(ext, file_types[i].ext))
+				return file_types[i].type;
+	}
+	return http_content_type_binary;
+}
+
+/* Map the request path below the registered uri to a file name. Returns -1
+ * for names that are too long or try to leave the served directory. */
+static int httpd_file_name(const char *path, char *name)
+{
+	int len = 0;
+
+	path += strlen(file_call.uri);
+	while (*path == '/')
+		path++;
+	while (path[len] && path[len] != '?')
+		len++;
+	if (len > HTTPD_MAX_URI_LENGTH)
+		return -1;
+	memcpy(name, path, len);
+	name[len] = 0;
+	if (strstr(name, ".."))
+		return -1;
+	/* http_index_html carries the leading '/' */
+	if (len == 0 || name[len - 1] == '/')
+		strcpy(&name[len], &http_index_html[1]);
+	return 0;
+}
+
+static int httpd_file_get(httpd_request_t *req)
+{
+	char name[HTTPD_FILE_NAME_LEN + 1];
+	const char *status = http_header_200;
+	const char *type;
+	char *buf;
+	unsigned etag = 0;
+	int fd = -1, gz = 0;
+	int size, first, last, len, n;
+	int err = -kInProgressErr;
+
+	buf = malloc(HTTPD_MAX_MESSAGE);
+	if (!buf) {
+		httpd_d("Failed to allocate memory for buffer");
+		return -kInProgressErr;
+	}
+
+	if (!req->hdr_parsed) {
+		if (httpd_parse_hdr_tags(req, req->sock, buf,
+					 HTTPD_MAX_MESSAGE) != kNoErr) {
+			httpd_d("Unable to parse header tags");
+			goto out;
+		}
+		req->hdr_parsed = 1;
+	}
+
+	if (httpd_file_name(httpd_skip_absolute_http_path(req->filename),
+			    name) == 0) {
+		type = httpd_file_type(name);
+		if (req->accept_gzip) {
+			strcat(name, http_gz);
+			fd = file_fs->open(name);
+			name[strlen(name) - sizeof(http_gz) + 1] = 0;
+			gz = fd >= 0;
+		}
+		if (fd < 0)
+			fd = file_fs->open(name);
+	}
+	if (fd < 0) {
+		httpd_set_error("File %s not_found", req->filename);
+		err = httpd_send_error(req->sock, HTTP_404);
+		goto out;
+	}
+
+	size = file_fs->size(fd);
+	/* The tag comes from file metadata, the file is not read for it */
+	if (file_fs->tag)
+		etag = file_fs->tag(fd);
+	httpd_d("Serving %s%s, %d bytes", name, gz ? http_gz : "", size);
+
+	if (etag && req->if_none_match && req->etag_val == etag) {
+		len = snprintf(buf, HTTPD_MAX_MESSAGE, "%s%sETag: \"%08x\"\r\n\r\n",
+			       http_header_304_prologue, http_header_server, etag);
+		err = httpd_send(req->sock, buf, len);
+		goto out;
+	}
+
+	first = 0;
+	last = size - 1;
+	if (req->range) {
+		if (req->range_first < 0) {
+			/* suffix range, the last range_last bytes */
+			first = size - req->range_last;
+			if (first < 0)
+				first = 0;
+			if (req->range_last == 0)
+				first = size;
+		} else {
+			first = req->range_first;
+			if (req->range_last >= 0 && req->range_last < last)
+				last = req->range_last;
+		}
+		if (first >= size) {
+			len = snprintf(buf, HTTPD_MAX_MESSAGE,
+				       "%s%sContent-Range: bytes */%d\r\n"
+				       "Content-Length: 0\r\n\r\n",
+				       http_header_416, http_header_server, size);
+			err = httpd_send(req->sock, buf, len);
+			goto out;
+		}
+		if (last < first) {
+			/* Invalid range, ignore it */
+			first = 0;
+			last = size - 1;
+		} else
+			status = http_header_206;
+	}
+
+	len = snprintf(buf, HTTPD_MAX_MESSAGE, "%s%s%s%sContent-Length: %d\r\n"
+		       "Accept-Ranges: bytes\r\nCache-Control: no-cache\r\n",
+		       status, http_header_server, type,
+		       gz ? http_content_encoding_gz : "", last - first + 1);
+	if (etag)
+		len += snprintf(&buf[len], HTTPD_MAX_MESSAGE - len,
+				"ETag: \"%08x\"\r\n", etag);
+	if (status == http_header_206)
+		len += snprintf(&buf[len], HTTPD_MAX_MESSAGE - len,
+				"Content-Range: bytes %d-%d/%d\r\n",
+				first, last, size);
+	len += snprintf(&buf[len], HTTPD_MAX_MESSAGE - len, "\r\n");
+	err = httpd_send(req->sock, buf, len);
+	if (err != kNoErr || req->type == HTTPD_REQ_TYPE_HEAD)
+		goto out;
+
+	if (first && file_fs->seek(fd, first) < 0) {
+		err = -kInProgressErr;
+		goto out;
+	}
+	len = last - first + 1;
+	while (len > 0) {
+		n = file_fs->read(fd, buf,
+				  len < HTTPD_MAX_MESSAGE ? len : HTTPD_MAX_MESSAGE);
+		if (n <= 0) {
+			httpd_d("Read of %s failed", name);
+			err = -kInProgressErr;
+			break;
+		}
+		err = httpd_send(req->sock, buf, n);
+		if (err != kNoErr)
+			break;
+		len -= n;
+	}
+
+out:
+	if (fd >= 0)
+		file_fs->close(fd);
+	free(buf);
+	return err;
+}
+
+int httpd_register_file_handler(const char *uri, const struct httpd_fs *fs)
+{
+	if (file_call.uri)
+		httpd_unregister_file_handler();
+
+	file_fs = fs;
+	file_call.uri = uri;
+	if (httpd_register_wsgi_handler(&file_call) != kNoErr) {
+		file_call.uri = NULL;
+		return -kInProgressErr;
+	}
+	return kNoErr;
+}
+
+void httpd_unregister_file_handler(void)
+{
+	if (!file_call.uri)
+		return;
+	httpd_unregister_wsgi_handler(&file_call);
+	file_call.uri = NULL;
+}
@@ -49,8 +49,6 @@ extern tls_handle_t httpd_tls_handle;
 #define STATE_WAITING 0
 #define STATE_OUTPUT  1
 
-static httpd_request_t httpd_req;
-
 /* Send the chunk header, which is just an ascii size followed by a cr lf.
  */
 #define CHUNK_SIZE_DIGITS 0x10
@@ -153,7 +151,8 @@ int httpd_send(int conn, const char *buf, int len)
 	return kNoErr;
 }
 
-int httpd_recv(int fd, void *buf, size_t n, int flags)
+/* Read from the socket itself, bypassing the receive buffer */
+int httpd_recv_sock(int fd, void *buf, size_t n, int flags)
 {
 #ifdef CONFIG_ENABLE_HTTPS
 	if (httpd_is_https_active())
@@ -163,6 +162,11 @@ int httpd_recv(int fd, void *buf, size_t n, int flags)
 		return recv(fd, buf, n, flags);
 }
 
+int httpd_recv(int fd, void *buf, size_t n, int flags)
+{
+	return htsys_recv(fd, buf, n, flags);
+}
+
 int httpd_send_hdr_from_code(int sock, int stat_code,
 			     enum http_content_type content_type)
 {
@@ -317,18 +321,19 @@ void httpd_purge_socket_data(httpd_request_t *req, char *msg_in,
 }
 
 /* Handle an incoming message (request) from the client. This is the
- * main processing function of the HTTPD.
+ * main processing function of the HTTPD. req is the request state of the
+ * connection conn belongs to.
  */
-int httpd_handle_message(int conn)
+int httpd_handle_message(int conn, httpd_request_t *req)
 {
 	int err;
 	int req_line_len;
 	char msg_in[128];
 
-	/* clear out the httpd_req structure */
-	memset(&httpd_req, 0x00, sizeof(httpd_req));
+	/* clear out the request structure */
+	memset(req, 0x00, sizeof(httpd_request_t));
 
-	httpd_req.sock = conn;
+	req->sock = conn;
 
 	/* Read the first line of the HTTP header */
 	req_line_len = htsys_getln_soc(conn, msg_in, sizeof(msg_in));
@@ -341,7 +346,7 @@ int httpd_handle_message(int conn)
 	}
 
 	/* Parse the first line of the header */
-	err = httpd_parse_hdr_main(msg_in, &httpd_req);
+	err = httpd_parse_hdr_main(msg_in, req);
 	if (err == -WM_E_HTTPD_NOTSUPP)
 		/* Send 505 HTTP Version not supported */
 		return httpd_send_error(conn, HTTP_505);
@@ -354,22 +359,22 @@ int httpd_handle_message(int conn)
 	httpd_d("Presetting");
 
 	/* Web Services Gateway Interface branch point:
-	 * At this point we have the request type (httpd_req.type) and the path
-	 * (httpd_req.filename) and all the headers waiting to be read from
+	 * At this point we have the request type (req->type) and the path
+	 * (req->filename) and all the headers waiting to be read from
 	 * the socket.
 	 *
 	 * The call bellow will iterate through all the url patterns and
 	 * invoke the handlers that match the request type and pattern.  If
 	 * request type and url patern match, invoke the handler.
 	 */
-	err = httpd_wsgi(&httpd_req);
+	err = httpd_wsgi(req);
 
 	if (err == HTTPD_DONE) {
 		httpd_d("Done processing request.");
 		return kNoErr;
 	} else if (err == -WM_E_HTTPD_NO_HANDLER) {
 		httpd_d("No handler for the given URL %s was found",
-			httpd_req.filename);
+			req->filename);
 		/*
 		 * We have not yet read the complete data from the current
 		 * request, from the socket. We are in an error state and
@@ -378,9 +383,9 @@ int httpd_handle_message(int conn)
 		 * all the pending data in the socket. We let the client
 		 * close the socket for us, if necessary.
 		 */
-		httpd_purge_socket_data(&httpd_req, msg_in,
+		httpd_purge_socket_data(req, msg_in,
 				sizeof(msg_in), conn);
-		httpd_set_error("File %s not_found", httpd_req.filename);
+		httpd_set_error("File %s not_found", req->filename);
 		httpd_send_error(conn, HTTP_404);
 		return kNoErr;
 	} else {
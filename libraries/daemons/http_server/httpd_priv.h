@@ -67,7 +67,7 @@ void httpd_set_error(const char *fmt, ...);
 
 int handle_message(char *msg_in, int msg_in_len, int conn);
 int httpd_parse_hdr_main(const char *data_p, httpd_request_t *req_p);
-int httpd_handle_message(int conn);
+int httpd_handle_message(int conn, httpd_request_t *req);
 
 /* Various Defines */
 #ifndef NULL
@@ -75,10 +75,16 @@ int httpd_handle_message(int conn);
 #endif
 
 int httpd_wsgi(httpd_request_t *req_p);
+char *httpd_skip_absolute_http_path(char *request);
 
 httpd_ssifunction httpd_ssi(char *);
 int httpd_ssi_init(void);
 int htsys_getln_soc(int sd, char *data_p, int buflen);
+int htsys_recv(int sd, void *buf, size_t n, int flags);
+void htsys_rxbuf_attach(int sd);
+void htsys_rxbuf_detach(int sd);
+int htsys_rxbuf_pending(int sd);
+int httpd_recv_sock(int fd, void *buf, size_t n, int flags);
 
 void httpd_parse_useragent(char *hdrline, httpd_useragent_t *agent);
 
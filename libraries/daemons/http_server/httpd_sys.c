@@ -35,7 +35,116 @@
 
 #include "httpd_priv.h"
 
-int htsys_getln_soc(int sd, char *data_p, int buflen)
+/* Size of the per connection receive buffer. Request lines and headers are
+ * read from the socket in chunks of this size instead of one byte per recv.
+ */
+#ifndef HTTPD_RX_BUF_SIZE
+#define HTTPD_RX_BUF_SIZE 256
+#endif
+
+typedef struct {
+	int sock;
+	char *data;	/* NULL when the slot is free */
+	int head;	/* next unread byte */
+	int tail;	/* end of the received data */
+} htsys_rxbuf_t;
+
+static htsys_rxbuf_t htsys_rxbufs[HTTPD_MAX_CONNECTIONS];
+
+static htsys_rxbuf_t *htsys_rxbuf_find(int sd)
+{
+	int i;
+
+	for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++)
+		if (htsys_rxbufs[i].data != NULL && htsys_rxbufs[i].sock == sd)
+			return &htsys_rxbufs[i];
+	return NULL;
+}
+
+/* Give an accepted client socket a receive buffer. Without one (no free
+ * slot, no memory) the socket is simply read unbuffered.
+ */
+void htsys_rxbuf_attach(int sd)
+{
+	int i;
+
+	for (i = 0; i < HTTPD_MAX_CONNECTIONS; i++) {
+		if (htsys_rxbufs[i].data != NULL)
+			continue;
+		htsys_rxbufs[i].data = malloc(HTTPD_RX_BUF_SIZE);
+		if (htsys_rxbufs[i].data == NULL) {
+			httpd_d("No memory for receive buffer of %d", sd);
+			return;
+		}
+		htsys_rxbufs[i].sock = sd;
+		htsys_rxbufs[i].head = 0;
+		htsys_rxbufs[i].tail = 0;
+		return;
+	}
+}
+
+/* Drop the receive buffer of a socket that is about to be closed, together
+ * with any data still in it.
+ */
+void htsys_rxbuf_detach(int sd)
+{
+	htsys_rxbuf_t *b = htsys_rxbuf_find(sd);
+
+	if (b != NULL) {
+		free(b->data);
+		b->data = NULL;
+	}
+}
+
+/* Number of bytes received on sd but not yet read. A pipelined request can
+ * be waiting here while select() sees nothing on the socket.
+ */
+int htsys_rxbuf_pending(int sd)
+{
+	htsys_rxbuf_t *b = htsys_rxbuf_find(sd);
+
+	return b != NULL ? b->tail - b->head : 0;
+}
+
+/* Refill an empty buffer with whatever the socket has, blocking like recv */
+static int htsys_rxbuf_fill(htsys_rxbuf_t *b)
+{
+	int result = httpd_recv_sock(b->sock, b->data, HTTPD_RX_BUF_SIZE, 0);
+
+	b->head = 0;
+	b->tail = result > 0 ? result : 0;
+	return result;
+}
+
+/* recv() through the receive buffer of sd. Buffered bytes are returned
+ * first, so body data read along with the headers is not lost. Small reads
+ * refill the buffer, large ones go straight to the caller.
+ */
+int htsys_recv(int sd, void *buf, size_t n, int flags)
+{
+	htsys_rxbuf_t *b = htsys_rxbuf_find(sd);
+	int avail, result;
+
+	if (b == NULL || n == 0)
+		return httpd_recv_sock(sd, buf, n, flags);
+
+	if (b->head == b->tail) {
+		if (n >= HTTPD_RX_BUF_SIZE)
+			return httpd_recv_sock(sd, buf, n, flags);
+		result = htsys_rxbuf_fill(b);
+		if (result <= 0)
+			return result;
+	}
+
+	avail = b->tail - b->head;
+	if (n > avail)
+		n = avail;
+	memcpy(buf, b->data + b->head, n);
+	b->head += n;
+	return n;
+}
+
+static int htsys_getln_bytes(int sd, char *data_p, int buflen)
 {
 	int len = 0;
 	char *c_p;
@@ -45,7 +154,7 @@ int htsys_getln_soc(int sd, char *data_p, int buflen)
 	c_p = data_p;
 
 	/* Read one byte at a time */
-	while ((result = httpd_recv(sd, c_p, 1, 0)) != 0) {
+	while ((result = httpd_recv_sock(sd, c_p, 1, 0)) != 0) {
 		/* error on recv */
 		if (result == -1) {
 			*c_p = 0;
@@ -55,7 +164,7 @@ int htsys_getln_soc(int sd, char *data_p, int buflen)
 
 		/* If new line... */
 		if ((*c_p == ISO_nl) || (*c_p == ISO_cr)) {
-			result = httpd_recv(sd, c_p, 1, 0);
+			result = httpd_recv_sock(sd, c_p, 1, 0);
 			if ((*c_p != ISO_nl) && (*c_p != ISO_cr)) {
 				httpd_d("should get double CR LF: %d, %d",
 				      (int)*c_p, result);
@@ -76,3 +185,63 @@ int htsys_getln_soc(int sd, char *data_p, int buflen)
 	*c_p = 0;
 	return len;
 }
+
+/* Read one line, without its CR LF, into data_p. Returns the line length,
+ * 0 when the peer closed the connection, or -kInProgressErr. Lines longer
+ * than buflen - 1 are returned in pieces.
+ */
+int htsys_getln_soc(int sd, char *data_p, int buflen)
+{
+	htsys_rxbuf_t *b = htsys_rxbuf_find(sd);
+	int len = 0;
+	int i, n, copy, result;
+	char *start;
+
+	if (b == NULL)
+		return htsys_getln_bytes(sd, data_p, buflen);
+
+	while (len < buflen - 1) {
+		if (b->head == b->tail) {
+			result = htsys_rxbuf_fill(b);
+			if (result == 0)
+				break;
+			if (result < 0) {
+				data_p[len] = 0;
+				httpd_d("recv failed len: %d", len);
+				return -kInProgressErr;
+			}
+		}
+
+		/* Scan the buffered data for the end of the line */
+		start = b->data + b->head;
+		n = b->tail - b->head;
+		for (i = 0; i < n; i++)
+			if (start[i] == ISO_nl || start[i] == ISO_cr)
+				break;
+
+		copy = i < buflen - 1 - len ? i : buflen - 1 - len;
+		memcpy(data_p + len, start, copy);
+		len += copy;
+		b->head += copy;
+		if (copy < i) {
+			httpd_d("buf full: recv didn't read complete line.");
+			break;
+		}
+		if (i == n)
+			continue;
+
+		/* Consume the line end, CR LF or a lone LF */
+		if (b->data[b->head++] == ISO_cr) {
+			if (b->head == b->tail && htsys_rxbuf_fill(b) <= 0)
+				break;
+			if (b->data[b->head] == ISO_nl)
+				b->head++;
+			else
+				httpd_d("should get double CR LF: %d", b->data[b->head]);
+		}
+		break;
+	}
+
+	data_p[len] = 0;
+	return len;
+}
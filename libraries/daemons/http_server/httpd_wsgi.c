@@ -40,9 +40,152 @@
 
 #include "httpd_priv.h"
 
-#define MAX_WSGI_HANDLERS 32
+/* Registered handlers live in a radix tree keyed by URI. A node holds the
+ * part of the URI following its parent's, and a handler hangs off the node
+ * where its URI ends, so a request is dispatched by walking its path once
+ * instead of testing every handler. Nodes are allocated on registration and
+ * only freed by httpd_wsgi_init(). Handlers may be (un)registered from any
+ * thread while the httpd thread dispatches, so the tree is only walked with
+ * wsgi_mutex held.
+ */
+struct wsgi_node {
+	struct wsgi_node *child;	/* first child, siblings differ in label[0] */
+	struct wsgi_node *next;		/* next sibling */
+	struct httpd_wsgi_call *exact;	/* URI ends here, exact match */
+	struct httpd_wsgi_call *prefix;	/* URI ends here, NO_EXACT_MATCH */
+	int len;
+	char label[1];
+};
+
+static struct wsgi_node wsgi_root;
+static mico_mutex_t wsgi_mutex = NULL;
+
+static void wsgi_lock(void)
+{
+	if (wsgi_mutex != NULL)
+		mico_rtos_lock_mutex(&wsgi_mutex);
+}
+
+static void wsgi_unlock(void)
+{
+	if (wsgi_mutex != NULL)
+		mico_rtos_unlock_mutex(&wsgi_mutex);
+}
+
+static struct wsgi_node *wsgi_node_new(const char *label, int len)
+{
+	struct wsgi_node *node = malloc(sizeof(struct wsgi_node) + len);
+
+	if (node == NULL)
+		return NULL;
+	memset(node, 0, sizeof(struct wsgi_node));
+	memcpy(node->label, label, len);
+	node->len = len;
+	return node;
+}
+
+static void wsgi_node_free(struct wsgi_node *node)
+{
+	struct wsgi_node *next;
+
+	for (; node != NULL; node = next) {
+		next = node->next;
+		wsgi_node_free(node->child);
+		free(node);
+	}
+}
+
+/* Link to the child of node whose label starts with c, or to the NULL at the
+ * end of the child list */
+static struct wsgi_node **wsgi_child_link(struct wsgi_node *node, char c)
+{
+	struct wsgi_node **link;
+
+	for (link = &node->child; *link != NULL; link = &(*link)->next)
+		if ((*link)->label[0] == c)
+			break;
+	return link;
+}
+
+/* Find the node for uri. With create set, missing nodes are added and an
+ * existing label is split where uri leaves it. Called with wsgi_mutex held. */
+static struct wsgi_node *wsgi_lookup(const char *uri, int create)
+{
+	struct wsgi_node *node = &wsgi_root, **link, *child, *split;
+	int i;
+
+	while (*uri) {
+		link = wsgi_child_link(node, *uri);
+		child = *link;
+		if (child == NULL) {
+			if (!create)
+				return NULL;
+			child = wsgi_node_new(uri, strlen(uri));
+			if (child != NULL)
+				*link = child;
+			return child;
+		}
+
+		for (i = 1; i < child->len && uri[i] == child->label[i]; i++)
+			;
+		if (i < child->len) {
+			if (!create)
+				return NULL;
+			split = wsgi_node_new(child->label, i);
+			if (split == NULL)
+				return NULL;
+			memmove(child->label, child->label + i, child->len - i);
+			child->len -= i;
+			split->next = child->next;
+			split->child = child;
+			child->next = NULL;
+			*link = split;
+			child = split;
+		}
+
+		node = child;
+		uri += i;
+	}
+	return node;
+}
+
+/* Find the handler for a request path. An exact handler matches when the
+ * path continues with '?' or only with forward slashes, the longest such URI
+ * wins. Otherwise the handler with the longest NO_EXACT_MATCH URI that is a
+ * prefix of the path is used. */
+static struct httpd_wsgi_call *wsgi_match(const char *request)
+{
+	struct wsgi_node *node = &wsgi_root, *child;
+	struct httpd_wsgi_call *exact = NULL, *prefix = NULL;
+	const char *p = request, *rest;
+
+	wsgi_lock();
+	for (;;) {
+		if (node->prefix)
+			prefix = node->prefix;
+		if (node->exact) {
+			/* '?' terminates a filename, otherwise check for any
+			 * number of forward slashes */
+			rest = p;
+			if (*rest != '?')
+				while (*rest == '/')
+					rest++;
+			if (*rest == '?' || !*rest)
+				exact = node->exact;
+		}
 
-static struct httpd_wsgi_call *calls[MAX_WSGI_HANDLERS];
+		if (!*p)
+			break;
+		child = *wsgi_child_link(node, *p);
+		if (child == NULL || strncmp(p, child->label, child->len))
+			break;
+		p += child->len;
+		node = child;
+	}
+	wsgi_unlock();
+
+	return exact ? exact : prefix;
+}
 
 /** This is the maximum size of a POST response */
 #define MAX_HTTP_POST_RESPONSE 256
@@ -51,33 +194,31 @@ char http_response[MAX_HTTP_POST_RESPONSE];
 /* Register a WSGI call in the list of handlers */
 int httpd_register_wsgi_handler(struct httpd_wsgi_call *wsgi_call)
 {
-	int i, store_index = -1;
+	struct wsgi_node *node;
 
 	if (!wsgi_call->uri)
 		return kNoErr;
 
-	for (i = 0; i < MAX_WSGI_HANDLERS; i++) {
-		/*Find the first empty location in the calls array */
-		if (!calls[i] && store_index == -1) {
-			httpd_d("Found empty location %d", i);
-			store_index = i;
-			continue;
-		}
-		if (strcmp(calls[i]->uri, wsgi_call->uri) == 0) {
-			httpd_d("Found wsgi %s at slot %d",
-			      wsgi_call->uri, i);
-			return kNoErr;
-		}
-	}
-	if (store_index == -1) {
-		httpd_d("Array full.. Cannot register wsgi %s", wsgi_call->uri);
+	wsgi_lock();
+	node = wsgi_lookup(wsgi_call->uri, 1);
+	if (node == NULL) {
+		wsgi_unlock();
+		httpd_d("No memory.. Cannot register wsgi %s", wsgi_call->uri);
 		return -kInProgressErr;
 	}
+	if (node->exact || node->prefix) {
+		wsgi_unlock();
+		httpd_d("Found wsgi %s", wsgi_call->uri);
+		return kNoErr;
+	}
 
-	httpd_d("Register wsgi %s at %d", wsgi_call->uri,
-	      store_index);
+	httpd_d("Register wsgi %s", wsgi_call->uri);
 
-	calls[store_index] = wsgi_call;
+	if (wsgi_call->http_flags & APP_HTTP_FLAGS_NO_EXACT_MATCH)
+		node->prefix = wsgi_call;
+	else
+		node->exact = wsgi_call;
+	wsgi_unlock();
 	return kNoErr;
 }
 
@@ -104,14 +245,20 @@ int httpd_register_wsgi_handlers(struct httpd_wsgi_call *wsgi_call_list, int
 /* Unregister a WSGI call */
 int httpd_unregister_wsgi_handler(struct httpd_wsgi_call *wsgi_call)
 {
-	int i;
+	struct wsgi_node *node;
 
-	for (i = 0; i < MAX_WSGI_HANDLERS; i++) {
-		if (calls[i] && (calls[i] == wsgi_call)) {
-			calls[i] = NULL;
-			return 0;
-		}
+	if (!wsgi_call->uri)
+		return 0;
+
+	wsgi_lock();
+	node = wsgi_lookup(wsgi_call->uri, 0);
+	if (node != NULL) {
+		if (node->exact == wsgi_call)
+			node->exact = NULL;
+		if (node->prefix == wsgi_call)
+			node->prefix = NULL;
 	}
+	wsgi_unlock();
 
 	return 0;
 }
@@ -543,18 +690,6 @@ out:
 	return req->remaining_bytes;
 }
 
-static int get_matching_chars(const char *s1, const char *s2)
-{
-	int match = 0;
-
-	if (s1 != NULL && s2 != NULL) {
-		while (*s1++ == *s2++)
-			match++;
-	}
-	return match;
-
-}
-
 /* Function to skip the initial ipaddress/hostname path in a URL */
 char *httpd_skip_absolute_http_path(char *request)
 {
@@ -622,82 +757,40 @@ int httpd_wsgi(httpd_request_t *req_p)
 {
 	struct httpd_wsgi_call *f;
 	int err = -WM_E_HTTPD_NO_HANDLER;
-	int index, ret = 0;
-	int match_index = -1, cur_char_match = 0;
-	bool found;
 
-	char *ptr, *request = httpd_skip_absolute_http_path(req_p->filename);
+	char *request = httpd_skip_absolute_http_path(req_p->filename);
 
 	httpd_d("httpd_wsgi: looking for %s", request);
-        
-	/* IMP: fixme: Need to check for ? at the end or any forward slashes /
-	 * httpd_validate URI? */
-	for (index = 0; index < MAX_WSGI_HANDLERS; index++) {
-		f = calls[index];
-		if (f == NULL)
-			continue;
-		if (f->http_flags & APP_HTTP_FLAGS_NO_EXACT_MATCH) {
-			ret = get_matching_chars(request,
-						f->uri);
-			if (ret > cur_char_match) {
-				cur_char_match = ret;
-				match_index = index;
-			}
-		} else {
-			if (!strncmp(request, f->uri, strlen(f->uri))) {
-				found = 0;
-				ptr = request;
-				ptr += strlen(f->uri);
-				/* '?' terminates a filename */
-				if (*ptr == '?')
-					found = 1;
-				else {
-					/* Check for any number of
-					 * forward slashes */
-					while (*ptr && (*ptr == '/')) {
-						ptr++;
-					}
-					if (!*ptr)
-						found = 1;
-				}
-				if (found) {
-					httpd_d("Anchored pattern match: %s",
-						f->uri);
-					match_index = index;
-					/* Break if there is an exact match */
-					break;
-				}
-			}
-		}
-	}
-	if (match_index == -1)
+
+	f = wsgi_match(request);
+	if (f == NULL)
 		return err;
 
 	/* Match found. So map the wsgi to this request */
-	req_p->wsgi = calls[match_index];
+	req_p->wsgi = f;
 	switch (req_p->type) {
 	case HTTPD_REQ_TYPE_HEAD:
 	case HTTPD_REQ_TYPE_GET:
-		if (calls[match_index]->get_handler)
-			err = calls[match_index]->get_handler(req_p);
+		if (f->get_handler)
+			err = f->get_handler(req_p);
 		else
 			return err;
 		break;
 	case HTTPD_REQ_TYPE_POST:
-		if (calls[match_index]->set_handler)
-			err = calls[match_index]->set_handler(req_p);
+		if (f->set_handler)
+			err = f->set_handler(req_p);
 		else
 			return err;
 		break;
 	case HTTPD_REQ_TYPE_PUT:
-		if (calls[match_index]->put_handler)
-			err = calls[match_index]->put_handler(req_p);
+		if (f->put_handler)
+			err = f->put_handler(req_p);
 		else
 			return err;
 		break;
 	case HTTPD_REQ_TYPE_DELETE:
-		if (calls[match_index]->delete_handler)
-			err = calls[match_index]->delete_handler(req_p);
+		if (f->delete_handler)
+			err = f->delete_handler(req_p);
 		else
 			return err;
 		break;
@@ -715,7 +808,16 @@ int httpd_wsgi(httpd_request_t *req_p)
 /* Initialise the WSGI handler data structures */
 int httpd_wsgi_init(void)
 {
-	memset(calls, 0, sizeof(calls));
+	if (wsgi_mutex == NULL &&
+	    mico_rtos_init_mutex(&wsgi_mutex) != kNoErr) {
+		wsgi_mutex = NULL;
+		return -kInProgressErr;
+	}
+
+	wsgi_lock();
+	wsgi_node_free(wsgi_root.child);
+	memset(&wsgi_root, 0, sizeof(wsgi_root));
+	wsgi_unlock();
 
 	return kNoErr;
 }
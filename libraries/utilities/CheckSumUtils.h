@@ -36,6 +36,23 @@ void CRC16_Update( CRC16_Context *inContext, const void *inSrc, size_t inLen );
 
 void CRC16_Final( CRC16_Context *inContext, uint16_t *outResult );
 
+/* One-shot CRC16 of a buffer, same result as Init/Update/Final */
+uint16_t CRC16_Calc( const void *inSrc, size_t inLen );
+
+typedef struct
+{
+  uint32_t crc;
+} CRC32_Context;
+
+void CRC32_Init( CRC32_Context *inContext );
+
+void CRC32_Update( CRC32_Context *inContext, const void *inSrc, size_t inLen );
+
+void CRC32_Final( CRC32_Context *inContext, uint32_t *outResult );
+
+/* One-shot CRC32 of a buffer, same result as Init/Update/Final */
+uint32_t CRC32_Calc( const void *inSrc, size_t inLen );
+
 uint8_t mico_CRC8_Table(uint8_t crc8_ori, uint8_t *p, uint32_t counter);
 
 
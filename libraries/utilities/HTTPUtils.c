@@ -589,7 +589,7 @@ bool findHeader ( HTTPHeader_t *inHeader,  char **  outHeaderEnd)
 {
   char *dst = inHeader->buf + inHeader->len;
   char *buf = (char *)inHeader->buf;
-  char *src = (char *)inHeader->buf;
+  char *src;
   size_t          len;
   
   // Check for interleaved binary data (4 byte header that begins with $). See RFC 2326 section 10.12.
@@ -599,6 +599,12 @@ bool findHeader ( HTTPHeader_t *inHeader,  char **  outHeaderEnd)
     return true;
   }
   
+  // Only search the bytes received since the last call. The last two bytes searched before may start an
+  // empty line that the new data completes, so they are searched again. A header that was cleared or
+  // shortened is searched from the start.
+  if( inHeader->scanLen > inHeader->len ) inHeader->scanLen = 0;
+  src = buf + inHeader->scanLen;
+  
   // Find an empty line (separates the header and body). The HTTP spec defines it as CRLFCRLF, but some
   // use LFLF or weird combos like CRLFLF so this handles CRLFCRLF, LFLF, and CRLFLF (but not CRCR).
   *outHeaderEnd = dst;
@@ -624,6 +630,7 @@ bool findHeader ( HTTPHeader_t *inHeader,  char **  outHeaderEnd)
     }
     ++src;
   }
+  inHeader->scanLen = ( inHeader->len > 2 ) ? inHeader->len - 2 : 0;
   return false;
 }
 
@@ -661,6 +668,7 @@ OSStatus HTTPHeaderParse( HTTPHeader_t *ioHeader )
   ioHeader->channelID         = 0;
   ioHeader->contentLength     = 0;
   ioHeader->persistent        = false;
+  ioHeader->fieldCount        = 0;
   
   // Check for a 4-byte interleaved binary data header (see RFC 2326 section 10.12). It has the following format:
   //
@@ -745,17 +753,61 @@ OSStatus HTTPHeaderParse( HTTPHeader_t *ioHeader )
   // There should at least be a blank line after the start line so make sure there's more data.
   require_action( ptr < end, exit, err = kMalformedErr );
   
+  // Index the header fields in one pass, the same way HTTPGetHeaderField finds them, so looking a field up
+  // later does not scan the whole header again. ptr is at the line end of the start line.
+  for( ;; )
+  {
+    const char *        linePtr;
+    const char *        nameEnd;
+    const char *        next;
+    HTTPHeaderField_t * field;
+    
+    if( ( ptr < end ) && ( *ptr == '\r' ) ) ++ptr;
+    if( ( ptr < end ) && ( *ptr == '\n' ) ) ++ptr;
+    linePtr = ptr;
+    while( ( ptr < end ) && ( ( c = *ptr ) != '\r' ) && ( c != '\n' ) ) ++ptr;
+    if( ( ptr >= end ) || ( ptr == linePtr ) ) break; // End of data or the empty line ending the header.
+    
+    nameEnd = linePtr;
+    while( ( nameEnd < ptr ) && ( *nameEnd != ':' ) ) ++nameEnd;
+    if( nameEnd >= ptr ) continue;
+    
+    value = nameEnd + 1;
+    while( ( value < ptr ) && ( ( ( c = *value ) == ' ' ) || ( c == '\t' ) ) ) ++value;
+    
+    // If the next line is a continuation line then keep parsing until we get to the true end.
+    for( ;; )
+    {
+      next = ptr;
+      if( ( next < end ) && ( *next == '\r' ) ) ++next;
+      if( ( next < end ) && ( *next == '\n' ) ) ++next;
+      if( ( next >= end ) || ( ( ( c = *next ) != ' ' ) && ( c != '\t' ) ) ) break;
+      ptr = next + 1;
+      while( ( ptr < end ) && ( ( c = *ptr ) != '\r' ) && ( c != '\n' ) ) ++ptr;
+    }
+    
+    if( ioHeader->fieldCount < kHTTPHeaderMaxFields )
+    {
+      field = &ioHeader->fields[ ioHeader->fieldCount ];
+      field->namePtr  = linePtr;
+      field->nameLen  = (size_t)( nameEnd - linePtr );
+      field->valuePtr = value;
+      field->valueLen = (size_t)( ptr - value );
+    }
+    ioHeader->fieldCount++;
+  }
+  
   // Determine persistence. Note: HTTP 1.0 defaults to non-persistent if a Connection header field is not present.
-  err = HTTPGetHeaderField( ioHeader->buf, ioHeader->len, "Connection", NULL, NULL, &value, &valueSize, NULL );
+  err = HTTPHeaderGetField( ioHeader, "Connection", &value, &valueSize );
   if( err )   ioHeader->persistent = (Boolean)( strnicmpx( ioHeader->protocolPtr, ioHeader->protocolLen, "HTTP/1.0" ) != 0 );
   else        ioHeader->persistent = (Boolean)( strnicmpx( value, valueSize, "close" ) != 0 );
 
-  err = HTTPGetHeaderField( ioHeader->buf, ioHeader->len, "Transfer-Encoding", NULL, NULL, &value, &valueSize, NULL );
+  err = HTTPHeaderGetField( ioHeader, "Transfer-Encoding", &value, &valueSize );
   if( err )   ioHeader->chunkedData = false;
   else        ioHeader->chunkedData = (Boolean)( strnicmpx( value, valueSize, kTransferrEncodingType_CHUNKED ) == 0 );
   
   // Content-Length is such a common field that we get it here during general parsing.
-  HTTPScanFHeaderValue( ioHeader->buf, ioHeader->len, "Content-Length", "%llu", &ioHeader->contentLength );
+  HTTPHeaderScanFValue( ioHeader, "Content-Length", "%llu", &ioHeader->contentLength );
 
   err = kNoErr;
   
@@ -925,6 +977,54 @@ exit:
   return( n );
 }
 
+//===========================================================================================================================
+//  HTTPHeaderGetField
+//
+//  Finds a header field in the index built by HTTPHeaderParse. Only headers with more than kHTTPHeaderMaxFields
+//  fields fall back to scanning the buffer.
+//===========================================================================================================================
+
+OSStatus HTTPHeaderGetField( HTTPHeader_t *inHeader, const char *inName, const char **outValuePtr, size_t *outValueLen )
+{
+  const HTTPHeaderField_t *   field;
+  size_t                      nameLen;
+  size_t                      i, n;
+  
+  nameLen = strlen( inName );
+  n = ( inHeader->fieldCount < kHTTPHeaderMaxFields ) ? inHeader->fieldCount : kHTTPHeaderMaxFields;
+  for( i = 0; i < n; ++i )
+  {
+    field = &inHeader->fields[ i ];
+    if( ( field->nameLen != nameLen ) || ( strnicmp( field->namePtr, inName, nameLen ) != 0 ) ) continue;
+    
+    if( outValuePtr )   *outValuePtr    = field->valuePtr;
+    if( outValueLen )   *outValueLen    = field->valueLen;
+    return( kNoErr );
+  }
+  
+  if( inHeader->fieldCount > kHTTPHeaderMaxFields )
+    return HTTPGetHeaderField( inHeader->buf, inHeader->len, inName, NULL, NULL, outValuePtr, outValueLen, NULL );
+  return kNotFoundErr;
+}
+
+int HTTPHeaderScanFValue( HTTPHeader_t *inHeader, const char *inName, const char *inFormat, ... )
+{
+  int                 n;
+  const char *        valuePtr;
+  size_t              valueLen;
+  va_list             args;
+  
+  n = (int) HTTPHeaderGetField( inHeader, inName, &valuePtr, &valueLen );
+  require_noerr_quiet( n, exit );
+  
+  va_start( args, inFormat );
+  n = VSNScanF( valuePtr, valueLen, inFormat, args );
+  va_end( args );
+  
+exit:
+  return( n );
+}
+
 OSStatus HTTPHeaderMatchMethod( HTTPHeader_t *inHeader, const char *method )
 {
   if( strnicmpx( inHeader->methodPtr, inHeader->methodLen, method ) == 0 )
@@ -982,6 +1082,10 @@ void HTTPHeaderClear( HTTPHeader_t *inHeader )
   if(inHeader->onClearCallback)
     (inHeader->onClearCallback)(inHeader, inHeader->userContext);
 
+  /* Data of the next package is searched for its header from the start */
+  inHeader->scanLen = 0;
+  inHeader->fieldCount = 0;
+
   if(inHeader->chunkedData && (uint32_t *)inHeader->chunkedDataBufferPtr){ //chunk data
     /* Possible to read the header of the next http package */
     if(findCRLF( inHeader->extraDataPtr, inHeader->extraDataLen - chunckheaderLen, &nextPackagePtr ) ){
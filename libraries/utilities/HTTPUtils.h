@@ -86,12 +86,23 @@
 
 #define OTA_Data_Length_per_read        1024
 
+#define kHTTPHeaderMaxFields            16  // Header fields indexed by HTTPHeaderParse, more are still found by a scan.
+
+typedef struct
+{
+    const char *        namePtr;            //! Field name, not null terminated.
+    size_t              nameLen;            //! Number of bytes in the name.
+    const char *        valuePtr;           //! Field value without leading whitespace, including continuation lines.
+    size_t              valueLen;           //! Number of bytes in the value.
+} HTTPHeaderField_t;
+
 
 typedef struct _HTTPHeader_t
 {
     char *              buf;                //! Buffer holding the start line and all headers.
     size_t              bufLen;             //! The size of the buffer.
     size_t              len;                //! Number of bytes in the header.
+    size_t              scanLen;            //! Number of bytes findHeader already searched for the end of the header.
     char *              extraDataPtr;       //! Ptr for any extra data beyond the header, it is alloced when http header is received.
     char *              otaDataPtr;         //! Ptr for any OTA data beyond the header, it is alloced when one OTA package is received.
     size_t              extraDataLen;       //! Length of any extra data beyond the header.
@@ -113,6 +124,9 @@ typedef struct _HTTPHeader_t
 
     int                 firstErr;           //! First error that occurred or kNoErr.
 
+    HTTPHeaderField_t   fields[ kHTTPHeaderMaxFields ]; //! Header fields in order of appearance, set by HTTPHeaderParse.
+    size_t              fieldCount;         //! Number of header fields, may be more than kHTTPHeaderMaxFields.
+
     bool                dataEndedbyClose;
     bool                chunkedData;        //! true=Application should read the next chunked data.
     char *              chunkedDataBufferPtr;     //! Ptr for any extra data beyond the header, it is alloced when http header is received.
@@ -151,6 +165,10 @@ int SocketReadHTTPSBody( mico_ssl_t ssl, HTTPHeader_t *inHeader );
 
 int HTTPHeaderParse( HTTPHeader_t *ioHeader );
 
+OSStatus HTTPHeaderGetField( HTTPHeader_t *inHeader, const char *inName, const char **outValuePtr, size_t *outValueLen );
+
+int HTTPHeaderScanFValue( HTTPHeader_t *inHeader, const char *inName, const char *inFormat, ... );
+
 int HTTPHeaderMatchMethod( HTTPHeader_t *inHeader, const char *method );
 
 int HTTPHeaderMatchURL( HTTPHeader_t *inHeader, const char *url );
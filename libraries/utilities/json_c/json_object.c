@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <math.h>
 
 #include "debug.h"
 #include "printbuf.h"
@@ -202,6 +203,245 @@ struct printbuf * json_object_to_json_string_ex(struct json_object *jso)
 }
 
 
+/* json_object_write */
+
+struct json_writer {
+  char *buf;
+  int size;
+  int pos;
+  int total;
+  json_flush_fn *flush;
+  void *arg;
+  int err;
+};
+
+static void json_writer_put(struct json_writer *w, const char *data, int len)
+{
+  int n;
+
+  w->total += len;
+  if(w->err || !w->buf) return;
+  while(len > 0) {
+    if(w->pos == w->size) {
+      if(!w->flush || w->flush(w->arg, w->buf, w->pos) < 0) {
+        w->err = 1;
+        return;
+      }
+      w->pos = 0;
+    }
+    n = w->size - w->pos;
+    if(n > len) n = len;
+    memcpy(w->buf + w->pos, data, n);
+    w->pos += n;
+    data += n;
+    len -= n;
+  }
+}
+
+#define json_writer_puts(w, s) json_writer_put(w, s, sizeof(s) - 1)
+
+static void json_writer_escape(struct json_writer *w, const char *str, int len)
+{
+  int pos = 0, start_offset = 0;
+  unsigned char c;
+  char esc[6] = { '\\', 'u', '0', '0' };
+
+  while (len--) {
+    c = str[pos];
+    switch(c) {
+    case '\b': esc[1] = 'b'; break;
+    case '\n': esc[1] = 'n'; break;
+    case '\r': esc[1] = 'r'; break;
+    case '\t': esc[1] = 't'; break;
+    case '"':
+    case '\\':
+    case '/': esc[1] = c; break;
+    default:
+      if(c >= ' ') { pos++; continue; }
+      esc[1] = 'u';
+    }
+    json_writer_put(w, str + start_offset, pos - start_offset);
+    if(esc[1] == 'u') {
+      esc[4] = json_hex_chars[c >> 4];
+      esc[5] = json_hex_chars[c & 0xf];
+      json_writer_put(w, esc, 6);
+    } else {
+      json_writer_put(w, esc, 2);
+    }
+    start_offset = ++pos;
+  }
+  json_writer_put(w, str + start_offset, pos - start_offset);
+}
+
+static void json_writer_int(struct json_writer *w, int64_t i)
+{
+  char tmp[21], *p = tmp + sizeof(tmp);
+  uint64_t u = i < 0 ? -(uint64_t)i : (uint64_t)i;
+
+  do {
+    *--p = '0' + (char)(u % 10);
+    u /= 10;
+  } while(u);
+  if(i < 0) *--p = '-';
+  json_writer_put(w, p, tmp + sizeof(tmp) - p);
+}
+
+/* Same digits as printf("%g"): six significant digits, trailing zeros
+ * removed, exponent form below 1e-4 and from 1e6 on */
+static void json_writer_double(struct json_writer *w, double d)
+{
+  char tmp[16], digits[6], *p = tmp;
+  int exp = 0, n = 6, i;
+  unsigned long m;
+  double x, scale, err;
+
+  if(d != d || d - d != 0) {
+    /* nan and inf have no JSON form */
+    json_writer_puts(w, "null");
+    return;
+  }
+  if(d < 0) { *p++ = '-'; d = -d; }
+  if(d == 0) {
+    *p++ = '0';
+    json_writer_put(w, tmp, p - tmp);
+    return;
+  }
+
+  for(x = d; x >= 10.0; x /= 10.0) exp++;
+  for(; x < 1.0; x *= 10.0) exp--;
+  if(exp < -300) {
+    /* the scale below would overflow, these are rare enough for printf */
+    p += snprintf(p, sizeof(tmp) - (p - tmp), "%g", d);
+    json_writer_put(w, tmp, p - tmp);
+    return;
+  }
+
+  /* Scale to six digits in one step. A result that lands exactly on .5
+   * may have been rounded there, fma gives the sign of the error so the
+   * tie is only broken to even when the value really is one. */
+  for(scale = 1.0, i = exp - 5; i > 0; i--) scale *= 10.0;
+  for(; i < 0; i++) scale *= 10.0;
+  if(exp > 5) {
+    x = d / scale;
+    err = fma(-x, scale, d);
+  } else {
+    x = d * scale;
+    err = fma(d, scale, -x);
+  }
+  m = (unsigned long)x;
+  x -= m;
+  if(x > 0.5 || (x == 0.5 && (err > 0 || (err == 0 && (m & 1))))) m++;
+  if(m >= 1000000) { m /= 10; exp++; }
+  if(m < 100000) { m *= 10; exp--; }
+  while(n > 1 && m % 10 == 0) { m /= 10; n--; }
+  for(i = n - 1; i >= 0; i--) { digits[i] = '0' + (char)(m % 10); m /= 10; }
+
+  if(exp < -4 || exp >= 6) {
+    *p++ = digits[0];
+    if(n > 1) {
+      *p++ = '.';
+      for(i = 1; i < n; i++) *p++ = digits[i];
+    }
+    *p++ = 'e';
+    *p++ = exp < 0 ? '-' : '+';
+    if(exp < 0) exp = -exp;
+    if(exp >= 100) { *p++ = '0' + exp / 100; exp %= 100; }
+    *p++ = '0' + exp / 10;
+    *p++ = '0' + exp % 10;
+  } else if(exp >= 0) {
+    for(i = 0; i <= exp; i++) *p++ = i < n ? digits[i] : '0';
+    if(n > exp + 1) {
+      *p++ = '.';
+      for(; i < n; i++) *p++ = digits[i];
+    }
+  } else {
+    *p++ = '0';
+    *p++ = '.';
+    for(i = -1; i > exp; i--) *p++ = '0';
+    for(i = 0; i < n; i++) *p++ = digits[i];
+  }
+  json_writer_put(w, tmp, p - tmp);
+}
+
+static void json_writer_value(struct json_writer *w, struct json_object *jso)
+{
+  struct json_object_iter iter;
+  struct json_object *val;
+  int i;
+
+  if(!jso) {
+    json_writer_puts(w, "null");
+    return;
+  }
+
+  switch(jso->o_type) {
+  case json_type_null:
+    json_writer_puts(w, "null");
+    break;
+  case json_type_boolean:
+    if(jso->o.c_boolean) json_writer_puts(w, "true");
+    else json_writer_puts(w, "false");
+    break;
+  case json_type_int:
+    json_writer_int(w, jso->o.c_int64);
+    break;
+  case json_type_double:
+    json_writer_double(w, jso->o.c_double);
+    break;
+  case json_type_string:
+    json_writer_puts(w, "\"");
+    json_writer_escape(w, jso->o.c_string.str, jso->o.c_string.len);
+    json_writer_puts(w, "\"");
+    break;
+  case json_type_object:
+    i = 0;
+    json_writer_puts(w, "{");
+    json_object_object_foreachC(jso, iter) {
+      if(i++) json_writer_puts(w, ",");
+      json_writer_puts(w, " \"");
+      json_writer_escape(w, iter.key, strlen(iter.key));
+      json_writer_puts(w, "\": ");
+      json_writer_value(w, iter.val);
+    }
+    json_writer_puts(w, " }");
+    break;
+  case json_type_array:
+    json_writer_puts(w, "[");
+    for(i = 0; i < json_object_array_length(jso); i++) {
+      if(i) json_writer_puts(w, ", ");
+      else json_writer_puts(w, " ");
+      val = json_object_array_get_idx(jso, i);
+      json_writer_value(w, val);
+    }
+    json_writer_puts(w, " ]");
+    break;
+  }
+}
+
+int json_object_write(struct json_object *jso, char *buf, int size,
+		      json_flush_fn *flush, void *arg)
+{
+  struct json_writer w;
+
+  memset(&w, 0, sizeof(w));
+  w.buf = size > 0 ? buf : NULL;
+  w.size = size;
+  w.flush = flush;
+  w.arg = arg;
+
+  json_writer_value(&w, jso);
+
+  if(w.buf && !flush) {
+    /* Fixed buffer only, keep room for the terminator */
+    if(w.err || w.pos == w.size) return -1;
+    w.buf[w.pos] = '\0';
+  } else if(w.buf && !w.err && w.pos > 0) {
+    if(flush(arg, w.buf, w.pos) < 0) w.err = 1;
+  }
+  return w.err ? -1 : w.total;
+}
+
+
 /* json_object_object */
 
 static int json_object_object_to_json_string(struct json_object* jso,
@@ -260,11 +500,20 @@ struct lh_table* json_object_get_object(struct json_object *jso)
   }
 }
 
-void json_object_object_add(struct json_object* jso, const char *key,
-			    struct json_object *val)
+int json_object_object_add(struct json_object* jso, const char *key,
+			   struct json_object *val)
 {
+  char *k;
+
   lh_table_delete(jso->o.c_object, key);
-  lh_table_insert(jso->o.c_object, strdup(key), val);
+  k = strdup(key);
+  if(!k || lh_table_insert(jso->o.c_object, k, val) < 0) {
+    /* the table is full, the caller handed over val */
+    free(k);
+    json_object_put(val);
+    return -1;
+  }
+  return 0;
 }
 
 struct json_object* json_object_object_get(struct json_object* jso, const char *key)
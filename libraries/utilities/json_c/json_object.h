@@ -20,7 +20,7 @@ extern "C" {
 
 
 
-#define JSON_OBJECT_DEF_HASH_ENTRIES 1 //default is 16
+#define JSON_OBJECT_DEF_HASH_ENTRIES 1 /* objects start small and double as keys are added */
 
 #undef FALSE
 #define FALSE ((boolean)0)
@@ -114,6 +114,33 @@ extern enum json_type json_object_get_type(struct json_object *obj);
  */
 extern const char* json_object_to_json_string(struct json_object *obj);
 
+/** Output callback for json_object_write
+ * @param arg the argument given to json_object_write
+ * @param data the bytes to write
+ * @param len the number of bytes
+ * @returns a negative value to abort serialization
+ */
+typedef int (json_flush_fn)(void *arg, const char *data, int len);
+
+/** Stringify object to json format without allocating memory
+ *
+ * The output is the same as from json_object_to_json_string. It is
+ * assembled in buf, which is passed to flush whenever it fills up and
+ * once more at the end. Without flush the whole string must fit in buf
+ * including the terminating null. Without buf the length is only
+ * counted, which allows a Content-Length to be sent before the body.
+ *
+ * @param obj the json_object instance
+ * @param buf the output buffer or NULL
+ * @param size the size of buf
+ * @param flush the output callback or NULL
+ * @param arg passed to flush
+ * @returns the length of the JSON text, or -1 when flush failed or the
+ * text did not fit in buf
+ */
+extern int json_object_write(struct json_object *obj, char *buf, int size,
+			     json_flush_fn *flush, void *arg);
+
 
 /* object type methods */
 
@@ -134,12 +161,16 @@ extern struct lh_table* json_object_get_object(struct json_object *obj);
  * fields to objects in code more compact. If you want to retain a reference
  * to an added object you must wrap the passed object with json_object_get
  *
+ * If the field can not be added, because the object already holds
+ * LH_MAX_SIZE fields or memory runs out, val is released.
+ *
  * @param obj the json_object instance
  * @param key the object field name (a private copy will be duplicated)
  * @param val a json_object or NULL member to associate with the given field
+ * @returns 0 on success, -1 if the field was not added
  */
-extern void json_object_object_add(struct json_object* obj, const char *key,
-				   struct json_object *val);
+extern int json_object_object_add(struct json_object* obj, const char *key,
+				  struct json_object *val);
 
 /** Get the json_object associate with a given object field
  * @param obj the json_object instance
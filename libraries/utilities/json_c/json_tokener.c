@@ -60,6 +60,7 @@ const char* json_tokener_errors[] = {
   "object value separator ',' expected",
   "invalid string sequence",
   "expected comment",
+  "out of memory or too many object fields",
 };
 
 /* Stuff for decoding unicode sequences */
@@ -672,7 +673,11 @@ struct json_object* json_tokener_parse_ex(struct json_tokener *tok,
       goto redo_char;
 
     case json_tokener_state_object_value_add:
-      json_object_object_add(current, obj_field_name, obj);
+      if(json_object_object_add(current, obj_field_name, obj) < 0) {
+	/* obj is released, the field name goes with the level on reset */
+	tok->err = json_tokener_error_memory;
+	goto out;
+      }
       free(obj_field_name);
       obj_field_name = NULL;
       saved_state = json_tokener_state_object_sep;
@@ -712,3 +717,367 @@ struct json_object* json_tokener_parse_ex(struct json_tokener *tok,
 
 
 
+
+
+/* Schema driven parsing:
+ * json_tokener_parse_fields() walks the top level object of a message
+ * directly from the text. Values of keys found in the field table are
+ * stored at their offset in the caller's struct, so no json_object is
+ * created for them. Other keys are parsed by json_tokener_parse_ex() and
+ * handed to the fallback. A first pass checks the whole message without
+ * storing anything, so a syntax error never leaves a half applied struct.
+ */
+
+static const char* json_fields_ws(const char *p)
+{
+  while(isspace((int)*p)) p++;
+  return p;
+}
+
+static int json_fields_hex4(const char *p, unsigned int *ucs)
+{
+  int i;
+
+  *ucs = 0;
+  for(i = 0; i < 4; i++) {
+    if(!p[i] || !strchr(json_hex_chars, p[i] | 0x20)) return 0;
+    *ucs = (*ucs << 4) | hexdigit(p[i]);
+  }
+  return 1;
+}
+
+/* Decode the string behind the opening quote into dst like strncpy: the
+ * rest of dst is zeroed, a string that fills dst is not terminated. The
+ * decoded length goes to len. Returns the character behind the closing
+ * quote or NULL. */
+static const char* json_fields_string(const char *p, char quote,
+				      char *dst, size_t size, size_t *len)
+{
+  unsigned char utf[4];
+  unsigned int ucs, lo;
+  size_t n = 0;
+  int i, ulen;
+
+  while(*p != quote) {
+    if(!*p) return NULL;
+    if(*p != '\\') {
+      if(n < size) dst[n] = *p;
+      n++;
+      p++;
+      continue;
+    }
+    ulen = 1;
+    switch(p[1]) {
+    case '"':
+    case '\\':
+    case '/': utf[0] = p[1]; break;
+    case 'b': utf[0] = '\b'; break;
+    case 'n': utf[0] = '\n'; break;
+    case 'r': utf[0] = '\r'; break;
+    case 't': utf[0] = '\t'; break;
+    case 'u':
+      if(!json_fields_hex4(p + 2, &ucs)) return NULL;
+      p += 4;
+      if(IS_HIGH_SURROGATE(ucs) && p[2] == '\\' && p[3] == 'u' &&
+	 json_fields_hex4(p + 4, &lo) && IS_LOW_SURROGATE(lo)) {
+	ucs = DECODE_SURROGATE_PAIR(ucs, lo);
+	p += 6;
+      }
+      if(ucs < 0x80) {
+	utf[0] = ucs;
+      } else if(ucs < 0x800) {
+	utf[0] = 0xc0 | (ucs >> 6);
+	utf[1] = 0x80 | (ucs & 0x3f);
+	ulen = 2;
+      } else if(IS_HIGH_SURROGATE(ucs) || IS_LOW_SURROGATE(ucs)) {
+	memcpy(utf, utf8_replacement_char, 3);
+	ulen = 3;
+      } else if(ucs < 0x10000) {
+	utf[0] = 0xe0 | (ucs >> 12);
+	utf[1] = 0x80 | ((ucs >> 6) & 0x3f);
+	utf[2] = 0x80 | (ucs & 0x3f);
+	ulen = 3;
+      } else {
+	utf[0] = 0xf0 | (ucs >> 18);
+	utf[1] = 0x80 | ((ucs >> 12) & 0x3f);
+	utf[2] = 0x80 | ((ucs >> 6) & 0x3f);
+	utf[3] = 0x80 | (ucs & 0x3f);
+	ulen = 4;
+      }
+      break;
+    default:
+      return NULL;
+    }
+    p += 2;
+    for(i = 0; i < ulen; i++, n++)
+      if(n < size) dst[n] = utf[i];
+  }
+  if(n < size) memset(dst + n, 0, size - n);
+  if(len) *len = n;
+  return p + 1;
+}
+
+static const char* json_fields_literal(const char *p, const char *lit)
+{
+  size_t n = strlen(lit);
+  return strncasecmp(p, lit, n) ? NULL : p + n;
+}
+
+/* Read a number with the rules of json_tokener_state_number, so the check
+ * pass refuses every number the fallback parse would fail on. Numbers
+ * longer than JSON_FIELD_NUMBER_MAX are refused as well. */
+#define JSON_FIELD_NUMBER_MAX 64
+
+static const char* json_fields_number(const char *p, int64_t *num64,
+				      double *numd, int *is_double)
+{
+  char number[JSON_FIELD_NUMBER_MAX];
+  int n;
+
+  *is_double = 0;
+  for(n = 0; p[n] && strchr(json_number_chars, p[n]); n++)
+    if(p[n] == '.' || p[n] == 'e') *is_double = 1;
+  if(n == 0 || n >= (int)sizeof(number)) return NULL;
+  memcpy(number, p, n);
+  number[n] = '\0';
+  if(*is_double) {
+    if(sscanf(number, "%lf", numd) != 1) return NULL;
+  } else {
+    if(json_parse_int64(number, num64)) return NULL;
+  }
+  return p + n;
+}
+
+/* Check one value without storing it */
+static const char* json_fields_skip(const char *p, int depth,
+				    enum json_tokener_error *err)
+{
+  const char *q;
+  char close;
+
+  p = json_fields_ws(p);
+  switch(*p) {
+  case '{':
+  case '[':
+    if(depth >= JSON_TOKENER_MAX_DEPTH) {
+      *err = json_tokener_error_depth;
+      return NULL;
+    }
+    close = (*p == '{') ? '}' : ']';
+    p = json_fields_ws(p + 1);
+    if(*p == close) return p + 1;
+    while(1) {
+      if(close == '}') {
+	if(*p != '"' && *p != '\'') {
+	  *err = json_tokener_error_parse_object_key_name;
+	  return NULL;
+	}
+	if(!(p = json_fields_string(p + 1, *p, NULL, 0, NULL))) {
+	  *err = json_tokener_error_parse_string;
+	  return NULL;
+	}
+	p = json_fields_ws(p);
+	if(*p++ != ':') {
+	  *err = json_tokener_error_parse_object_key_sep;
+	  return NULL;
+	}
+      }
+      if(!(p = json_fields_skip(p, depth + 1, err))) return NULL;
+      p = json_fields_ws(p);
+      if(*p == close) return p + 1;
+      if(*p != ',') {
+	*err = (close == '}') ? json_tokener_error_parse_object_value_sep :
+	  json_tokener_error_parse_array;
+	return NULL;
+      }
+      p = json_fields_ws(p + 1);
+    }
+  case '"':
+  case '\'':
+    if(!(q = json_fields_string(p + 1, *p, NULL, 0, NULL)))
+      *err = json_tokener_error_parse_string;
+    return q;
+  case 't':
+  case 'T':
+  case 'f':
+  case 'F':
+    if(!(q = json_fields_literal(p, json_true_str)) &&
+       !(q = json_fields_literal(p, json_false_str)))
+      *err = json_tokener_error_parse_boolean;
+    return q;
+  case 'n':
+  case 'N':
+    if(!(q = json_fields_literal(p, json_null_str)))
+      *err = json_tokener_error_parse_null;
+    return q;
+  case '\0':
+    *err = json_tokener_error_parse_eof;
+    return NULL;
+  default:
+    if(!strchr(json_number_chars, *p)) {
+      *err = json_tokener_error_parse_unexpected;
+      return NULL;
+    }
+    {
+      int64_t num64;
+      double numd;
+      int is_double;
+      if(!(q = json_fields_number(p, &num64, &numd, &is_double)))
+	*err = json_tokener_error_parse_number;
+      return q;
+    }
+  }
+}
+
+static void json_fields_store_int(char *dst, size_t size, int64_t v)
+{
+  switch(size) {
+  case 1: *(int8_t*)dst = (int8_t)v; break;
+  case 2: *(int16_t*)dst = (int16_t)v; break;
+  case 4: *(int32_t*)dst = (int32_t)v; break;
+  case 8: *(int64_t*)dst = v; break;
+  }
+}
+
+/* Store the value at p in every field that accepts its type. Returns the
+ * end of the value, or NULL when no field took it. */
+static const char* json_fields_store(const char *p, const char *key,
+				     const struct json_field *fields, int count,
+				     char *base, unsigned long *found)
+{
+  const char *end = NULL, *q;
+  int64_t num64;
+  double numd;
+  int i, is_double;
+
+  for(i = 0; i < count; i++) {
+    if(strcmp(fields[i].key, key)) continue;
+    q = NULL;
+    switch(fields[i].type) {
+    case json_field_string:
+      if(*p == '"' || *p == '\'')
+	q = json_fields_string(p + 1, *p, base + fields[i].offset,
+			       fields[i].size, NULL);
+      break;
+    case json_field_boolean:
+      if((q = json_fields_literal(p, json_true_str)) ||
+	 (q = json_fields_literal(p, json_false_str)))
+	json_fields_store_int(base + fields[i].offset, fields[i].size,
+			      (*p | 0x20) == 't');
+      break;
+    case json_field_int:
+    case json_field_double:
+      if(!(q = json_fields_number(p, &num64, &numd, &is_double))) break;
+      if(fields[i].type == json_field_int) {
+	if(is_double) {
+	  q = NULL;
+	  break;
+	}
+	json_fields_store_int(base + fields[i].offset, fields[i].size, num64);
+      } else {
+	if(!is_double) numd = (double)num64;
+	if(fields[i].size == sizeof(float))
+	  *(float*)(base + fields[i].offset) = (float)numd;
+	else
+	  *(double*)(base + fields[i].offset) = numd;
+      }
+      break;
+    }
+    if(q) {
+      end = q;
+      if(found && i < (int)(sizeof(*found) * CHAR_BIT)) *found |= 1UL << i;
+    }
+  }
+  return end;
+}
+
+static enum json_tokener_error json_fields_scan(const char *str,
+						const struct json_field *fields,
+						int count, char *base,
+						unsigned long *found,
+						json_field_fallback_fn *fallback,
+						void *arg, struct json_tokener *tok)
+{
+  enum json_tokener_error err = json_tokener_success;
+  struct json_object *val;
+  char key[JSON_FIELD_KEY_MAX];
+  const char *p, *q;
+  size_t len;
+
+  p = json_fields_ws(str);
+  if(*p != '{') return *p ? json_tokener_error_parse_unexpected :
+		  json_tokener_error_parse_eof;
+  p = json_fields_ws(p + 1);
+  if(*p == '}') goto out;
+
+  while(1) {
+    if(*p != '"' && *p != '\'') {
+      err = json_tokener_error_parse_object_key_name;
+      goto out;
+    }
+    if(!(p = json_fields_string(p + 1, *p, key, sizeof(key), &len))) {
+      err = json_tokener_error_parse_string;
+      goto out;
+    }
+    /* Longer keys cannot be in the table, the fallback gets them cut */
+    if(len >= sizeof(key)) key[sizeof(key) - 1] = '\0';
+    p = json_fields_ws(p);
+    if(*p++ != ':') {
+      err = json_tokener_error_parse_object_key_sep;
+      goto out;
+    }
+    p = json_fields_ws(p);
+
+    if(!base) {
+      if(!(p = json_fields_skip(p, 1, &err))) goto out;
+    } else if(len < sizeof(key) &&
+	      (q = json_fields_store(p, key, fields, count, base, found))) {
+      p = q;
+    } else if(!json_fields_literal(p, json_null_str) && fallback) {
+      json_tokener_reset(tok);
+      val = json_tokener_parse_ex(tok, p, -1);
+      if(tok->err != json_tokener_success) {
+	err = tok->err;
+	goto out;
+      }
+      fallback(key, val, arg);
+      json_object_put(val);
+      p += tok->char_offset;
+    } else {
+      if(!(p = json_fields_skip(p, 1, &err))) goto out;
+    }
+
+    p = json_fields_ws(p);
+    if(*p == '}') break;
+    if(*p != ',') {
+      err = *p ? json_tokener_error_parse_object_value_sep :
+	json_tokener_error_parse_eof;
+      goto out;
+    }
+    p = json_fields_ws(p + 1);
+  }
+
+ out:
+  return err;
+}
+
+enum json_tokener_error json_tokener_parse_fields(const char *str,
+						  const struct json_field *fields,
+						  int count, void *base,
+						  unsigned long *found,
+						  json_field_fallback_fn *fallback,
+						  void *arg)
+{
+  enum json_tokener_error err;
+  struct json_tokener *tok = NULL;
+
+  if(found) *found = 0;
+  err = json_fields_scan(str, fields, count, NULL, NULL, NULL, NULL, NULL);
+  if(err != json_tokener_success) return err;
+  /* The fallback parser is allocated before anything is stored */
+  if(fallback && !(tok = json_tokener_new()))
+    return json_tokener_error_memory;
+  err = json_fields_scan(str, fields, count, (char*)base, found, fallback, arg, tok);
+  if(tok) json_tokener_free(tok);
+  return err;
+}
@@ -33,7 +33,8 @@ enum json_tokener_error {
   json_tokener_error_parse_object_key_sep,
   json_tokener_error_parse_object_value_sep,
   json_tokener_error_parse_string,
-  json_tokener_error_parse_comment
+  json_tokener_error_parse_comment,
+  json_tokener_error_memory
 };
 
 enum json_tokener_state {
@@ -92,6 +93,44 @@ extern struct json_object* json_tokener_parse_verbose(const char *str, enum json
 extern struct json_object* json_tokener_parse_ex(struct json_tokener *tok,
 						 const char *str, int len);
 
+/* Schema driven parsing of a top level object */
+
+#define JSON_FIELD_KEY_MAX 64
+
+enum json_field_type {
+  json_field_string,   /* char array, filled like strncpy */
+  json_field_boolean,  /* bool or int */
+  json_field_int,      /* 1, 2, 4 or 8 byte integer */
+  json_field_double    /* float or double */
+};
+
+struct json_field {
+  const char *key;
+  enum json_field_type type;
+  size_t offset;
+  size_t size;
+};
+
+#define JSON_FIELD(type, key, s, member) \
+  { key, json_field_##type, offsetof(s, member), sizeof(((s *)0)->member) }
+
+typedef void (json_field_fallback_fn)(const char *key, struct json_object *val,
+				      void *arg);
+
+/* Store the members of the object in str straight into the struct at base.
+ * A key may appear in several fields, each of them receives the value. The
+ * bit of every stored field index (up to 32) is set in found. Keys not in
+ * the table, values of another type and keys in their own table whose
+ * value is null are not stored; except for null, they are passed to
+ * fallback as a json_object that is released afterwards. The whole
+ * message is checked before anything is stored. */
+extern enum json_tokener_error json_tokener_parse_fields(const char *str,
+							 const struct json_field *fields,
+							 int count, void *base,
+							 unsigned long *found,
+							 json_field_fallback_fn *fallback,
+							 void *arg);
+
 #ifdef __cplusplus
 }
 #endif
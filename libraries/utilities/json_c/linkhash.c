@@ -120,15 +120,27 @@ void lh_table_free(struct lh_table *t)
 }
 
 
+/* Small tables are filled up completely and searched from the first slot,
+ * larger ones are kept below the load factor so probe runs stay short */
+static int lh_table_full(struct lh_table *t)
+{
+	if(t->size <= LH_LINEAR_MAX) return t->count >= t->size;
+	return (t->count + 1) * LH_LOAD_DEN > t->size * LH_LOAD_NUM;
+}
+
 int lh_table_insert(struct lh_table *t, void *k, const void *v)
 {
-	unsigned long h, n;
+	unsigned long n;
+	int new_size;
 
-	//if(t->count > t->size * 0.66) lh_table_resize(t, t->size * 2); 
-	if(t->count >= t->size) lh_table_resize(t, t->size + 1); 
+	if(lh_table_full(t) && t->size < LH_MAX_SIZE) {
+		new_size = t->size ? t->size * 2 : 1;
+		if(new_size > LH_MAX_SIZE) new_size = LH_MAX_SIZE;
+		lh_table_resize(t, new_size);
+	}
+	if(t->count >= t->size) return -1;
 
-	h = t->hash_fn(k);
-	n = h % t->size;
+	n = (t->size <= LH_LINEAR_MAX) ? 0 : t->hash_fn(k) % t->size;
 
 	while( 1 ) {
 		if(t->table[n].k == LH_EMPTY || t->table[n].k == LH_FREED) break;
@@ -155,10 +167,18 @@ int lh_table_insert(struct lh_table *t, void *k, const void *v)
 
 struct lh_entry* lh_table_lookup_entry(struct lh_table *t, const void *k)
 {
-	unsigned long h = t->hash_fn(k);
-	unsigned long n = h % t->size;
+	unsigned long n;
 	int count = 0;
 
+	if(t->size <= LH_LINEAR_MAX) {
+		for(n = 0; n < t->size; n++) {
+			if(t->table[n].k != LH_EMPTY && t->table[n].k != LH_FREED &&
+			   t->equal_fn(t->table[n].k, k)) return &t->table[n];
+		}
+		return NULL;
+	}
+
+	n = t->hash_fn(k) % t->size;
 	while( count < t->size ) {
 		if(t->table[n].k == LH_EMPTY) return NULL;
 		if(t->table[n].k != LH_FREED &&
@@ -31,6 +31,23 @@ extern "C" {
  */
 #define LH_FREED (void*)-2
 
+/**
+ * Tables up to this size are scanned linearly and never hashed.
+ */
+#define LH_LINEAR_MAX 8
+
+/**
+ * Largest table, size and count are stored in a byte.
+ */
+#define LH_MAX_SIZE 255
+
+/**
+ * Hashed tables grow once more than LH_LOAD_NUM/LH_LOAD_DEN of the slots
+ * are used.
+ */
+#define LH_LOAD_NUM 3
+#define LH_LOAD_DEN 4
+
 struct lh_entry;
 
 /**